@@ -0,0 +1,171 @@
+/// @file benchmark.h
+// TODO: Doxygen comments
+
+#ifndef _BENCHMARK_H
+#define _BENCHMARK_H 1
+
+#include <stdint.h>
+
+/// If boot-time benchmarks are run at the end of `kernel_main`. Benchmarks
+///  allocate and free a fair bit of early memory, so are off by default.
+#ifndef KERNEL_BENCHMARKS
+#define KERNEL_BENCHMARKS 0
+#endif
+
+
+/** @brief Runs all boot-time benchmarks
+ * 
+ * Runs each of the boot-time benchmarks in turn, logging their results. Should
+ * only be called once the boot allocator has handed over to the page
+ * allocator. @ref benchmark_bootmem is run separately before then.
+*/
+void benchmark_run_all();
+
+/** @brief Returns the next number from a xorshift generator
+ * 
+ * Gives benchmarks the same sequence of random numbers on every boot, so
+ * their workloads can be compared between runs.
+ * 
+ * @param state State of the generator, seeded with any non-zero value
+*/
+uint32_t benchmark_random(uint32_t* state);
+
+/** @brief Benchmarks searching the boot allocator's bitmap
+ * 
+ * Makes a thousand single page @ref bootmem_aligned_alloc calls, timing each
+ * of them against a bit-by-bit scan of the bitmap from the same goal and
+ * cursor, over the same state. The allocations are freed afterwards.
+*/
+void benchmark_bootmem();
+
+/** @brief Stress tests the page allocator
+ * 
+ * Runs a random workload of allocations and frees of order 0 to 4 against the
+ * page allocator, and logs the allocations and frees per second along with
+ * how fragmented ZONE_NORMAL is part way through. Everything is freed
+ * afterwards, and the free blocks are checked to have merged back together.
+*/
+void benchmark_page_allocator();
+
+/** @brief Benchmarks the per-CPU lists of single pages
+ * 
+ * Times bursts of single page allocations and frees with the default
+ * watermarks, then with the lists cut down to a single page so nearly every
+ * page goes through the zone lock. Logs the cycles per operation for both,
+ * and how often the lists were hit.
+*/
+void benchmark_page_pcp();
+
+/** @brief Benchmarks the pools of pages zeroed while idle
+ * 
+ * Times allocating zeroed movable single pages with the pools empty, so each is zeroed
+ * as it's allocated, then again after filling the pools with
+ * @ref page_zero_idle. Logs the cycles per page for both, and for zeroing the
+ * pages in the pools.
+*/
+void benchmark_page_zero();
+
+/** @brief Stress tests grouping by mobility and compaction
+ * 
+ * Repeatedly fills ZONE_NORMAL with single pages, mostly movable with a few
+ * unmovable ones mixed in, then frees a random half of them. After each
+ * round, tries to allocate a whole pageblock, and logs if it succeeded, if it
+ * needed compaction, and the fragmentation index beforehand. Everything is
+ * freed afterwards. Every single page is allocated zeroed, and any that
+ * wasn't is warned about, as frames compaction freed must not pass for zeroed.
+*/
+void benchmark_page_compaction();
+
+/** @brief Benchmarks clearing and copying whole pages
+ * 
+ * Times memset and memcpy against @ref clear_page and @ref copy_page over the
+ * same pages, and logs the cycles per page for each, along with what
+ * @ref page_mem_initialise measured for every variant.
+*/
+void benchmark_page_mem();
+
+/** @brief Benchmarks copying pages across the ZONE_HIGHMEM boundary
+ * 
+ * Copies pages from the linear mapping to ZONE_HIGHMEM and back, mapping them
+ * with @ref kmap_atomic and with @ref kmap, and logs the cycles per page for
+ * each against a copy within the linear mapping. Also times mapping and
+ * unmapping on its own, and logs how often @ref kmap found the page still
+ * mapped.
+*/
+void benchmark_highmem();
+
+/** @brief Benchmarks allocating and freeing in the vmalloc area
+ * 
+ * Keeps a set of areas of random sizes live, replacing random ones so the
+ * free ranges fragment, and logs the cycles per @ref vmalloc and @ref vfree,
+ * and how many TLB flushes the lazily unmapped areas took. Then compares a
+ * large @ref vmalloc with a contiguous block of the same size.
+*/
+void benchmark_vmalloc();
+
+/** @brief Benchmarks allocating memory on first touch against up front
+ * 
+ * Allocates an area, touches one page in every 64, every 8, and every page of
+ * it, and frees it again, once with @ref vzalloc and once with
+ * @ref vmalloc_demand, and logs the cycles for each and per page fault. Then
+ * shares an area copy-on-write and writes to both copies, logging the cycles
+ * per fault that copied a page and per fault that only made it writable.
+*/
+void benchmark_page_fault();
+
+/** @brief Benchmarks entering and leaving interrupt handlers
+ * 
+ * Raises software interrupts with `int` in a loop, on the breakpoint
+ * exception, whose stub saves every register, and on two interrupt vectors,
+ * whose stubs only save what C may clobber. Logs the cycles per interrupt from
+ * before the `int` to the handler, and from the handler back after `iret`, for
+ * each vector.
+*/
+void benchmark_idt();
+
+/** @brief Compares the slab allocator with whole pages for small objects
+ * 
+ * For objects of 32 to 512 bytes, times allocating and freeing a batch of
+ * objects from a slab cache, and the same number of pages from the page
+ * allocator. Logs the cycles per object and the pages used by each.
+*/
+void benchmark_slab();
+
+/** @brief Compares freeing heap memory with and without its size
+ * 
+ * Allocates a mix of mostly small objects and a few spans of pages with
+ * @ref malloc, then times freeing them with @ref free, which looks the size up
+ * in the page descriptors, and with @ref free_sized, which goes straight to
+ * the size class. Logs the cycles per free for each.
+*/
+void benchmark_heap();
+
+/** @brief Benchmarks sweeping through the linear mapping
+ * 
+ * Reads a word from every page of 64 MiB of the linear mapping, first with the
+ * large pages set up by @ref paging_initialise, then with the same region
+ * temporarily remapped by 4 KiB page tables, and logs the cycles per page for
+ * each. Skipped if large pages aren't enabled.
+*/
+void benchmark_linear_sweep();
+
+/** @brief Benchmarks the kernel TLB cost of switching page directory
+ * 
+ * Switches page directory and re-touches 256 kernel pages, with global pages
+ * enabled and then with CR4.PGE temporarily cleared, and logs the cycles per
+ * switch for each. Misses aren't measured, so the cost of each kernel TLB miss
+ * is estimated by assuming every page re-touched without PGE missed. Skipped
+ * if PGE isn't enabled.
+*/
+void benchmark_pgd_switch();
+
+/** @brief Benchmarks scrolling and clearing the terminal
+ * 
+ * Times full-screen scrolls and clears with video memory mapped
+ * write-combining, then again with it temporarily mapped write-back, and logs
+ * the cycles for each, and if scrolls read video memory or only write it. The
+ * screen is cleared afterwards. Skipped if the PAT isn't enabled.
+*/
+void benchmark_terminal();
+
+#endif
@@ -170,6 +170,11 @@
 #define VIDEO_MEMORY_ADDR_MONOCHROME ((uint16_t*)0xb0000)
 #define VIDEO_MEMORY_ADDR_COLOUR ((uint16_t*)0xb8000)
 
+// Physical range of the legacy video memory window, holding the graphics and
+//  text mode buffers
+#define VIDEO_MEMORY_START 0x000a0000
+#define VIDEO_MEMORY_END   0x000c0000
+
 #endif
 
 /** @} */
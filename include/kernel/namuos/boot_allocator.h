@@ -9,26 +9,70 @@
 #include <namuos/multiboot.h>
 #include <namuos/terminal.h>
 
+/// Largest alignment supported by the boot allocator (a 4 MiB page)
+#define BOOTMEM_MAX_ALIGN 0x00400000
+
+/// Number of PFNs tracked by each word of the bootmem bitmap
+#define BOOTMEM_BITS_PER_WORD 32
+
+// Zones the boot allocator keeps a next-fit cursor for
+#define BOOTMEM_ZONE_DMA    0 ///< Searches starting in ZONE_DMA
+#define BOOTMEM_ZONE_NORMAL 1 ///< Searches starting in ZONE_NORMAL
+#define BOOTMEM_NR_ZONES    2
+
+/// Per-zone allocation counters for the boot allocator
+typedef struct {
+	uint32_t alloc_count;     ///< Number of successful allocations
+	uint32_t bytes_requested; ///< Total bytes asked for by those allocations
+	uint32_t pages_reserved;  ///< Pages newly reserved to satisfy them
+} bootmem_zone_stats_t;
+
+/// Counters for how much early memory is used and wasted
+typedef struct {
+	bootmem_zone_stats_t zones[BOOTMEM_NR_ZONES]; ///< Counters per zone allocated from
+	uint32_t failed_allocs;         ///< Allocations that couldn't be satisfied
+	uint32_t refused_partial_pages; ///< Pages only partly freed, so left reserved, by @ref bootmem_free
+	uint32_t largest_free_run;      ///< Largest free run when the bitmap was retired
+} bootmem_stats_t;
+
 /// Information needed for the boot memory allocator
 typedef struct {
 	uint32_t pfn_start;   ///< First PFN available to allocator
 	uint32_t pfn_end;     ///< Last PFN available to allocator
-	char* bitmap;         ///< Bitmap representing free/allocated pages
+	uint32_t* bitmap;     ///< Bitmap representing free/allocated pages
 	uint32_t last_pfn;    ///< Last page allocated
 	uint32_t last_offset; ///< Offset within the last page allocated
+
+	/// Next-fit cursor per zone. Every page between the start of the zone and
+	///  its cursor is reserved, so searches from that zone start here.
+	uint32_t next_pfn[BOOTMEM_NR_ZONES];
+
+	bootmem_stats_t stats; ///< Usage and fragmentation counters
 } bootmem_data_t;
 
+/// Global boot allocator state, set up by @ref bootmem_initialise
+extern bootmem_data_t bootmem_data;
+
 
 /** @brief Initialises boot allocator 
  * 
- * Sets up the global @ref bootmem_data for memory between 0 and the end of
- * ZONE_NORMAL. Will initialise the bitmap, and reserve all addresses from the
- * start of memory up until where the bitmap ends in memory.
+ * Builds the physical memory layout with @ref memblock_initialise, then sets
+ * up the global @ref bootmem_data for memory between 0 and the end of RAM, or
+ * the end of ZONE_NORMAL if there is more RAM than that. Only frames that the
+ * multiboot memory map reports as available and unused start out free; holes
+ * and everything up to the end of the bitmap are reserved.
  * 
- * @note Bitmap is allocated within ZONE_DMA to make things easy, immediately
- * after the kernel image. This ends up using about 29 KiB of the precious 16
- * MiB in ZONE_DMA, but it'll be replaced with the physical page allocator soon
- * enough.
+ * @note Bitmap is allocated in the first free pages of ZONE_NORMAL, which
+ * `boot.S` maps before paging is initialised, so it doesn't use up any of the
+ * precious 16 MiB in ZONE_DMA. Only if there's no ZONE_NORMAL does it go in
+ * the first free pages after the kernel image. It takes up to about 28 KiB,
+ * but it'll be replaced with the physical page allocator soon enough. The
+ * bitmap is stored as 32-bit words so it can be scanned and updated a whole
+ * word at a time.
+ * 
+ * @note Once initialised, the bitmap is what tracks which frames below
+ * ZONE_HIGHMEM are in use. The memblock lists remain the record of the memory
+ * layout, and of frames above ZONE_HIGHMEM, for the page allocator.
  * 
  * @param mb_info Multiboot info passed by GRUB.
 */
@@ -63,7 +107,9 @@ void bootmem_free(uintptr_t paddr, size_t size);
 
 /** @brief Allocate `size` bytes from ZONE_NORMAL
  * 
- * Allocates `size` bytes from ZONE_NORMAL.
+ * Allocates `size` bytes from ZONE_NORMAL. Allocation will be aligned to the
+ * cache line size reported by CPUID, so small allocations never share a cache
+ * line.
  * 
  * @param size Number of bytes to allocate
  * 
@@ -73,7 +119,9 @@ void* bootmem_alloc(size_t size);
 
 /** @brief Allocate `size` bytes from ZONE_DMA
  * 
- * Allocates `size` bytes from ZONE_DMA.
+ * Allocates `size` bytes from ZONE_DMA. Allocation will be aligned to the
+ * cache line size reported by CPUID, so small allocations never share a cache
+ * line.
  * 
  * @param size Number of bytes to allocate
  * 
@@ -95,9 +143,9 @@ void* bootmem_aligned_alloc(size_t size);
  * 
  * Allocates `size` bytes from ZONE_DMA. Allocation will be page aligned.
  * 
- * @note This should be used sparingly. One situation is in setting up paging,
- * where only the first 8 MiB are pre-mapped by boot, and ZONE_NORMAL starts at
- * 16 MiB.
+ * @note This should be used sparingly, for memory that has to be in ZONE_DMA,
+ * or on machines with no ZONE_NORMAL at all. Everything else should come
+ * from ZONE_NORMAL, which `boot.S` maps too.
  * 
  * @param size Number of bytes to allocate
  * 
@@ -105,6 +153,48 @@ void* bootmem_aligned_alloc(size_t size);
 */
 void* bootmem_aligned_alloc_low(size_t size);
 
-// TODO: bootmem_free_all();
+/** @brief Allocates `size` bytes aligned to `align`, searching from `goal`
+ * 
+ * Allocates `size` bytes at the first suitably aligned address at or after
+ * `goal`. Allocations smaller than a page are packed into the partly used page
+ * left by the previous allocation where alignment allows.
+ * 
+ * @param size Number of bytes to allocate
+ * @param align Alignment of the allocation. Must be a power of two, no larger
+ * than @ref BOOTMEM_MAX_ALIGN.
+ * @param goal Physical address to start searching from, e.g.
+ * `ZONE_NORMAL_OFFSET`
+ * 
+ * @returns Pointer to allocated block, or NULL on failure
+*/
+void* bootmem_alloc_aligned(size_t size, uint32_t align, uintptr_t goal);
+
+/** @brief Retires the boot allocator, handing all free frames to the page
+ * allocator.
+ * 
+ * Walks the bitmap a word at a time, giving each run of free frames to the
+ * page allocator as the largest naturally aligned blocks that fit, then does
+ * the same for the pages holding the bitmap itself. Free frames above
+ * ZONE_NORMAL, which the bitmap doesn't track, are taken from memblock. The
+ * time taken and number of pages recovered is logged.
+ * 
+ * @note The boot allocator must not be used after this is called. Frames that
+ * are still reserved (including partially used pages) stay that way for good.
+ * 
+ * @returns Number of pages handed to the page allocator
+*/
+uint32_t bootmem_free_all();
+
+/** @brief Logs boot allocator usage and fragmentation
+ * 
+ * Logs, per zone, the number of allocations, bytes requested, pages reserved
+ * for them, and the bytes wasted in partial pages and alignment padding. Also
+ * logs the size of the bitmap, the largest free run of frames, failed
+ * allocations, and partial pages that @ref bootmem_free refused to free.
+ * 
+ * @note Can be called after @ref bootmem_free_all, in which case the largest
+ * free run is the one seen when the bitmap was retired.
+*/
+void bootmem_dump_stats();
 
 #endif
@@ -0,0 +1,184 @@
+/// @file cpu.h
+// TODO: Doxygen comments
+
+#ifndef _CPU_H
+#define _CPU_H 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// CPUID leaf 1 EDX feature bits
+#define CPUID_EDX_PSE   (1U << 3)  ///< 4 MiB pages supported
+#define CPUID_EDX_TSC   (1U << 4)  ///< Time-stamp counter supported
+#define CPUID_EDX_PAE   (1U << 6)  ///< Physical address extension supported
+#define CPUID_EDX_PGE   (1U << 13) ///< Global pages supported
+#define CPUID_EDX_PAT   (1U << 16) ///< Page attribute table supported
+#define CPUID_EDX_CLFSH (1U << 19) ///< CLFLUSH supported, line size in EBX
+#define CPUID_EDX_FXSR  (1U << 24) ///< FXSAVE and FXRSTOR supported
+#define CPUID_EDX_SSE   (1U << 25) ///< SSE supported
+#define CPUID_EDX_SSE2  (1U << 26) ///< SSE2 supported, including MOVNTI
+
+// CPUID leaf 0x80000001 EDX feature bits
+#define CPUID_EXT_EDX_NX (1U << 20) ///< Execute-disable bit supported
+
+// CR0 control bits
+#define CR0_MP (1U << 1) ///< WAIT/FWAIT honour CR0.TS
+#define CR0_EM (1U << 2) ///< x87 and SSE instructions are emulated (trap)
+
+// CR4 control bits
+#define CR4_PSE        (1U << 4)  ///< Page size extensions (4 MiB pages)
+#define CR4_PAE        (1U << 5)  ///< Physical address extension (3-level paging)
+#define CR4_PGE        (1U << 7)  ///< Global pages kept across CR3 reloads
+#define CR4_OSFXSR     (1U << 9)  ///< SSE instructions and FXSAVE enabled
+#define CR4_OSXMMEXCPT (1U << 10) ///< Unmasked SSE exceptions raise #XM
+
+// Model-specific registers
+#define MSR_EFER 0xC0000080 ///< Extended feature enable register
+#define EFER_NXE (1U << 11) ///< Execute-disable bit enabled in PAE entries
+#define MSR_PAT  0x00000277 ///< Page attribute table
+
+/// Cache line size assumed if CPUID doesn't report one
+#define CPU_DEFAULT_CACHE_LINE_SIZE 64
+
+/// Maximum number of CPUs. Only the boot CPU is brought up for now.
+#define NR_CPUS 1
+
+/// Information about the CPU, read with CPUID
+typedef struct {
+	uint32_t max_leaf;         ///< Highest basic CPUID leaf supported
+	uint32_t features_ecx;     ///< Leaf 1 ECX feature flags
+	uint32_t features_edx;     ///< Leaf 1 EDX feature flags
+	uint32_t max_ext_leaf;     ///< Highest extended CPUID leaf supported
+	uint32_t ext_features_edx; ///< Leaf 0x80000001 EDX feature flags
+	uint32_t cache_line_size;  ///< Cache line size in bytes
+	uint32_t tsc_khz;          ///< Time-stamp counter frequency, or 0 if unknown
+} cpu_info_t;
+
+/// Global CPU information, set up by @ref cpu_initialise
+extern cpu_info_t cpu_info;
+
+
+/** @brief Reads CPU information with CPUID
+ * 
+ * Fills in @ref cpu_info, measures the time-stamp counter frequency against
+ * the PIT, and enables SSE if it's supported. Should be called before
+ * anything that depends on CPU features, including the boot allocator.
+*/
+void cpu_initialise();
+
+/** @brief Gets the index of the CPU this is running on
+ * 
+ * @returns Index from 0 to `NR_CPUS-1`. Always 0 until other CPUs are brought
+ * up.
+*/
+static inline uint32_t smp_processor_id() {
+	return 0;
+}
+
+/** @brief Executes CPUID for the given leaf
+ * 
+ * @param leaf Value of EAX to query
+ * @param eax Set to the resulting EAX
+ * @param ebx Set to the resulting EBX
+ * @param ecx Set to the resulting ECX
+ * @param edx Set to the resulting EDX
+*/
+static inline void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+	asm volatile ("cpuid"
+		: "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+		: "a"(leaf), "c"(0));
+}
+
+/** @brief Reads the CR0 control register
+ * 
+ * @returns Current value of CR0
+*/
+static inline uint32_t read_cr0() {
+	uint32_t cr0;
+	asm volatile ("mov %%cr0, %0" : "=r"(cr0));
+	return cr0;
+}
+
+/** @brief Writes the CR0 control register
+ * 
+ * @param cr0 New value of CR0
+*/
+static inline void write_cr0(uint32_t cr0) {
+	asm volatile ("mov %0, %%cr0" : : "r"(cr0) : "memory");
+}
+
+/** @brief Reads the CR2 control register
+ * 
+ * @returns Linear address that caused the last page fault
+*/
+static inline uint32_t read_cr2() {
+	uint32_t cr2;
+	asm volatile ("mov %%cr2, %0" : "=r"(cr2));
+	return cr2;
+}
+
+/** @brief Reads the CR4 control register
+ * 
+ * @returns Current value of CR4
+*/
+static inline uint32_t read_cr4() {
+	uint32_t cr4;
+	asm volatile ("mov %%cr4, %0" : "=r"(cr4));
+	return cr4;
+}
+
+/** @brief Writes the CR4 control register
+ * 
+ * @param cr4 New value of CR4
+*/
+static inline void write_cr4(uint32_t cr4) {
+	asm volatile ("mov %0, %%cr4" : : "r"(cr4) : "memory");
+}
+
+/** @brief Reads a model-specific register
+ * 
+ * @param msr Index of the MSR to read
+ * 
+ * @returns Current 64-bit value of the MSR
+*/
+static inline uint64_t rdmsr(uint32_t msr) {
+	uint32_t lo, hi;
+	asm volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+/** @brief Writes a model-specific register
+ * 
+ * @param msr Index of the MSR to write
+ * @param value New 64-bit value of the MSR
+*/
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+	asm volatile ("wrmsr"
+		: : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32))
+		: "memory");
+}
+
+/** @brief Writes back and invalidates every cache
+ * 
+ * Needed after changing the memory type of a mapping, so no lines cached under
+ * the old type are left behind. Very slow, so only for rare changes.
+*/
+static inline void wbinvd() {
+	asm volatile ("wbinvd" : : : "memory");
+}
+
+/** @brief Reads the CPU time-stamp counter
+ * 
+ * Reads the 64-bit time-stamp counter with `rdtsc`. Used for timing sections
+ * of code in cycles.
+ * 
+ * @returns Current value of the time-stamp counter
+*/
+static inline uint64_t rdtsc() {
+	uint32_t lo, hi;
+	asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+#endif
@@ -0,0 +1,127 @@
+/// @file highmem.h
+// TODO: Doxygen comments
+
+#ifndef _HIGHMEM_H
+#define _HIGHMEM_H 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <namuos/cpu.h>
+#include <namuos/page.h>
+#include <namuos/page_allocator.h>
+#include <namuos/paging.h>
+
+
+/// Start of the window of persistent mappings made by @ref kmap. It's covered
+///  by a single page table, so every slot's PTE is in the same table.
+#define PKMAP_BASE 0xFF800000
+
+/// Number of persistent mapping slots, one page table's worth
+#define LAST_PKMAP PTRS_PER_PTE
+
+/// Gets the address mapped by persistent mapping slot `slot`
+#define PKMAP_ADDR(slot) (PKMAP_BASE + ((uintptr_t)(slot) << PAGE_SHIFT))
+
+/// Start of the per-CPU windows used by @ref kmap_atomic, in the last 4 MiB
+///  of the address space (the last 2 MiB with PAE)
+#define KMAP_ATOMIC_BASE 0xFFC00000
+
+/// Number of @ref kmap_atomic mappings each CPU can hold at once
+#define KMAP_ATOMIC_SLOTS 16
+
+/// Gets the address of slot `slot` of CPU `cpu`'s @ref kmap_atomic window
+#define KMAP_ATOMIC_ADDR(cpu, slot) \
+	(KMAP_ATOMIC_BASE + ((uintptr_t)((cpu) * KMAP_ATOMIC_SLOTS + (slot)) << PAGE_SHIFT))
+
+_Static_assert(PKMAP_ADDR(LAST_PKMAP) <= KMAP_ATOMIC_BASE,
+	"The kmap window must end before the kmap_atomic windows");
+_Static_assert(NR_CPUS * KMAP_ATOMIC_SLOTS <= PTRS_PER_PTE,
+	"Every kmap_atomic window must fit in one page table");
+
+/// Counters kept by @ref kmap, for the benchmarks
+typedef struct {
+	uint32_t hits;    ///< Pages that were still mapped from an earlier kmap
+	uint32_t maps;    ///< Pages given a new slot
+	uint32_t flushes; ///< Times every unused slot was unmapped at once
+	uint32_t fails;   ///< Calls that found every slot in use
+} kmap_stats_t;
+
+/// Counters kept by @ref kmap
+extern kmap_stats_t kmap_stats;
+
+
+/** @brief Sets up the windows for mapping ZONE_HIGHMEM
+ * 
+ * Allocates the page tables covering the @ref kmap and @ref kmap_atomic
+ * windows in @ref kernel_pgd up front, so every page directory that copies
+ * the kernel's entries sees the same tables, and mapping a page only ever
+ * writes a PTE. Must be called after the page allocator is set up, and before
+ * anything maps a page from ZONE_HIGHMEM.
+*/
+void highmem_initialise();
+
+/** @brief Gets if a page is outside the linear mapping */
+static inline bool page_is_highmem(const page_t* page) {
+	return page->zone == PAGE_ZONE_HIGHMEM;
+}
+
+/** @brief Maps a page until @ref kunmap is called on it
+ * 
+ * Pages in the linear mapping are returned straight away. Pages in
+ * ZONE_HIGHMEM are given one of @ref LAST_PKMAP slots, shared by everyone
+ * mapping the same page. Slots aren't unmapped when their last user is done
+ * with them, so mapping the same page again is only a lookup. Once the slots
+ * run out, every unused one is unmapped with a single TLB flush. Takes a lock,
+ * so @ref kmap_atomic is cheaper for short uses.
+ * 
+ * @param page Page to map
+ * 
+ * @returns Address the page is mapped at, or NULL if every slot is in use.
+ * There's nothing to wait on for a slot to be freed yet.
+*/
+void* kmap(page_t* page);
+
+/** @brief Drops a mapping made by @ref kmap
+ * 
+ * @param page Page passed to @ref kmap
+*/
+void kunmap(page_t* page);
+
+/** @brief Maps a page for a short time on this CPU
+ * 
+ * Pages in the linear mapping are returned straight away. Pages in
+ * ZONE_HIGHMEM are mapped at the next free slot of this CPU's window, which
+ * costs one PTE write and an `invlpg`, with no lock. The mapping is only
+ * valid on this CPU, so nothing may switch CPUs while it's held, and each
+ * must be dropped with @ref kunmap_atomic in the reverse order of mapping.
+ * 
+ * @param page Page to map
+ * 
+ * @returns Address the page is mapped at
+*/
+void* kmap_atomic(page_t* page);
+
+/** @brief Drops the last mapping made by @ref kmap_atomic on this CPU
+ * 
+ * The PTE is left in place, as the next @ref kmap_atomic of the slot
+ * invalidates it anyway.
+ * 
+ * @param addr Address returned by @ref kmap_atomic
+*/
+void kunmap_atomic(void* addr);
+
+/** @brief Zeroes a page, wherever it is
+ * 
+ * @param page Page to zero
+*/
+void clear_highpage(page_t* page);
+
+/** @brief Copies a page, wherever either of them is
+ * 
+ * @param dest Page to copy to
+ * @param src Page to copy from
+*/
+void copy_highpage(page_t* dest, page_t* src);
+
+#endif
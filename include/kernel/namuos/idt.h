@@ -0,0 +1,131 @@
+/// @file idt.h
+// TODO: Doxygen comments
+
+#ifndef _IDT_H
+#define _IDT_H 1
+
+// Only the constants below are usable from assembly
+#ifndef __ASSEMBLER__
+#include <stdint.h>
+#endif
+
+
+/// Number of entries in the IDT, one for each vector
+#define IDT_ENTRIES 256
+
+/** @brief Number of vectors reserved for CPU exceptions
+ * 
+ * Their entry stubs save every register in an @ref interrupt_frame_t, and the
+ * rest only save what C code may clobber, in an @ref interrupt_fast_frame_t.
+*/
+#define IDT_EXCEPTIONS 32
+
+// Exception vectors
+#define IDT_VECTOR_BREAKPOINT 3  ///< Breakpoint (#BP), raised by `int3`
+#define IDT_VECTOR_PAGE_FAULT 14 ///< Page fault (#PF), with an error code
+
+// Types of gate, each present and only usable from ring 0
+#define IDT_GATE_INTERRUPT 0x8E ///< 32-bit interrupt gate, entered with interrupts disabled
+#define IDT_GATE_TRAP      0x8F ///< 32-bit trap gate, entered with interrupts left as they were
+
+
+#ifndef __ASSEMBLER__
+
+/// An entry of the IDT, pointing at the code to run for a vector
+typedef struct {
+	uint16_t offset_low;  ///< Bits 0 - 15 of the entry point
+	uint16_t selector;    ///< Code segment selector of the entry point
+	uint8_t zero;         ///< Reserved (must be 0)
+	uint8_t type;         ///< `IDT_GATE_*` type, privilege level, and present bit
+	uint16_t offset_high; ///< Bits 16 - 31 of the entry point
+} __attribute__((packed)) idt_gate_t;
+
+/** @brief Registers saved on the stack by an entry stub
+ * 
+ * The stub pushes the general purpose registers with `pushal` on top of the
+ * vector, the error code (0 for vectors without one), and what the CPU pushed.
+ * Interrupts are only taken in ring 0 for now, so the CPU doesn't switch
+ * stacks or push the old stack pointer.
+*/
+typedef struct {
+	uint32_t edi;        ///< Saved EDI
+	uint32_t esi;        ///< Saved ESI
+	uint32_t ebp;        ///< Saved EBP
+	uint32_t esp;        ///< ESP when `pushal` ran, pointing at `vector`
+	uint32_t ebx;        ///< Saved EBX
+	uint32_t edx;        ///< Saved EDX
+	uint32_t ecx;        ///< Saved ECX
+	uint32_t eax;        ///< Saved EAX
+	uint32_t vector;     ///< Vector that was raised
+	uint32_t error_code; ///< Error code pushed by the CPU, or 0
+	uint32_t eip;        ///< Instruction that was interrupted, or that faulted
+	uint32_t cs;         ///< Code segment of `eip`
+	uint32_t eflags;     ///< EFLAGS before the interrupt
+} interrupt_frame_t;
+
+/** @brief Registers saved on the stack by the entry stub of an interrupt
+ * 
+ * Vectors from @ref IDT_EXCEPTIONS on only save the registers the C calling
+ * convention lets a handler clobber, on top of the vector and what the CPU
+ * pushed. The handler preserves the rest itself. None of these vectors have
+ * an error code.
+*/
+typedef struct {
+	uint32_t edx;    ///< Saved EDX
+	uint32_t ecx;    ///< Saved ECX
+	uint32_t eax;    ///< Saved EAX
+	uint32_t vector; ///< Vector that was raised
+	uint32_t eip;    ///< Instruction that was interrupted
+	uint32_t cs;     ///< Code segment of `eip`
+	uint32_t eflags; ///< EFLAGS before the interrupt
+} interrupt_fast_frame_t;
+
+/// Handles an exception, given every register saved by its entry stub
+typedef void (*idt_exception_handler_t)(interrupt_frame_t* frame);
+
+/// Handles an interrupt, given the few registers saved by its entry stub
+typedef void (*idt_interrupt_handler_t)(interrupt_fast_frame_t* frame);
+
+
+/** @brief Loads the IDT
+ * 
+ * Points every vector at its entry stub, and page faults at
+ * @ref page_fault_handle. Any other exception panics, and any other interrupt
+ * is logged and ignored, until a handler is set for it. Should be called as
+ * early as possible, so faults are reported instead of resetting the machine.
+*/
+void idt_initialise();
+
+/** @brief Sets the handler of an exception vector
+ * 
+ * @param vector Vector to set, below @ref IDT_EXCEPTIONS
+ * @param handler Handler to call, or NULL to panic when it's raised
+ * @return The previous handler
+*/
+idt_exception_handler_t idt_set_exception_handler(uint8_t vector, idt_exception_handler_t handler);
+
+/** @brief Sets the handler of an interrupt vector
+ * 
+ * @param vector Vector to set, from @ref IDT_EXCEPTIONS on
+ * @param handler Handler to call, or NULL to log and ignore it when it's raised
+ * @return The previous handler
+*/
+idt_interrupt_handler_t idt_set_interrupt_handler(uint8_t vector, idt_interrupt_handler_t handler);
+
+/** @brief Logs the registers saved for an exception, as critical messages
+ * 
+ * @param frame Registers saved by the entry stub
+*/
+void idt_dump_frame(const interrupt_frame_t* frame);
+
+/** @brief Points a vector of the IDT at an entry point
+ * 
+ * @param vector Vector to set
+ * @param entry Entry stub to run, which must return with `iret`
+ * @param type `IDT_GATE_*` type of the gate
+*/
+void idt_set_gate(uint8_t vector, void (*entry)(), uint8_t type);
+
+#endif // __ASSEMBLER__
+
+#endif
@@ -0,0 +1,31 @@
+/// @file io.h
+// TODO: Doxygen comments
+
+#ifndef _IO_H
+#define _IO_H 1
+
+#include <stdint.h>
+
+
+/** @brief Writes a byte to an I/O port
+ * 
+ * @param port Port to write to
+ * @param value Byte to write
+*/
+static inline void outb(uint16_t port, uint8_t value) {
+	asm volatile ("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+/** @brief Reads a byte from an I/O port
+ * 
+ * @param port Port to read from
+ * 
+ * @returns Byte read
+*/
+static inline uint8_t inb(uint16_t port) {
+	uint8_t value;
+	asm volatile ("inb %1, %0" : "=a"(value) : "Nd"(port));
+	return value;
+}
+
+#endif
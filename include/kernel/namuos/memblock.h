@@ -0,0 +1,133 @@
+/// @file memblock.h
+// TODO: Doxygen comments
+
+#ifndef _MEMBLOCK_H
+#define _MEMBLOCK_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <namuos/multiboot.h>
+
+
+/// Maximum number of regions tracked in each of the memory and reserved lists
+#define MEMBLOCK_MAX_REGIONS 128
+
+/// A contiguous range of physical memory, `[base, base+size)`
+typedef struct {
+	uint64_t base; ///< Physical address of the start of the region
+	uint64_t size; ///< Size of the region in bytes
+} memblock_region_t;
+
+/// A sorted list of non-overlapping, non-adjacent regions
+typedef struct {
+	uint32_t count; ///< Number of regions in use
+	memblock_region_t regions[MEMBLOCK_MAX_REGIONS]; ///< Regions sorted by base
+} memblock_type_t;
+
+/// Physical memory layout, and what parts of it are in use
+typedef struct {
+	memblock_type_t memory;   ///< Usable RAM reported by the bootloader
+	memblock_type_t reserved; ///< Parts of `memory` that are in use
+} memblock_t;
+
+/// Global early memory layout, set up by @ref memblock_initialise
+extern memblock_t memblock;
+
+
+/** @brief Builds the memory and reserved region lists
+ * 
+ * Adds every available region in the multiboot memory map to the memory list,
+ * falling back to `mem_lower`/`mem_upper` if there is no memory map. The low
+ * 1 MiB, kernel image, and multiboot structures are then reserved.
+ * 
+ * @param mb_info Multiboot info passed by GRUB. Addresses must already have
+ * been fixed with @ref multiboot_fix_addresses.
+*/
+void memblock_initialise(multiboot_info_t* mb_info);
+
+/** @brief Adds `[base, base+size)` to the list of usable memory
+ * 
+ * Adds the range to the memory list, merging it with any overlapping or
+ * adjacent regions.
+ * 
+ * @param base Physical address of the start of the range
+ * @param size Size of the range in bytes
+*/
+void memblock_add(uint64_t base, uint64_t size);
+
+/** @brief Marks `[base, base+size)` as reserved
+ * 
+ * Adds the range to the reserved list, merging it with any overlapping or
+ * adjacent regions. The regions to merge are found by binary search.
+ * 
+ * @param base Physical address of the start of the range
+ * @param size Size of the range in bytes
+*/
+void memblock_reserve(uint64_t base, uint64_t size);
+
+/** @brief Removes `[base, base+size)` from the reserved list
+ * 
+ * Removes the range from the reserved list, splitting any region that only
+ * partially overlaps it.
+ * 
+ * @param base Physical address of the start of the range
+ * @param size Size of the range in bytes
+*/
+void memblock_free(uint64_t base, uint64_t size);
+
+/** @brief Allocates `size` bytes between `start` and `end`
+ * 
+ * Finds the lowest free range of memory between `start` and `end` that fits
+ * `size` bytes aligned to `align`, and reserves it.
+ * 
+ * @param size Number of bytes to allocate
+ * @param align Alignment of the allocation. Must be a power of two.
+ * @param start Lowest physical address the allocation may start at
+ * @param end Physical address the allocation must end before
+ * 
+ * @returns Physical address of the allocation, or 0 on failure
+*/
+uint64_t memblock_alloc_range(uint64_t size, uint64_t align, uint64_t start, uint64_t end);
+
+/** @brief Finds the next free range of memory at or after `from`
+ * 
+ * Finds the lowest range of memory that is in the memory list, but not in the
+ * reserved list, and ends after `from`. Free ranges can be walked with
+ * ```c
+ * uint64_t start, end;
+ * for (uint64_t addr = 0; memblock_next_free_range(addr, &start, &end); addr = end)
+ *     ...
+ * ```
+ * 
+ * @param from Physical address to start searching from
+ * @param start Set to the start of the free range (never lower than `from`)
+ * @param end Set to the end of the free range
+ * 
+ * @returns true if a free range was found, otherwise false
+*/
+bool memblock_next_free_range(uint64_t from, uint64_t* start, uint64_t* end);
+
+/** @brief Checks if `addr` is usable RAM
+ * 
+ * @param addr Physical address to check
+ * 
+ * @returns true if `addr` falls within the memory list, otherwise false
+*/
+bool memblock_is_memory(uint64_t addr);
+
+/** @brief Checks if `addr` is reserved
+ * 
+ * @param addr Physical address to check
+ * 
+ * @returns true if `addr` falls within the reserved list, otherwise false
+*/
+bool memblock_is_reserved(uint64_t addr);
+
+/** @brief Gets the end of usable RAM
+ * 
+ * @returns Physical address of the end of the highest memory region
+*/
+uint64_t memblock_end_of_ram();
+
+#endif
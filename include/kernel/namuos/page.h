@@ -0,0 +1,97 @@
+/// @file page.h
+// TODO: Doxygen comments
+
+#ifndef _PAGE_H
+#define _PAGE_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <namuos/paging.h>
+
+
+// Flags for @ref page_t
+#define PG_RESERVED (1<<0) ///< Not managed by the page allocator
+#define PG_BUDDY    (1<<1) ///< First page of a free block in the page allocator
+#define PG_HEAD     (1<<2) ///< First page of an allocated block of order above 0
+#define PG_PCP      (1<<3) ///< Free single page on a per-CPU list
+#define PG_SLAB     (1<<4) ///< Part of a slab of the slab allocator
+#define PG_SPAN     (1<<5) ///< First page of a heap allocation of whole pages
+#define PG_ZERO     (1<<6) ///< First page of a block known to be all zeroes
+#define PG_POOL     (1<<7) ///< Free single page in a zone's pool of zeroed pages
+#define PG_MOVABLE  (1<<8) ///< Allocated single page that compaction can migrate
+
+/** @brief Descriptor for a physical page frame
+ * 
+ * One of these exists in @ref mem_map for every frame, so it's kept to 32
+ * bytes. @ref mem_map is aligned to 32 bytes, so a descriptor never straddles
+ * two cache lines. The fields the page allocator touches on every allocation
+ * and free come first, so they share the first 16 bytes.
+*/
+typedef struct page {
+	uint32_t flags;    ///< `PG_*` flags
+	uint8_t order;     ///< Order of the free or allocated block this page heads
+	uint8_t zone;      ///< Zone the frame is in, as a `PAGE_ZONE_*` index
+	uint16_t reserved; ///< Unused, keeps the fields below aligned
+	struct page* next; ///< Next page in whatever list the page is on
+	struct page* prev; ///< Previous page in whatever list the page is on
+
+	// The rest is for whoever owns the page
+	uint32_t refcount; ///< Number of users of the page
+	void* owner;       ///< Owner-specific pointer
+	uint32_t index;    ///< Owner-specific index
+	uint32_t data;     ///< Owner-specific data
+} page_t;
+
+_Static_assert(sizeof(page_t) == 32, "page_t must be 32 bytes");
+
+/// Array of page descriptors, indexed by PFN
+extern page_t* mem_map;
+
+/// Number of descriptors in @ref mem_map. PFNs from here on aren't managed.
+extern uint32_t mem_map_pages;
+
+
+/** @brief Allocates and initialises @ref mem_map
+ * 
+ * Sizes the array from the end of RAM reported by memblock, and allocates it
+ * from the boot allocator. If RAM is large enough that the array would take
+ * more than an eighth of the linear mapping, frames past what that covers are
+ * left out. Every descriptor starts out as @ref PG_RESERVED, until its frame
+ * is given to the page allocator.
+*/
+void mem_map_initialise();
+
+/** @brief Gets the descriptor of the frame `pfn` */
+static inline page_t* pfn_to_page(uint32_t pfn) {
+	return &mem_map[pfn];
+}
+
+/** @brief Gets the PFN of the frame described by `page` */
+static inline uint32_t page_to_pfn(const page_t* page) {
+	return (uint32_t)(page - mem_map);
+}
+
+/** @brief Gets the physical address of the frame described by `page` */
+static inline phys_addr_t page_to_phys(const page_t* page) {
+	return PFN_PHYS(page_to_pfn(page));
+}
+
+/** @brief Gets the virtual address of the frame described by `page`
+ * 
+ * @note Only valid for frames in the linear mapping, so not for ZONE_HIGHMEM.
+ * Those have to be mapped with @ref kmap or @ref kmap_atomic.
+*/
+static inline void* page_to_virt(const page_t* page) {
+	return __to_virt(page_to_phys(page));
+}
+
+/** @brief Gets the descriptor of the frame mapped at `addr`
+ * 
+ * @note Only valid for addresses in the linear mapping.
+*/
+static inline page_t* virt_to_page(const void* addr) {
+	return pfn_to_page(__to_phys(addr) >> PAGE_SHIFT);
+}
+
+#endif
@@ -0,0 +1,377 @@
+/// @file page_allocator.h
+// TODO: Doxygen comments
+
+#ifndef _PAGE_ALLOCATOR_H
+#define _PAGE_ALLOCATOR_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <namuos/cpu.h>
+#include <namuos/page.h>
+#include <namuos/spinlock.h>
+
+
+/// Number of block orders. Blocks are 2^order pages, from 1 page to 4 MiB.
+#define PAGE_MAX_ORDER 11
+
+// Zones the page allocator splits physical memory into. See `paging.h` for
+//  where each starts.
+#define PAGE_ZONE_DMA     0
+#define PAGE_ZONE_NORMAL  1
+#define PAGE_ZONE_HIGHMEM 2
+#define PAGE_NR_ZONES     3
+
+// Migrate types. Free memory is grouped by how easily what's allocated from
+//  it can be moved or freed, in pageblocks of `2^PAGEBLOCK_ORDER` pages, so
+//  the pages that can't be moved don't end up scattered across every block.
+#define PAGE_MIGRATE_UNMOVABLE   0 ///< Pinned where it is, such as page tables
+#define PAGE_MIGRATE_RECLAIMABLE 1 ///< Can be freed on demand, such as caches
+#define PAGE_MIGRATE_MOVABLE     2 ///< Can be moved by compaction
+#define PAGE_MIGRATE_TYPES       3
+
+/// Order of each pageblock, the size of the largest block
+#define PAGEBLOCK_ORDER (PAGE_MAX_ORDER - 1)
+
+/// Fragmentation index above which compaction is worth trying, in thousandths.
+///  Below it, allocations fail for lack of memory rather than fragmentation.
+#define PAGE_COMPACT_THRESHOLD 500
+
+/// Returned by @ref page_alloc_pfn when no block could be allocated
+#define PAGE_PFN_NONE 0xffffffff
+
+// Default watermarks for the per-CPU lists of single pages. See
+//  @ref per_cpu_pages_t.
+#define PAGE_PCP_BATCH 16                   ///< Pages moved to or from the zone at once
+#define PAGE_PCP_HIGH  (6 * PAGE_PCP_BATCH) ///< Length above which a batch is drained
+#define PAGE_PCP_LOW   0                    ///< Length at which a batch is refilled
+
+// Defaults for the pool of zeroed pages in each zone. See @ref zone_t.
+#define PAGE_ZERO_POOL_HIGH  256 ///< Pages the idle loop zeroes ahead of time
+#define PAGE_ZERO_IDLE_BATCH 16  ///< Pages zeroed per call from the idle loop
+
+// Allocation flags. The low bits pick which zones @ref page_alloc_pfn may
+//  use. Without any, ZONE_NORMAL is used, falling back to ZONE_DMA.
+typedef uint32_t gfp_t;
+#define GFP_KERNEL    0x0 ///< ZONE_NORMAL, then ZONE_DMA
+#define GFP_DMA       0x1 ///< Only ZONE_DMA
+#define GFP_HIGHMEM   0x2 ///< ZONE_HIGHMEM, then ZONE_NORMAL, then ZONE_DMA
+#define GFP_ZONE_MASK 0x3 ///< Bits of the flags that pick the zones
+#define GFP_COLD      0x4 ///< Prefer a single page that's likely not in cache
+#define GFP_ZERO      0x8 ///< Zero the allocation
+
+// Allocation flags that pick the migrate type. Without either, the allocation
+//  is unmovable.
+#define GFP_RECLAIMABLE 0x10 ///< Freed by a shrinker when memory is short
+#define GFP_MOVABLE     0x20 ///< Can be moved, see @ref page_set_movable
+
+/// Operations on a page allocated with @ref GFP_MOVABLE that compaction uses
+///  to move it
+typedef struct {
+	/** @brief Moves the owner's references from `page` to `new_page`
+	 * 
+	 * Called after the contents of the page, and its `owner`, `index` and
+	 * `data`, have been copied to `new_page`. `page` is freed afterwards.
+	 * 
+	 * @returns If the page was moved. If not, `new_page` is freed instead.
+	*/
+	bool (*migrate)(page_t* page, page_t* new_page);
+} page_movable_ops_t;
+
+/** @brief Per-CPU lists of free single pages in front of a zone
+ * 
+ * Single pages are allocated from and freed to the lists of the current CPU
+ * without taking the zone lock. There's a list for each migrate type, and
+ * each page's `index` is the list it's on. The most recently freed, and so
+ * hottest, pages are at the head, and the coldest at the tail. When there
+ * are `low` pages or fewer, or none of the type wanted, `batch` pages of that
+ * type are taken from the zone at once, and when there are more than `high`,
+ * the `batch` coldest go back to the zone.
+ * 
+ * Each CPU's lists have a cache line to themselves, so CPUs never share one
+ * on the fast path.
+*/
+typedef struct {
+	page_t* head[PAGE_MIGRATE_TYPES]; ///< Hottest page of each type
+	page_t* tail[PAGE_MIGRATE_TYPES]; ///< Coldest page of each type
+	uint32_t count; ///< Number of pages on all the lists
+	uint32_t low;   ///< Length at or below which the list is refilled
+	uint32_t high;  ///< Length above which the list is drained
+	uint32_t batch; ///< Number of pages refilled or drained at once
+
+	uint32_t alloc_hits;   ///< Allocations served straight from the list
+	uint32_t alloc_misses; ///< Allocations that had to refill the list first
+	uint32_t free_hits;    ///< Frees that stayed on the list
+	uint32_t free_drains;  ///< Frees that had to drain the list
+} __attribute__((aligned(CPU_DEFAULT_CACHE_LINE_SIZE))) per_cpu_pages_t;
+
+/** @brief A zone of physical memory with its own buddy allocator
+ * 
+ * Each free block is on the list for its order and the migrate type of the
+ * pageblock it's in. Allocations take from the lists of their own type first,
+ * then take the largest block they can find of another type, claiming its
+ * whole pageblock if enough of it is free.
+ * 
+ * Each zone also keeps a pool of free single pages that were zeroed ahead of
+ * time by @ref page_zero_idle. Movable allocations with @ref GFP_ZERO take from
+ * the pool first, so they don't have to zero pages themselves.
+*/
+typedef struct {
+	const char* name;       ///< Name of the zone, for logging
+	uint32_t pfn_start;     ///< First PFN spanned by the zone
+	uint32_t pfn_end;       ///< PFN after the last one spanned by the zone
+	uint32_t free_pages;    ///< Number of free pages, not counting per-CPU lists or the pool
+	uint32_t managed_pages; ///< Number of pages given to the zone
+	spinlock_t lock;        ///< Held while changing the free lists
+
+	page_t* free_list[PAGE_MAX_ORDER][PAGE_MIGRATE_TYPES]; ///< First page of each free block
+	uint32_t nr_free[PAGE_MAX_ORDER]; ///< Number of free blocks per order, of any type
+
+	uint8_t* pageblock_types;  ///< Migrate type of each pageblock spanned by the zone
+	uint32_t nr_pageblocks;    ///< Number of entries in `pageblock_types`
+	uint32_t pageblock_steals; ///< Allocations that took a block of another type
+	uint32_t pageblock_claims; ///< Pageblocks changed to the type of an allocation
+
+	per_cpu_pages_t pcp[NR_CPUS]; ///< Lists of free single pages per CPU
+
+	page_t* zero_pool;        ///< Free single pages already zeroed
+	uint32_t zero_count;      ///< Number of pages in `zero_pool`
+	uint32_t zero_high;       ///< Number of pages the idle loop fills the pool to
+	uint32_t zero_hits;       ///< @ref GFP_ZERO allocations that were already zeroed
+	uint32_t zero_misses;     ///< @ref GFP_ZERO allocations that had to be zeroed
+	uint64_t zero_idle_bytes; ///< Bytes zeroed by @ref page_zero_idle
+} zone_t;
+
+/// Information needed for the page allocator
+typedef struct {
+	zone_t zones[PAGE_NR_ZONES]; ///< Each zone, indexed by `PAGE_ZONE_*`
+	uint32_t free_pages;         ///< Free pages in all zones, not counting per-CPU lists or pools
+} page_allocator_t;
+
+/// Global page allocator state
+extern page_allocator_t page_allocator;
+
+
+/** @brief Initialises the page allocator
+ * 
+ * Sets up @ref mem_map with @ref mem_map_initialise, then works out the span
+ * of each zone. Uses the boot allocator, so must be called before
+ * @ref bootmem_free_all. Frames are given to the allocator afterwards by
+ * @ref bootmem_free_all.
+*/
+void page_allocator_initialise();
+
+/** @brief Gives a block of `2^order` free frames starting at `pfn` to the
+ * page allocator
+ * 
+ * Used to hand frames over from the boot allocator. `pfn` must be aligned to
+ * `2^order` pages, and the block must be covered by @ref mem_map. The block is
+ * merged with any free buddies.
+ * 
+ * @param pfn First PFN of the block
+ * @param order Order of the block
+*/
+void page_allocator_add_block(uint32_t pfn, uint32_t order);
+
+/** @brief Allocates `2^order` contiguous page frames
+ * 
+ * Takes the smallest free block that fits from the first zone allowed by `gfp`
+ * that has one, splitting it as needed. Single pages come from the per-CPU
+ * list of the zone instead, the hottest one unless `gfp` has @ref GFP_COLD.
+ * Blocks of the migrate type picked by `gfp` are used first. If there are no
+ * free blocks big enough, the zones are compacted when that's likely to help.
+ * 
+ * If the descriptor of the first frame has @ref PG_ZERO set, the whole block
+ * is known to be zeroed. It's cleared again when the block is freed. With
+ * @ref GFP_ZERO, movable single pages come from the pool of zeroed pages if it
+ * has any, and anything else is zeroed if it isn't already, so @ref PG_ZERO is
+ * always set.
+ * 
+ * @param order Order of the allocation
+ * @param gfp Allocation flags, such as @ref GFP_KERNEL
+ * 
+ * @returns PFN of the first page frame, or @ref PAGE_PFN_NONE on failure
+*/
+uint32_t page_alloc_pfn(uint32_t order, gfp_t gfp);
+
+/** @brief Frees `2^order` contiguous page frames from @ref page_alloc_pfn
+ * 
+ * Merges the block with its buddy for as long as the buddy is free too.
+ * Single pages go on the head of the per-CPU list instead, as they're likely
+ * still in cache.
+ * 
+ * @param pfn PFN of the first page frame
+ * @param order Order the frames were allocated with
+*/
+void page_free_pfn(uint32_t pfn, uint32_t order);
+
+/** @brief Frees a single page frame that's likely not in cache
+ * 
+ * Like @ref page_free_pfn, but puts the page on the tail of the per-CPU list,
+ * so it's the last to be reused and the first to go back to the zone.
+ * 
+ * @param pfn PFN of the page frame
+*/
+void page_free_pfn_cold(uint32_t pfn);
+
+/** @brief Allocates exactly `count` contiguous page frames
+ * 
+ * Allocates the smallest block that fits, and gives the frames past `count`
+ * straight back. The first frame is aligned to the size of that block.
+ * 
+ * @param count Number of frames, up to the size of the largest block
+ * @param gfp Allocation flags, such as @ref GFP_KERNEL
+ * 
+ * @returns PFN of the first page frame, or @ref PAGE_PFN_NONE on failure
+*/
+uint32_t page_alloc_pfn_exact(uint32_t count, gfp_t gfp);
+
+/** @brief Frees `count` contiguous page frames
+ * 
+ * The frames can be all or part of anything from the page allocator, such as
+ * the end of a block from @ref page_alloc_pfn_exact that's no longer needed.
+ * 
+ * @param pfn PFN of the first page frame
+ * @param count Number of frames
+*/
+void page_free_pfn_exact(uint32_t pfn, uint32_t count);
+
+/** @brief Allocates the specific frames `[pfn, pfn+count)`, if they're free
+ * 
+ * Used to grow an allocation in place. Only frames in the buddy lists count
+ * as free, not ones on the per-CPU lists.
+ * 
+ * @param pfn PFN of the first page frame
+ * @param count Number of frames
+ * 
+ * @returns If every frame was free and has been allocated. Nothing is
+ * allocated otherwise.
+*/
+bool page_claim_pfn_range(uint32_t pfn, uint32_t count);
+
+/** @brief Lets compaction move a page allocated with @ref GFP_MOVABLE
+ * 
+ * Sets the page's `owner` to `ops`, leaving `index` and `data` for the caller
+ * to find its references with. The page stays movable until it's freed.
+ * 
+ * @param pfn PFN of the page, allocated with order 0
+ * @param ops How to move the page
+ * 
+ * @returns If the page was made movable. Pages that aren't single pages in a
+ * movable pageblock can't be, which is only logged if it's not the pageblock
+ * that's wrong, as an allocation can fall back to other types' pageblocks.
+*/
+bool page_set_movable(uint32_t pfn, const page_movable_ops_t* ops);
+
+/** @brief Compacts a zone, moving movable pages to rebuild large free blocks
+ * 
+ * Scans up from the bottom of the zone for pages made movable with
+ * @ref page_set_movable, and down from the top of the zone for free pages in
+ * movable pageblocks, moving each page found at the bottom into a free page
+ * at the top until the two scans meet. The pages on the per-CPU lists and in
+ * the pools of zeroed pages are given back to the zone first. Pages in
+ * ZONE_HIGHMEM are copied through @ref kmap_atomic.
+ * 
+ * @param zone Zone to compact
+ * 
+ * @returns Number of pages moved
+*/
+uint32_t page_compact_zone(zone_t* zone);
+
+/** @brief Sets the watermarks of every per-CPU list
+ * 
+ * Lists longer than the new `high` are drained straight away.
+ * 
+ * @param low Length at or below which a list is refilled
+ * @param high Length above which a list is drained. Must be above `low`.
+ * @param batch Number of pages refilled or drained at once. Must be between 1
+ * and `high`.
+ * 
+ * @returns If the watermarks were valid and set
+*/
+bool page_pcp_set_watermarks(uint32_t low, uint32_t high, uint32_t batch);
+
+/** @brief Gives every page on the per-CPU lists back to their zones */
+void page_pcp_drain_all();
+
+/** @brief Zeroes free pages ahead of time, for movable @ref GFP_ZERO allocations
+ * 
+ * Called from the idle loop. Takes free single pages from the movable
+ * pageblocks of each zone whose pool is below its `zero_high` mark, zeroes them
+ * with non-temporal stores so they don't push anything out of the cache, and
+ * puts them in the pool. Pages in ZONE_HIGHMEM are zeroed through
+ * @ref kmap_atomic.
+ * 
+ * @param max_pages Most pages to zero before returning
+ * 
+ * @returns Number of pages added to the pools. 0 once every pool is full, or
+ * there are no free pages left to take.
+*/
+uint32_t page_zero_idle(uint32_t max_pages);
+
+/** @brief Gives every page in the pools of zeroed pages back to their zones
+ * 
+ * The pages stay marked @ref PG_ZERO in the buddy lists, so they can still be
+ * used for @ref GFP_ZERO allocations without being zeroed again.
+*/
+void page_zero_drain_all();
+
+/** @brief Allocates `2^order` contiguous pages
+ * 
+ * Allocates from ZONE_NORMAL, falling back to ZONE_DMA.
+ * 
+ * @param order Order of the allocation
+ * 
+ * @returns Virtual address of the first page, or NULL on failure
+*/
+void* page_alloc(uint32_t order);
+
+/** @brief Allocates `2^order` contiguous pages in ZONE_DMA
+ * 
+ * @param order Order of the allocation
+ * 
+ * @returns Virtual address of the first page, or NULL on failure
+*/
+void* page_alloc_low(uint32_t order);
+
+/** @brief Frees `2^order` contiguous pages allocated by @ref page_alloc or
+ * @ref page_alloc_low
+ * 
+ * @param addr Virtual address of the first page
+ * @param order Order the pages were allocated with
+*/
+void page_free(void* addr, uint32_t order);
+
+/** @brief Measures how fragmented the free memory of a zone is
+ * 
+ * Gives the unusable free space index: the fraction of free pages that are in
+ * blocks too small for an allocation of `order`.
+ * 
+ * @param zone Zone to measure
+ * @param order Order of the allocation
+ * 
+ * @returns Index in thousandths, from 0 (all usable) to 1000 (none usable)
+*/
+uint32_t page_zone_unusable_index(zone_t* zone, uint32_t order);
+
+/** @brief Measures why an allocation would fail in a zone
+ * 
+ * Gives the fragmentation index: near 0 if an allocation of `order` would
+ * fail for lack of free memory, and near 1000 if it would fail because the
+ * free memory is split into blocks that are too small. Compaction can only
+ * help in the second case.
+ * 
+ * @param zone Zone to measure
+ * @param order Order of the allocation
+ * 
+ * @returns Index in thousandths, or -1000 if there's a free block big enough
+*/
+int32_t page_zone_fragmentation_index(zone_t* zone, uint32_t order);
+
+/** @brief Logs the free blocks, pageblocks, per-CPU list hit rates and pools
+ * of zeroed pages of each zone
+*/
+void page_allocator_dump_stats();
+
+#endif
@@ -0,0 +1,59 @@
+/// @file page_fault.h
+// TODO: Doxygen comments
+
+#ifndef _PAGE_FAULT_H
+#define _PAGE_FAULT_H 1
+
+#include <stdint.h>
+
+#include <namuos/cpu.h>
+#include <namuos/idt.h>
+
+
+// Bits of the error code the CPU pushes for a page fault
+#define PF_PRESENT (1U << 0) ///< The page was present, so access was denied. Otherwise it wasn't mapped.
+#define PF_WRITE   (1U << 1) ///< The access was a write, otherwise a read
+#define PF_USER    (1U << 2) ///< The access came from user mode
+#define PF_RSVD    (1U << 3) ///< A reserved bit was set in a paging entry
+#define PF_INSTR   (1U << 4) ///< The access was an instruction fetch, with NX enabled
+
+/** @brief Page fault counters for a CPU
+ * 
+ * There's no swap, so no fault waits on I/O. Faults are counted as major when
+ * they had to allocate memory, and minor when only entries needed changing.
+*/
+typedef struct {
+	uint32_t minor;    ///< Faults fixed by changing entries, such as a copy-on-write page with no other users
+	uint32_t major;    ///< Faults that allocated a page or page table, or copied a page
+	uint32_t spurious; ///< Faults on entries that were already fixed, from stale TLB entries
+	uint64_t cycles;   ///< Cycles spent handling faults of every kind
+} __attribute__((aligned(CPU_DEFAULT_CACHE_LINE_SIZE))) page_fault_stats_t;
+
+/// Page fault counters for each CPU
+extern page_fault_stats_t page_fault_stats[NR_CPUS];
+
+
+/** @brief Handles a page fault, called from the IDT's exception entry path
+ * 
+ * Decodes the error code and the faulting address in CR2, and fixes faults
+ * the kernel expects:
+ * - a @ref PTE_ANON page touched for the first time, which is allocated
+ *   zeroed, along with its page table if that was left to first touch too
+ * - a write to a @ref PTE_COW page, which is copied if anything else still
+ *   maps it, and otherwise just made writable
+ * - a kernel address whose page table is in @ref kernel_pgd, but not yet in
+ *   the current page directory
+ * - a stale TLB entry for an entry that's since been fixed
+ * 
+ * Anything else is a bug, and panics with the registers and paging entries.
+ * Memory that faults mustn't be touched while holding the page allocator's
+ * locks.
+ * 
+ * @param frame Registers saved by the entry stub
+*/
+void page_fault_handle(interrupt_frame_t* frame);
+
+/** @brief Logs the page fault counters of each CPU */
+void page_fault_dump_stats();
+
+#endif
@@ -0,0 +1,86 @@
+/// @file page_mem.h
+// TODO: Doxygen comments
+
+#ifndef _PAGE_MEM_H
+#define _PAGE_MEM_H 1
+
+#include <stdint.h>
+
+#include <namuos/cpu.h>
+
+
+// Ways of clearing and copying a page
+#define PAGE_MEM_REP      0 ///< `rep stosd` and `rep movsd`
+#define PAGE_MEM_UNROLLED 1 ///< Unrolled loops of 32-bit moves, a cache line at a time
+#define PAGE_MEM_SSE2     2 ///< SSE2 `movntdq`, writing around the cache
+#define PAGE_MEM_VARIANTS 3 ///< Number of ways of clearing and copying a page
+
+/// Pages cleared and copied by each variant when measuring which is fastest
+#define PAGE_MEM_PROBE_PAGES 64
+
+/// Number of times each variant is measured, keeping the fastest
+#define PAGE_MEM_PROBE_ROUNDS 4
+
+/** @brief Page clearing and copying picked for a CPU
+ * 
+ * Starts out using `rep stosd` and `rep movsd`, which every CPU has, until
+ * @ref page_mem_initialise has measured the others on the CPU.
+*/
+typedef struct {
+	void (*clear)(void* page);                   ///< Fastest way found to clear a page
+	void (*copy)(void* dest, const void* src);   ///< Fastest way found to copy a page
+	uint32_t clear_variant;                      ///< `PAGE_MEM_*` variant used to clear
+	uint32_t copy_variant;                       ///< `PAGE_MEM_*` variant used to copy
+	uint32_t clear_cycles[PAGE_MEM_VARIANTS];    ///< Cycles per page cleared by each variant, or 0 if unmeasured
+	uint32_t copy_cycles[PAGE_MEM_VARIANTS];     ///< Cycles per page copied by each variant, or 0 if unmeasured
+} page_mem_cpu_t;
+
+/// Page clearing and copying picked for each CPU
+extern page_mem_cpu_t page_mem_cpu[NR_CPUS];
+
+
+/** @brief Picks the fastest way to clear and copy pages on this CPU
+ * 
+ * Measures each variant the CPU supports, going by CPUID, on a buffer of
+ * @ref PAGE_MEM_PROBE_PAGES pages from the page allocator, so must be called
+ * after the page allocator is set up. Until then, and if there's no TSC to
+ * measure with, `rep stosd` and `rep movsd` are used.
+*/
+void page_mem_initialise();
+
+/** @brief Gets the name of a way of clearing and copying pages
+ * 
+ * @param variant `PAGE_MEM_*` variant
+ * 
+ * @returns Short name of the variant, for logging
+*/
+const char* page_mem_variant_name(uint32_t variant);
+
+/** @brief Zeroes a page
+ * 
+ * @param page Page-aligned address of the page, which must be mapped
+*/
+static inline void clear_page(void* page) {
+	page_mem_cpu[smp_processor_id()].clear(page);
+}
+
+/** @brief Copies a page
+ * 
+ * @param dest Page-aligned address to copy to, which must be mapped
+ * @param src Page-aligned address to copy from, which must be mapped
+*/
+static inline void copy_page(void* dest, const void* src) {
+	page_mem_cpu[smp_processor_id()].copy(dest, src);
+}
+
+/** @brief Zeroes a page without bringing it into the cache
+ * 
+ * For pages that won't be touched again soon, such as those zeroed ahead of
+ * time, so they don't push more useful lines out of the cache. Uses SSE2
+ * non-temporal stores if there are any, otherwise @ref clear_page.
+ * 
+ * @param page Page-aligned address of the page, which must be mapped
+*/
+void clear_page_nocache(void* page);
+
+#endif
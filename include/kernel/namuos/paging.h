@@ -4,8 +4,19 @@
 #ifndef _PAGING_H
 #define _PAGING_H 1
 
+/// If paging uses PAE, with 3 levels of 64-bit entries, the NX bit, and
+///  physical memory above 4 GiB. Otherwise classic 2-level 32-bit paging is
+///  used. Selected at build time with `make PAE=1`.
+#ifndef PAGING_PAE
+#define PAGING_PAE 0
+#endif
+
+// Only the constants below are usable from `boot.S`
+#ifndef __ASSEMBLER__
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#endif
 
 
 /// Virtual address for the beginning of kernel space
@@ -15,142 +26,611 @@
 #define __to_virt(x) (void*)((uintptr_t)(x) + PAGE_OFFSET)
 #define __to_phys(x) (uintptr_t)((uintptr_t)(x) - PAGE_OFFSET)
 
+// Size of the start of the linear mapping `boot.S` maps with page tables, so
+//  the kernel image can be given permissions a page at a time. The rest of
+//  low memory is mapped with large pages, or if the CPU has none, with page
+//  tables up to BOOT_TABLES_MAPPED_SIZE, leaving the rest to paging_initialise.
+#define BOOT_MAPPED_SIZE        0x00800000 // First 8 MiB
+#define BOOT_TABLES_MAPPED_SIZE 0x02000000 // First 32 MiB
+
 // Locations of special regions in physical address space
 #define ZONE_DMA_OFFSET     0x00000000
 #define ZONE_DMA_SIZE       0x01000000 // First 16 MiB
 #define ZONE_NORMAL_OFFSET  0x01000000
 #define ZONE_NORMAL_SIZE    0x37000000 // 16 MiB to 896 MiB
 #define ZONE_HIGHMEM_OFFSET 0x38000000
-#define ZONE_HIGHMEM_SIZE   0xc8000000 // 896 MiB to end
+#define ZONE_HIGHMEM_SIZE   (PHYS_ADDR_LIMIT - ZONE_HIGHMEM_OFFSET) // 896 MiB to end
+
+/// Exclusive limit of physical memory the kernel can use. PAE entries can
+///  address more, but 64 GiB keeps every page frame number within 32 bits.
+#if PAGING_PAE
+#define PHYS_ADDR_LIMIT 0x1000000000ULL // 64 GiB
+#else
+#define PHYS_ADDR_LIMIT 0x100000000ULL // 4 GiB
+#endif
 
 // PTE bits
 #define PAGE_SHIFT 12
 #define PAGE_SIZE  (1UL << PAGE_SHIFT)
 #define PAGE_MASK  (~(PAGE_SIZE-1))
 #define PAGE_ALIGN(addr) (((addr) + PAGE_SIZE - 1) & PAGE_MASK)
+#if PAGING_PAE
+#define PTRS_PER_PTE 512
+#else
 #define PTRS_PER_PTE 1024
+#endif
 
-// PDE bits
+// PDE bits. With PAE, the 4 page directories of a PGD are allocated
+//  contiguously so they can be indexed as one directory of 2048 entries.
+#if PAGING_PAE
+#define PGDIR_SHIFT 21
+#define PTRS_PER_PDE 2048
+#else
 #define PGDIR_SHIFT 22
+#define PTRS_PER_PDE 1024
+#endif
 #define PGDIR_SIZE  (1UL << PGDIR_SHIFT)
 #define PGDIR_MASK  (~(PGDIR_SIZE-1))
-#define PTRS_PER_PDE 1024
+
+// PDPTE bits. Only used with PAE, where each of the 4 PDPT entries points to a
+//  page directory covering 1 GiB.
+#define PDPT_SHIFT 30
+#define PTRS_PER_PDPTE 4
+
+// Size of each paging structure entry in bytes, and pages in a PGD
+#if PAGING_PAE
+#define PDE_SIZE 8
+#else
+#define PDE_SIZE 4
+#endif
+#define PGD_PAGES ((PTRS_PER_PDE * PDE_SIZE) >> PAGE_SHIFT)
+
+
+#ifndef __ASSEMBLER__
+
+/// Raw type of a paging structure entry
+#if PAGING_PAE
+typedef uint64_t paging_entry_t;
+#else
+typedef uint32_t paging_entry_t;
+#endif
+
+/// Physical address, wide enough for any page frame the kernel can use
+#if PAGING_PAE
+typedef uint64_t phys_addr_t;
+#else
+typedef uint32_t phys_addr_t;
+#endif
+
+/// Physical address of page frame number `pfn`
+#define PFN_PHYS(pfn) ((phys_addr_t)(pfn) << PAGE_SHIFT)
 
 
 /// Structure used for page table entries (PTEs)
 union page_PTE {
-	uint32_t raw;
+	paging_entry_t raw;
 	struct {
 		// Bit 0, Present; Must be 1 to map to 4-KiB page
 		#define PTE_PRESENT 1<<0
-		uint32_t present:1;
+		paging_entry_t present:1;
 
 		// Bit 1, Read/write; If 0, writes are not allowed to the 4 KiB region
 		#define PTE_RW 1<<1
-		uint32_t rw:1;
+		paging_entry_t rw:1;
 
 		// Bit 2, User/supervisor; If 0, user-mode access not allowed to the
 		//  4 KiB region
 		#define PTE_USER 1<<2
-		uint32_t user:1;
+		paging_entry_t user:1;
 
 		// Bit 3, Page-level write-through (PWT)
 		#define PTE_PWT 1<<3
-		uint32_t pwt:1;
+		paging_entry_t pwt:1;
 
 		// Bit 4, Page-level cache disable (PCD)
 		#define PTE_PCD 1<<4
-		uint32_t pcd:1;
+		paging_entry_t pcd:1;
 
 		// Bit 5, Accessed; Indicates whether software has accessed the 4 KiB
 		//  page referenced by this entry
 		#define PTE_ACCESSED 1<<5
-		uint32_t accessed:1;
+		paging_entry_t accessed:1;
 
 		// Bit 6, Dirty; Indicates whether software has written to the 4 KiB
 		//  page referenced by this entry
 		#define PTE_DIRTY 1<<6
-		uint32_t dirty:1;
+		paging_entry_t dirty:1;
 
-		// Bit 7, PAT; If PAT not supported, must be 0
-		#define PTE_PAGE_SIZE 1<<7
-		uint32_t page_size:1;
+		// Bit 7, PAT; Selects the PAT entry along with PCD and PWT. If PAT not
+		//  supported, must be 0
+		#define PTE_PAT 1<<7
+		paging_entry_t pat:1;
 
 		// Bit 8, Global; If CR4.PGE = 1, determines whether the translation is
 		//  global. Ignored otherwise
 		#define PTE_GLOBAL 1<<8
-		uint32_t global:1;
-
-		// Bits 9 - 11, Ignored
-		uint32_t ignored_9_11:3;
-
+		paging_entry_t global:1;
+
+		// Bits 9 - 11, Ignored by the CPU, and used by the kernel. Bit 9 marks
+		//  memory allocated on demand by the page fault handler. Not present,
+		//  the page is allocated zeroed on first touch, and the rest of the
+		//  entry holds the flags to map it with. Present, the frame belongs to
+		//  the mapping. Bit 10 marks a read-only frame shared copy-on-write.
+		#define PTE_ANON (1<<9)
+		#define PTE_COW  (1<<10)
+		paging_entry_t ignored_9_11:3;
+
+#if PAGING_PAE
+		// Bits 12 - 51, Physical address of referenced 4 KiB page frame
+		paging_entry_t addr:40;
+
+		// Bits 52 - 62, Ignored
+		paging_entry_t ignored_52_62:11;
+
+		// Bit 63, Execute-disable; If EFER.NXE = 1, instruction fetches are
+		//  not allowed from the 4 KiB page. Otherwise reserved (must be 0)
+		#define PTE_NX (1ULL<<63)
+		paging_entry_t nx:1;
+#else
 		// Bits 12 - 31, Physical address of referenced 4 KiB page frame
-		uint32_t addr:20;
+		paging_entry_t addr:20;
+
+		// No execute-disable bit without PAE
+		#define PTE_NX 0
+#endif
 	};
 } __attribute__((packed));
 typedef union page_PTE PTE_t;
 
 /// Structure used for page directory entries (PDEs)
 union page_PDE {
-	uint32_t raw;
+	paging_entry_t raw;
 	struct {
 		// Bit 0, Present; Must be 1 to reference a page table
 		#define PDE_PRESENT 1<<0
-		uint32_t present:1;
+		paging_entry_t present:1;
 
-		// Bit 1, Read/write; If 0, writes are not allowed to the 4 MiB region
+		// Bit 1, Read/write; If 0, writes are not allowed to the region
+		//  controlled by this entry
 		#define PDE_RW 1<<1
-		uint32_t rw:1;
+		paging_entry_t rw:1;
 
 		// Bit 2, User/supervisor; If 0, user-mode access not allowed to the
-		//  4 MiB region
+		//  region controlled by this entry
 		#define PDE_USER 1<<2
-		uint32_t user:1;
+		paging_entry_t user:1;
 
 		// Bit 3, Page-level write-through (PWT)
 		#define PDE_PWT 1<<3
-		uint32_t pwt:1;
+		paging_entry_t pwt:1;
 
 		// Bit 4, Page-level cache disable (PCD)
 		#define PDE_PCD 1<<4
-		uint32_t pcd:1;
+		paging_entry_t pcd:1;
 
 		// Bit 5, Accessed; Indicates whether this entry has been used for
 		//  linear-address translation
 		#define PDE_ACCESSED 1<<5
-		uint32_t accessed:1;
+		paging_entry_t accessed:1;
 
 		// Bit 6, Ignored
-		uint32_t ignored_6:1;
+		paging_entry_t ignored_6:1;
 
-		// Bit 7, If PSE enabled, 1 maps to a 4 MiB page, 0 maps to a page
-		//  table. If PSE disabled, ignored.
+		// Bit 7, If PSE (or PAE) enabled, 1 maps to a large page, 0 maps to a
+		//  page table. Otherwise ignored.
 		#define PDE_PAGE_SIZE 1<<7
+		paging_entry_t page_size:1;
+
+		// Bits 8 - 11, Ignored. Not present, bit 9 marks a range reserved with
+		//  @ref paging_map_anon, whose page table is allocated on first touch.
+		//  The rest of the entry is then the @ref PTE_ANON entry for each page.
+		#define PDE_ANON (1<<9)
+		paging_entry_t ignored_8_11:4;
+
+#if PAGING_PAE
+		// Bits 12 - 51, Physical address of referenced page table
+		paging_entry_t addr:40;
+
+		// Bits 52 - 62, Ignored
+		paging_entry_t ignored_52_62:11;
+
+		// Bit 63, Execute-disable; If EFER.NXE = 1, instruction fetches are
+		//  not allowed from the 2 MiB region controlled by this entry
+		#define PDE_NX (1ULL<<63)
+		paging_entry_t nx:1;
+#else
+		// Bits 12 - 31, Physical address of referenced page table
+		paging_entry_t addr:20;
+#endif
+	};
+} __attribute__((packed));
+typedef union page_PDE PDE_t;
+
+#if PAGING_PAE
+/// Structure used for page directory entries that map a 2 MiB page. Only
+///  valid with PAE, when `page_size` is 1.
+union page_PDE_2M {
+	uint64_t raw;
+	struct {
+		// Bit 0, Present; Must be 1 to map a 2 MiB page
+		uint64_t present:1;
+
+		// Bit 1, Read/write; If 0, writes are not allowed to the 2 MiB page
+		uint64_t rw:1;
+
+		// Bit 2, User/supervisor; If 0, user-mode access not allowed to the
+		//  2 MiB page
+		uint64_t user:1;
+
+		// Bit 3, Page-level write-through (PWT)
+		uint64_t pwt:1;
+
+		// Bit 4, Page-level cache disable (PCD)
+		uint64_t pcd:1;
+
+		// Bit 5, Accessed; Indicates whether software has accessed the 2 MiB
+		//  page referenced by this entry
+		uint64_t accessed:1;
+
+		// Bit 6, Dirty; Indicates whether software has written to the 2 MiB
+		//  page referenced by this entry
+		uint64_t dirty:1;
+
+		// Bit 7, Page size; Must be 1 to map a 2 MiB page
+		uint64_t page_size:1;
+
+		// Bit 8, Global; If CR4.PGE = 1, determines whether the translation is
+		//  global. Ignored otherwise
+		uint64_t global:1;
+
+		// Bits 9 - 11, Ignored
+		uint64_t ignored_9_11:3;
+
+		// Bit 12, PAT; If PAT not supported, must be 0
+		uint64_t pat:1;
+
+		// Bits 13 - 20, Reserved (must be 0)
+		uint64_t reserved_13_20:8;
+
+		// Bits 21 - 51, Physical address of referenced 2 MiB page
+		uint64_t addr:31;
+
+		// Bits 52 - 62, Ignored
+		uint64_t ignored_52_62:11;
+
+		// Bit 63, Execute-disable; If EFER.NXE = 1, instruction fetches are
+		//  not allowed from the 2 MiB page
+		uint64_t nx:1;
+	};
+} __attribute__((packed));
+typedef union page_PDE_2M PDE_2M_t;
+typedef PDE_2M_t PDE_LARGE_t; ///< PDE mapping a single large page
+
+/// Structure used for page directory pointer table entries (PDPTEs). Only used
+///  with PAE, where CR3 points to a table of 4 of these.
+union page_PDPTE {
+	uint64_t raw;
+	struct {
+		// Bit 0, Present; Must be 1 to reference a page directory
+		#define PDPTE_PRESENT 1<<0
+		uint64_t present:1;
+
+		// Bits 1 - 2, Reserved (must be 0)
+		uint64_t reserved_1_2:2;
+
+		// Bit 3, Page-level write-through (PWT)
+		uint64_t pwt:1;
+
+		// Bit 4, Page-level cache disable (PCD)
+		uint64_t pcd:1;
+
+		// Bits 5 - 8, Reserved (must be 0)
+		uint64_t reserved_5_8:4;
+
+		// Bits 9 - 11, Ignored
+		uint64_t ignored_9_11:3;
+
+		// Bits 12 - 51, Physical address of referenced page directory
+		uint64_t addr:40;
+
+		// Bits 52 - 63, Reserved (must be 0)
+		uint64_t reserved_52_63:12;
+	};
+} __attribute__((packed));
+typedef union page_PDPTE PDPTE_t;
+#else
+/// Structure used for page directory entries that map a 4 MiB page. Only
+///  valid when CR4.PSE is set and `page_size` is 1.
+union page_PDE_4M {
+	uint32_t raw;
+	struct {
+		// Bit 0, Present; Must be 1 to map a 4 MiB page
+		uint32_t present:1;
+
+		// Bit 1, Read/write; If 0, writes are not allowed to the 4 MiB page
+		uint32_t rw:1;
+
+		// Bit 2, User/supervisor; If 0, user-mode access not allowed to the
+		//  4 MiB page
+		uint32_t user:1;
+
+		// Bit 3, Page-level write-through (PWT)
+		uint32_t pwt:1;
+
+		// Bit 4, Page-level cache disable (PCD)
+		uint32_t pcd:1;
+
+		// Bit 5, Accessed; Indicates whether software has accessed the 4 MiB
+		//  page referenced by this entry
+		uint32_t accessed:1;
+
+		// Bit 6, Dirty; Indicates whether software has written to the 4 MiB
+		//  page referenced by this entry
+		uint32_t dirty:1;
+
+		// Bit 7, Page size; Must be 1 to map a 4 MiB page
 		uint32_t page_size:1;
 
-		// Bits 8 - 11, Ignored
-		uint32_t ignored_8_11:4;
+		// Bit 8, Global; If CR4.PGE = 1, determines whether the translation is
+		//  global. Ignored otherwise
+		uint32_t global:1;
 
-		// Bits 12 - 31, Physical address of referenced page table
-		uint32_t addr:20;
+		// Bits 9 - 11, Ignored
+		uint32_t ignored_9_11:3;
+
+		// Bit 12, PAT; If PAT not supported, must be 0
+		uint32_t pat:1;
+
+		// Bits 13 - 21, Bits 32+ of the physical address with PSE-36, otherwise
+		//  reserved (must be 0)
+		uint32_t addr_high:9;
+
+		// Bits 22 - 31, Physical address of referenced 4 MiB page
+		uint32_t addr:10;
 	};
 } __attribute__((packed));
-typedef union page_PDE PDE_t;
+typedef union page_PDE_4M PDE_4M_t;
+typedef PDE_4M_t PDE_LARGE_t; ///< PDE mapping a single large page
+#endif
 
-// TODO: 4 MiB PDE if PSE bit enabled
+
+// PTE flags for common kernel mappings, for use with @ref paging_map_range.
+//  The NX bit is dropped if execute-disable isn't enabled.
+#define PAGE_KERNEL      (PTE_PRESENT | PTE_RW | PTE_GLOBAL | PTE_NX)
+#define PAGE_KERNEL_RO   (PTE_PRESENT | PTE_GLOBAL | PTE_NX)
+#define PAGE_KERNEL_EXEC (PTE_PRESENT | PTE_RW | PTE_GLOBAL)
+
+/// Caching attribute of a mapping. Each is selected by the PAT, PCD, and PWT
+///  bits of a PTE once @ref paging_initialise has programmed the PAT.
+enum page_cache {
+	PAGE_CACHE_WB,       ///< Write-back, for normal memory
+	PAGE_CACHE_WC,       ///< Write-combining, for framebuffers
+	PAGE_CACHE_WT,       ///< Write-through
+	PAGE_CACHE_WP,       ///< Write-protected
+	PAGE_CACHE_UC_MINUS, ///< Uncached, unless the MTRRs say write-combining
+	PAGE_CACHE_UC,       ///< Uncached, for memory-mapped I/O
+	PAGE_CACHE_TYPES
+};
+
+/// Most pages @ref paging_gather_flush invalidates one at a time with
+///  `invlpg`. Past this, reloading the whole TLB is cheaper.
+#define PAGING_GATHER_INVLPG_MAX 32
+
+/// Collects the TLB invalidations needed after changing page table entries, so
+///  they can be done together once the entries are written
+typedef struct {
+	PDE_t* pgd;      ///< Page directory the entries belong to
+	uintptr_t start; ///< Lowest page changed
+	uintptr_t last;  ///< Highest page changed
+	uint32_t count;  ///< Number of present entries changed
+	bool global;     ///< If any changed entry was global
+} paging_gather_t;
 
 
 // Pointers to current page directory, and kernel page directory
 extern PDE_t* kernel_pgd;  ///< Kernel page directory
 extern PDE_t* current_pgd; ///< Current page directory
 
+#if PAGING_PAE
+/// Page directory pointer table loaded in CR3. Rewritten to point at the
+///  current PGD by @ref paging_change_pgd
+extern PDPTE_t* kernel_pdpt;
+#endif
+
+/// If the linear mapping beyond the kernel image uses large pages (4 MiB, or
+///  2 MiB with PAE)
+extern bool paging_pse_enabled;
+
+/// If EFER.NXE is set, so the `nx` bit of PAE entries is honoured
+extern bool paging_nx_enabled;
+
+/// If the PAT has been programmed, so every @ref page_cache type is available.
+///  Otherwise write-combining and write-protected fall back to uncached.
+extern bool paging_pat_enabled;
+
+/// If CR4.PGE is set, so global kernel entries survive CR3 reloads
+extern bool paging_pge_enabled;
+
 // TODO: Doxygen comment
 void paging_initialise();
 
+/** @brief Gets how much of low memory `boot.S` mapped
+ * 
+ * `boot.S` maps all of low memory with large pages if the CPU has them, and
+ * only the first @ref BOOT_TABLES_MAPPED_SIZE otherwise. Until
+ * @ref paging_initialise has run, only memory below this can be touched
+ * through the linear mapping. Needs @ref cpu_initialise to have run.
+ * 
+ * @returns Physical address of the end of the boot mapping
+*/
+uintptr_t paging_boot_mapped_end();
+
 // TODO: Doxygen comment
 void invalidate_page(void* vaddr);
 
-// TODO: Doxygen comment
+/** @brief Switches to the page directory `pgd`
+ * 
+ * Loads `pgd` into CR3. With PAE, `pgd` is the first of @ref PGD_PAGES
+ * contiguous page directories, which are written into @ref kernel_pdpt before
+ * loading the PDPT into CR3 instead. With global pages enabled, only
+ * non-global (user) TLB entries are flushed, and the kernel mapping stays
+ * cached.
+ * 
+ * @param pgd Page directory to switch to
+*/
 void paging_change_pgd(PDE_t* pgd);
 
+/** @brief Flushes all non-global TLB entries
+ * 
+ * Reloads CR3. Global kernel entries are kept if global pages are enabled.
+*/
+void paging_flush_tlb_user();
+
+/** @brief Flushes every TLB entry, including global ones
+ * 
+ * Toggles CR4.PGE off and on again if global pages are enabled, otherwise
+ * reloads CR3. Needed after changing a global kernel mapping.
+*/
+void paging_flush_tlb_all();
+
+/** @brief Maps a range of pages
+ * 
+ * Maps `npages` pages from `vaddr` to consecutive page frames from `paddr` in
+ * `pgd` with the caching attribute `cache`, writing whole PTEs at a time. Page tables are allocated as needed,
+ * from the boot allocator until it retires, and from the page allocator after.
+ * Any entries that were already present are invalidated once at the end.
+ * Changing the caching attribute of memory that's already mapped also needs
+ * @ref wbinvd afterwards.
+ * 
+ * @param pgd Page directory to map into
+ * @param vaddr Page aligned virtual address to map from
+ * @param paddr Page aligned physical address of the first page frame
+ * @param npages Number of pages to map
+ * @param flags PTE flags for every page, such as @ref PAGE_KERNEL. Any PAT,
+ *  PCD, or PWT bits are replaced by those for `cache`.
+ * @param cache Caching attribute for every page
+ * 
+ * @returns True if every page was mapped, false if a page table couldn't be
+ *  allocated or part of the range is covered by a large page.
+*/
+bool paging_map_range(PDE_t* pgd, uintptr_t vaddr, phys_addr_t paddr, uint32_t npages, paging_entry_t flags, enum page_cache cache);
+
+/** @brief Unmaps a range of pages
+ * 
+ * Clears the PTEs for `npages` pages from `vaddr` in `pgd`, and invalidates
+ * the ones that were present once at the end. Page tables are left in place.
+ * 
+ * @param pgd Page directory to unmap from
+ * @param vaddr Page aligned virtual address to unmap from
+ * @param npages Number of pages to unmap
+*/
+void paging_unmap_range(PDE_t* pgd, uintptr_t vaddr, uint32_t npages);
+
+/** @brief Unmaps a range of pages, leaving the invalidations to the caller
+ * 
+ * Like @ref paging_unmap_range, but only adds the entries that were present
+ * to `gather`, so unmaps of several ranges can share one flush. Until
+ * `gather` is flushed, the old mappings may still be cached in the TLB.
+ * 
+ * @param pgd Page directory to unmap from
+ * @param vaddr Page aligned virtual address to unmap from
+ * @param npages Number of pages to unmap
+ * @param gather Gather structure for `pgd` to add the invalidations to
+*/
+void paging_unmap_range_gather(PDE_t* pgd, uintptr_t vaddr, uint32_t npages, paging_gather_t* gather);
+
+/** @brief Gets the PTE mapping `vaddr`
+ * 
+ * For callers that keep rewriting the same few entries, such as the windows
+ * for ZONE_HIGHMEM, so they can skip walking the page directory each time.
+ * The caller is left to invalidate any present entry it changes.
+ * 
+ * @param pgd Page directory to look in
+ * @param vaddr Virtual address to get the entry of
+ * @param alloc If the page table covering `vaddr` is allocated when missing,
+ *  as in @ref paging_map_range
+ * 
+ * @returns Pointer to the entry, or NULL if there's no page table covering
+ *  `vaddr` and `alloc` isn't set or it couldn't be allocated, or `vaddr` is
+ *  covered by a large page.
+*/
+PTE_t* paging_get_pte(PDE_t* pgd, uintptr_t vaddr, bool alloc);
+
+/** @brief Reserves a range of pages to be allocated on first touch
+ * 
+ * Writes @ref PTE_ANON entries instead of mapping anything, so the page fault
+ * handler allocates a zeroed page the first time each one is touched. Where
+ * the range covers the whole of a page table that doesn't exist yet, only the
+ * PDE is written, and the table is allocated on first touch too. The range
+ * must not have anything mapped in it.
+ * 
+ * @param pgd Page directory to reserve in
+ * @param vaddr Page aligned virtual address of the range
+ * @param npages Number of pages to reserve
+ * @param flags PTE flags to map each page with, such as @ref PAGE_KERNEL
+ * 
+ * @returns True if the whole range was reserved, false if a page table
+ *  couldn't be allocated or part of the range is covered by a large page.
+*/
+bool paging_map_anon(PDE_t* pgd, uintptr_t vaddr, uint32_t npages, paging_entry_t flags);
+
+/** @brief Shares a range of pages from @ref paging_map_anon copy-on-write
+ * 
+ * Maps the pages already allocated at `src` at `dest` too, making both
+ * read-only with @ref PTE_COW set, and takes a reference on each frame. The
+ * first write to either copies the page, unless the other mapping is gone by
+ * then. Pages not yet allocated stay demand-zero at both.
+ * 
+ * @param pgd Page directory both ranges are in
+ * @param dest Page aligned virtual address to share to, which must have
+ *  nothing mapped in it
+ * @param src Page aligned virtual address of a range from @ref paging_map_anon
+ * @param npages Number of pages to share
+ * 
+ * @returns True if every page was shared, false if a page table couldn't be
+ *  allocated.
+*/
+bool paging_share_anon(PDE_t* pgd, uintptr_t dest, uintptr_t src, uint32_t npages);
+
+/** @brief Unmaps a range from @ref paging_map_anon and frees its pages
+ * 
+ * Clears every entry, flushes the TLB for the ones that were present, then
+ * drops a reference on each frame that was allocated, freeing those with no
+ * other users left.
+ * 
+ * @param pgd Page directory to unmap from
+ * @param vaddr Page aligned virtual address of the range
+ * @param npages Number of pages to unmap
+*/
+void paging_unmap_anon(PDE_t* pgd, uintptr_t vaddr, uint32_t npages);
+
+/** @brief Starts collecting TLB invalidations for `pgd`
+ * 
+ * @param gather Gather structure to initialise
+ * @param pgd Page directory the changed entries belong to
+*/
+void paging_gather_init(paging_gather_t* gather, PDE_t* pgd);
+
+/** @brief Records that the present entry for `vaddr` changed
+ * 
+ * @param gather Gather structure to add to
+ * @param vaddr Virtual address of the changed page
+ * @param old Previous raw value of the entry
+*/
+void paging_gather_add(paging_gather_t* gather, uintptr_t vaddr, paging_entry_t old);
+
+/** @brief Performs the TLB invalidations collected in `gather`
+ * 
+ * Does nothing if no present entry changed, or if only user entries of a page
+ * directory that isn't loaded changed. Up to @ref PAGING_GATHER_INVLPG_MAX
+ * pages are invalidated with `invlpg`. Anything larger reloads the TLB, also
+ * flushing global entries if any changed entry was global. The gather is
+ * empty again afterwards.
+ * 
+ * @param gather Gather structure to flush
+*/
+void paging_gather_flush(paging_gather_t* gather);
+
+#endif // __ASSEMBLER__
+
 #endif
@@ -0,0 +1,82 @@
+/// @file rbtree.h
+// TODO: Doxygen comments
+
+#ifndef _RBTREE_H
+#define _RBTREE_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/** @brief Node of a red-black tree, embedded in whatever it orders
+ * 
+ * The tree doesn't know the keys, so callers walk down it themselves to find
+ * where a node goes, then hand the spot to @ref rb_insert.
+*/
+typedef struct rb_node {
+	struct rb_node* parent; ///< Parent node, or NULL for the root
+	struct rb_node* left;   ///< Child with smaller keys
+	struct rb_node* right;  ///< Child with larger keys
+	bool red;               ///< If the node is red, otherwise black
+} rb_node_t;
+
+/** @brief Recomputes the data a node keeps about its subtree
+ * 
+ * Called on a node whenever its children change, after they've been updated.
+ * 
+ * @returns If the node's data changed, so its parent needs updating too
+*/
+typedef bool (*rb_augment_t)(rb_node_t* node);
+
+/// A red-black tree, optionally keeping data about each subtree in its nodes
+typedef struct {
+	rb_node_t* node;      ///< Root node, or NULL if the tree is empty
+	rb_augment_t augment; ///< Updates a node's subtree data, or NULL if there's none
+} rb_root_t;
+
+/// Initialiser for an empty @ref rb_root_t, with augment callback `aug`
+#define RB_ROOT_INIT(aug) { NULL, (aug) }
+
+/// Gets the structure of type `type` that embeds `ptr` as its member `member`
+#define rb_entry(ptr, type, member) ((type*)((char*)(ptr) - offsetof(type, member)))
+
+
+/** @brief Adds a node at a spot found by walking down the tree
+ * 
+ * Links `node` in as a leaf, brings the subtree data of its ancestors up to
+ * date, and rebalances the tree.
+ * 
+ * @param root Tree to add to
+ * @param node Node to add
+ * @param parent Leaf found by the walk, or NULL if the tree is empty
+ * @param link The `left` or `right` of `parent` the walk ended on, or the
+ *  `node` of `root` if the tree is empty
+*/
+void rb_insert(rb_root_t* root, rb_node_t* node, rb_node_t* parent, rb_node_t** link);
+
+/** @brief Removes a node and rebalances the tree
+ * 
+ * @param root Tree to remove from
+ * @param node Node in the tree to remove
+*/
+void rb_erase(rb_root_t* root, rb_node_t* node);
+
+/** @brief Brings subtree data up to date after a node's own data changed
+ * 
+ * Updates `node`, then each of its ancestors until one doesn't change.
+ * 
+ * @param root Tree the node is in
+ * @param node Node whose data changed without the tree's shape changing
+*/
+void rb_propagate(rb_root_t* root, rb_node_t* node);
+
+/** @brief Gets the node with the smallest key, or NULL if the tree is empty */
+rb_node_t* rb_first(const rb_root_t* root);
+
+/** @brief Gets the node with the next larger key, or NULL if there's none */
+rb_node_t* rb_next(const rb_node_t* node);
+
+/** @brief Gets the node with the next smaller key, or NULL if there's none */
+rb_node_t* rb_prev(const rb_node_t* node);
+
+#endif
@@ -0,0 +1,149 @@
+/// @file slab.h
+// TODO: Doxygen comments
+
+#ifndef _SLAB_H
+#define _SLAB_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <namuos/cpu.h>
+#include <namuos/page.h>
+#include <namuos/spinlock.h>
+
+
+/// Number of objects each per-CPU magazine holds
+#define SLAB_MAGAZINE_SIZE 16
+
+/// Number of objects moved between a magazine and the slabs at once
+#define SLAB_MAGAZINE_BATCH (SLAB_MAGAZINE_SIZE / 2)
+
+/// Fewest objects a slab should hold. Caches of large objects use slabs of
+///  more than one page to get at least this many.
+#define SLAB_MIN_OBJECTS 8
+
+/// Largest order of slab allocated by a cache
+#define SLAB_MAX_ORDER 3
+
+/// Number of empty slabs a cache keeps, rather than freeing them straight away
+#define SLAB_MAX_EMPTY 1
+
+/// Constructor run on every object when its slab is created
+typedef void (*kmem_ctor_t)(void* object);
+
+/** @brief Per-CPU stack of free objects in front of a cache
+ * 
+ * Objects are allocated from and freed to the magazine of the current CPU
+ * without taking the cache lock. Each has a cache line of its own.
+*/
+typedef struct {
+	uint32_t count;                      ///< Number of objects in the magazine
+	void* objects[SLAB_MAGAZINE_SIZE];   ///< Free objects, the hottest last
+} __attribute__((aligned(CPU_DEFAULT_CACHE_LINE_SIZE))) kmem_magazine_t;
+
+/** @brief Cache of fixed-size objects
+ * 
+ * Objects are carved out of slabs of `2^order` pages from the page allocator.
+ * A slab's page descriptors are marked @ref PG_SLAB, and the first holds the
+ * slab's state: `owner` is the cache, `index` the number of objects in use,
+ * and `data` the colour offset of the objects. Each slab starts with a stack
+ * of the indices of its free objects, followed by the colour offset, then the
+ * objects themselves.
+ * 
+ * Successive slabs offset their objects by successive multiples of the cache
+ * line size, using up the space left at the end of the slab, so the same
+ * object in each slab doesn't land in the same cache set.
+*/
+typedef struct kmem_cache {
+	const char* name;          ///< Name of the cache, for logging
+	uint32_t object_size;      ///< Size asked for when the cache was created
+	uint32_t size;             ///< Size of each object, rounded up to `align`
+	uint32_t align;            ///< Alignment of each object
+	uint32_t order;            ///< Order of each slab
+	uint32_t objects_per_slab; ///< Number of objects in each slab
+	uint32_t objects_offset;   ///< Offset of the first object before colouring
+	uint32_t colours;          ///< Number of colour offsets used in turn
+	uint32_t colour_next;      ///< Colour offset of the next slab, in cache lines
+	kmem_ctor_t ctor;          ///< Constructor for new objects, or NULL
+	spinlock_t lock;           ///< Held while changing the slab lists
+
+	page_t* slabs_full;    ///< Slabs with every object in use
+	page_t* slabs_partial; ///< Slabs with some objects in use
+	page_t* slabs_empty;   ///< Slabs with no objects in use
+	uint32_t nr_slabs;     ///< Number of slabs on all the lists
+	uint32_t nr_empty;     ///< Number of slabs on `slabs_empty`
+	uint32_t nr_active;    ///< Objects taken from the slabs, including magazines
+
+	struct kmem_cache* next; ///< Next cache in the list of every cache
+
+	kmem_magazine_t magazines[NR_CPUS]; ///< Free objects per CPU
+} kmem_cache_t;
+
+
+/** @brief Initialises the slab allocator
+ * 
+ * Sets up the cache that the other caches are allocated from. Must be called
+ * after the page allocator has been given memory by @ref bootmem_free_all.
+*/
+void slab_initialise();
+
+/** @brief Creates a cache of objects of `size` bytes
+ * 
+ * @param name Name of the cache, for logging. Must outlive the cache.
+ * @param size Size of each object
+ * @param align Alignment of each object. Must be a power of two, or 0 for the
+ * size of a pointer.
+ * @param ctor Constructor run on each object when its slab is created, or NULL.
+ * Objects must be in their constructed state when they're freed.
+ * 
+ * @returns The new cache, or NULL on failure
+*/
+kmem_cache_t* kmem_cache_create(const char* name, uint32_t size, uint32_t align, kmem_ctor_t ctor);
+
+/** @brief Destroys a cache, giving all of its slabs back to the page allocator
+ * 
+ * Every object should have been freed first. Any that haven't are leaked, and
+ * a warning is logged.
+ * 
+ * @param cache Cache to destroy
+*/
+void kmem_cache_destroy(kmem_cache_t* cache);
+
+/** @brief Allocates an object from a cache
+ * 
+ * @param cache Cache to allocate from
+ * 
+ * @returns The object, or NULL on failure
+*/
+void* kmem_cache_alloc(kmem_cache_t* cache);
+
+/** @brief Frees an object back to the cache it was allocated from
+ * 
+ * @param cache Cache the object was allocated from
+ * @param object Object to free, or NULL to do nothing
+*/
+void kmem_cache_free(kmem_cache_t* cache, void* object);
+
+/** @brief Gives the empty slabs of a cache back to the page allocator
+ * 
+ * Objects in the per-CPU magazines are put back into their slabs first.
+ * 
+ * @param cache Cache to shrink
+ * 
+ * @returns Number of pages freed
+*/
+uint32_t kmem_cache_shrink(kmem_cache_t* cache);
+
+/** @brief Shrinks every cache
+ * 
+ * Called by the page allocator when it runs out of memory.
+ * 
+ * @returns Number of pages freed
+*/
+uint32_t slab_reap();
+
+/** @brief Logs the slabs and objects of every cache */
+void slab_dump_stats();
+
+#endif
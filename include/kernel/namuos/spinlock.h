@@ -0,0 +1,49 @@
+/// @file spinlock.h
+// TODO: Doxygen comments
+
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H 1
+
+#include <stdint.h>
+
+
+/// Simple test-and-set spinlock
+typedef struct {
+	volatile uint32_t locked; ///< 1 while held, otherwise 0
+} spinlock_t;
+
+/// Initialiser for an unlocked @ref spinlock_t
+#define SPINLOCK_INIT { 0 }
+
+
+/** @brief Initialises `lock` as unlocked
+ * 
+ * @param lock Lock to initialise
+*/
+static inline void spin_lock_init(spinlock_t* lock) {
+	lock->locked = 0;
+}
+
+/** @brief Acquires `lock`, spinning until it's free
+ * 
+ * Waits with plain reads between attempts, so a contended lock's cache line
+ * isn't bounced between CPUs by the atomic exchange.
+ * 
+ * @param lock Lock to acquire
+*/
+static inline void spin_lock(spinlock_t* lock) {
+	while (__sync_lock_test_and_set(&lock->locked, 1)) {
+		while (lock->locked)
+			asm volatile ("pause");
+	}
+}
+
+/** @brief Releases `lock`
+ * 
+ * @param lock Lock to release
+*/
+static inline void spin_unlock(spinlock_t* lock) {
+	__sync_lock_release(&lock->locked);
+}
+
+#endif
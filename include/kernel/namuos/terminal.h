@@ -47,6 +47,10 @@ enum terminal_colour {
 /// If terminal screen is scrolled upwards when reaching bottom of screen.
 #define TERMINAL_SCROLLING_ENBALED 1
 
+/// Most entries in the write-back copy of the screen that scrolls are done in,
+///  enough for 132x60 text modes. Larger modes scroll video memory directly.
+#define TERMINAL_SHADOW_ENTRIES (132 * 60)
+
 // Logging colours
 #define KLOG_DEBUG_BG TERMINAL_COLOUR_BLACK ///< Debug message background colour
 #define KLOG_DEBUG_FG TERMINAL_COLOUR_LIGHT_BLUE ///< Debug message text colour
@@ -70,6 +74,21 @@ enum terminal_colour {
 */
 bool terminal_initialise(multiboot_info_t* mb_info);
 
+/** @brief Clears the terminal
+ * 
+ * Fills the screen with spaces in the current colour, and moves back to the
+ * top left.
+*/
+void terminal_clear();
+
+/** @brief Returns if the terminal scrolls a write-back copy of the screen
+ * 
+ * Scrolling shifts the copy and writes it out, so video memory is never read.
+ * Text modes with more than @ref TERMINAL_SHADOW_ENTRIES entries have no
+ * copy, and scroll video memory directly.
+*/
+bool terminal_shadowed();
+
 /** @brief Sets the default terminal colours
  * 
  * Sets the default terminal colours. This does not change the current colours
@@ -0,0 +1,164 @@
+/// @file vmalloc.h
+// TODO: Doxygen comments
+
+#ifndef _VMALLOC_H
+#define _VMALLOC_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <namuos/highmem.h>
+#include <namuos/page.h>
+#include <namuos/paging.h>
+#include <namuos/rbtree.h>
+
+
+/// Gap left between the end of the linear mapping and the vmalloc area, so
+///  running off the end of either faults
+#define VMALLOC_OFFSET 0x00800000 // 8 MiB
+
+/// Start of the virtual address space handed out by @ref vmalloc and
+///  @ref vmap, past the end of the linear mapping
+#define VMALLOC_START ((uintptr_t)__to_virt(ZONE_HIGHMEM_OFFSET) + VMALLOC_OFFSET)
+
+/// End of the vmalloc area, where the @ref kmap window starts
+#define VMALLOC_END PKMAP_BASE
+
+/// Number of pages @ref vfree and @ref vunmap leave lazily unmapped before
+///  flushing the TLB for all of them at once
+#define VMAP_LAZY_MAX_PAGES 4096 // 16 MiB
+
+// Flags for @ref vmap_area_t
+#define VM_ALLOC  0x1 ///< Pages were allocated by @ref vmalloc, and are freed with the area
+#define VM_MAP    0x2 ///< Pages were passed to @ref vmap, and belong to the caller
+#define VM_DEMAND 0x4 ///< Pages are allocated on first touch, see @ref vmalloc_demand
+
+/** @brief A range of the vmalloc area, free or in use
+ * 
+ * Free ranges are kept in a tree ordered by address, where each node also
+ * keeps the size of the largest free range below it, so the lowest range big
+ * enough for an allocation is found in one walk down the tree. Areas in use
+ * are kept in a second tree, to find them again when they're freed. Each area
+ * in use is followed by an unmapped guard page, included in its range.
+*/
+typedef struct vmap_area {
+	rb_node_t node;            ///< Node in the free tree or the busy tree
+	uintptr_t start;           ///< First address of the range
+	uintptr_t end;             ///< Address past the end of the range
+	uint32_t subtree_max_size; ///< Size of the largest free range in this subtree, in the free tree
+	uint32_t flags;            ///< `VM_*` flags, for areas in use
+	page_t** pages;            ///< Pages mapped into the area, kept until the purge for @ref VM_ALLOC
+	uint32_t nr_pages;         ///< Number of pages mapped into the area, or reserved for @ref VM_DEMAND
+	struct vmap_area* purge_next; ///< Next area waiting to be purged
+} vmap_area_t;
+
+/// Counters for the vmalloc area
+typedef struct {
+	uint32_t areas;        ///< Areas in use
+	uint32_t pages;        ///< Pages mapped into areas in use, or reserved for lazy areas
+	uint32_t lazy_pages;   ///< Pages unmapped but not yet flushed from the TLB
+	uint32_t purges;       ///< Times the lazily unmapped areas were flushed
+	uint32_t purged_areas; ///< Areas given back to the free tree by purges
+} vmalloc_stats_t;
+
+/// Counters for the vmalloc area
+extern vmalloc_stats_t vmalloc_stats;
+
+
+/** @brief Sets up the vmalloc area
+ * 
+ * Makes the whole of `[VMALLOC_START, VMALLOC_END)` one free range. Must be
+ * called after the slab allocator is set up.
+*/
+void vmalloc_initialise();
+
+/** @brief Allocates memory that's contiguous in virtual memory only
+ * 
+ * Allocates pages one at a time, preferring ZONE_HIGHMEM to keep the linear
+ * mapping for memory that needs it, and maps them into the vmalloc area. So
+ * large allocations don't need a large free block, but are slower to set up
+ * and to access through their own TLB entries. The pages are movable, so
+ * compaction can move them while the area is mapped.
+ * 
+ * @param size Size of the allocation in bytes
+ * 
+ * @returns Page-aligned address of the memory, or NULL if there wasn't enough
+ * memory or virtual address space.
+*/
+void* vmalloc(size_t size);
+
+/** @brief Allocates zeroed memory that's contiguous in virtual memory only
+ * 
+ * Like @ref vmalloc, but zeroes the pages, taking already zeroed pages from
+ * the page allocator where it has them.
+*/
+void* vzalloc(size_t size);
+
+/** @brief Reserves memory that's allocated a page at a time on first touch
+ * 
+ * Only reserves the address range. The page fault handler allocates a zeroed
+ * page, preferring ZONE_HIGHMEM, the first time each page is touched, so
+ * memory that's mostly left untouched costs little more than its page tables.
+ * Each first touch costs a fault, though.
+ * 
+ * @param size Size of the allocation in bytes
+ * 
+ * @returns Page-aligned address of the memory, or NULL if there wasn't enough
+ * virtual address space, or memory for page tables.
+*/
+void* vmalloc_demand(size_t size);
+
+/** @brief Frees memory from @ref vmalloc, @ref vzalloc, or @ref vmalloc_demand
+ * 
+ * The mappings are cleared, but only flushed from the TLB, and the pages and
+ * address range only freed, once @ref VMAP_LAZY_MAX_PAGES pages are waiting,
+ * or the range runs out. So no TLB entry can point at a page that's been
+ * reused. Pages of @ref vmalloc_demand memory are flushed and freed straight
+ * away instead.
+ * 
+ * @param addr Address returned by @ref vmalloc, or NULL to do nothing
+*/
+void vfree(const void* addr);
+
+/** @brief Maps pages contiguously into the vmalloc area
+ * 
+ * @param pages Pages to map, in order
+ * @param count Number of pages
+ * @param flags PTE flags for every page, such as @ref PAGE_KERNEL
+ * 
+ * @returns Page-aligned address of the mapping, or NULL if there wasn't
+ * enough virtual address space or memory for page tables.
+*/
+void* vmap(page_t** pages, uint32_t count, paging_entry_t flags);
+
+/** @brief Removes a mapping made by @ref vmap
+ * 
+ * The pages are left to the caller. Unmapped lazily, like @ref vfree, so they
+ * mustn't be freed until after @ref vmalloc_purge.
+ * 
+ * @param addr Address returned by @ref vmap, or NULL to do nothing
+*/
+void vunmap(const void* addr);
+
+/** @brief Flushes every lazily unmapped area, and frees up its range and pages */
+void vmalloc_purge();
+
+/** @brief Gets if an address is in the vmalloc area */
+static inline bool is_vmalloc_addr(const void* addr) {
+	return (uintptr_t)addr >= VMALLOC_START && (uintptr_t)addr < VMALLOC_END;
+}
+
+/** @brief Gets the page mapped at an address in the vmalloc area
+ * 
+ * @param addr Address in an area from @ref vmalloc or @ref vmap
+ * 
+ * @returns Descriptor of the page mapped at `addr`, or NULL if nothing is
+ * mapped there.
+*/
+page_t* vmalloc_to_page(const void* addr);
+
+/** @brief Logs the areas in use, the purges, and the largest free range */
+void vmalloc_dump_stats();
+
+#endif
@@ -127,31 +127,77 @@ extern void* calloc(size_t num, size_t size) __attribute__((malloc));
 
 /** @brief Expands previously allocated memory block
  * 
- * @todo Detailed description
+ * Reallocates the given area of memory, which must have been allocated by
+ * @ref malloc, @ref calloc, @ref realloc or @ref aligned_alloc, and not yet
+ * freed. The area is either expanded or contracted in place, or a new area is
+ * allocated and the contents copied over, up to the lesser of the old and new
+ * sizes, before the old area is freed.
+ * 
+ * If `ptr` is a null pointer, the behaviour is the same as calling
+ * `malloc(new_size)`. If `new_size` is zero, `ptr` is freed and a null pointer
+ * is returned.
+ * 
+ * @param ptr Pointer to the memory area to be reallocated
+ * @param new_size New size of the array in bytes
+ * 
+ * @returns On success, returns the pointer to the beginning of the reallocated
+ * memory, which may be `ptr` itself. To avoid a memory leak, the returned
+ * pointer must be deallocated with @ref free or @ref realloc.
+ * @returns On failure, returns a null pointer. The original pointer `ptr`
+ * remains valid and may need to be deallocated with @ref free or
+ * @ref realloc.
+ * 
+ * @note Not marked `malloc`, as the memory returned can be the memory passed
+ * in.
 */
-extern void* realloc(void* ptr, size_t new_size) __attribute__((malloc));
+extern void* realloc(void* ptr, size_t new_size);
 
 /** @brief Deallocates previously allocated memory block
  * 
- * @todo Detailed description
+ * Deallocates the space previously allocated by @ref malloc, @ref calloc,
+ * @ref aligned_alloc or @ref realloc. If `ptr` is a null pointer, the function
+ * does nothing.
+ * 
+ * The behaviour is undefined if `ptr` doesn't match a pointer returned by one
+ * of those functions, or if the memory has already been deallocated.
+ * 
+ * @param ptr Pointer to the memory to deallocate
 */
 extern void free(void* ptr);
 
 /** @brief Deallocates previously allocated sized memory
  * 
- * @todo Detailed description
+ * Same as @ref free, but `size` must be the size passed to @ref malloc,
+ * @ref realloc, or `num * size` for @ref calloc.
+ * 
+ * @param ptr Pointer to the memory to deallocate
+ * @param size Size of memory previously passed to the allocation function
 */
 extern void free_sized(void* ptr, size_t size);
 
 /** @brief Deallocates previously allocated sized and aligned memory
  * 
- * @todo Detailed description
+ * Same as @ref free, but `alignment` and `size` must be the ones passed to
+ * @ref aligned_alloc.
+ * 
+ * @param ptr Pointer to the memory to deallocate
+ * @param alignment Alignment of memory previously passed to @ref aligned_alloc
+ * @param size Size of memory previously passed to @ref aligned_alloc
 */
 extern void free_aligned_sized(void* ptr, size_t alignment, size_t size);
 
 /** @brief Allocates aligned memory
  * 
- * @todo Detailed description
+ * Allocates `size` bytes of uninitialised storage whose alignment is specified
+ * by `alignment`, which must be a power of two.
+ * 
+ * @param alignment Specifies the alignment
+ * @param size Number of bytes to allocate
+ * 
+ * @returns On success, returns the pointer to the beginning of newly allocated
+ * memory. To avoid a memory leak, the returned pointer must be deallocated with
+ * @ref free or @ref realloc.
+ * @returns On failure, returns a null pointer.
 */
 extern void* aligned_alloc(size_t alignment, size_t size) __attribute__((malloc));
 
@@ -0,0 +1,34 @@
+/// @file benchmark.c
+
+#include <namuos/benchmark.h> // Implements
+
+#include <namuos/terminal.h>
+
+
+void benchmark_run_all() {
+	klog_info("Running boot-time benchmarks...\n");
+	benchmark_terminal(); // First, as it clears the screen
+	benchmark_page_allocator();
+	benchmark_page_pcp();
+	benchmark_page_zero();
+	benchmark_page_compaction();
+	benchmark_page_mem();
+	benchmark_highmem();
+	benchmark_vmalloc();
+	benchmark_page_fault();
+	benchmark_idt();
+	benchmark_slab();
+	benchmark_heap();
+	benchmark_linear_sweep();
+	benchmark_pgd_switch();
+	klog_info("Finished boot-time benchmarks\n");
+}
+
+uint32_t benchmark_random(uint32_t* state) {
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
@@ -0,0 +1,114 @@
+/// @file bootmem.c
+
+#include <namuos/benchmark.h> // Implements
+
+#include <namuos/boot_allocator.h>
+#include <namuos/cpu.h>
+#include <namuos/paging.h>
+#include <namuos/terminal.h>
+
+
+// Number of single pages allocated. Their addresses are kept in one page
+//  allocated up front, so they can all be freed afterwards.
+#define BENCH_BOOTMEM_ALLOCS (PAGE_SIZE / sizeof(uintptr_t))
+
+// Bitmap search helpers from `boot_allocator.c`
+uint32_t _bitmap_find_zero(uint32_t pfn, uint32_t pfn_end);
+uint32_t _bitmap_find_set(uint32_t pfn, uint32_t pfn_end);
+
+/// Bit-by-bit search for a free block of `needed_pfns` pages from `pfn`, the
+///  way `__bootmem_alloc` used to scan. Used as a reference only.
+uint32_t _bench_bootmem_bit_scan(uint32_t pfn, uint32_t needed_pfns);
+
+/// Word at a time search for a free block of `needed_pfns` pages from `pfn`,
+///  the way `__bootmem_alloc` scans now, without the alignment
+uint32_t _bench_bootmem_word_scan(uint32_t pfn, uint32_t needed_pfns);
+
+
+void benchmark_bootmem() {
+	uint64_t bit_cycles = 0; // Cycles spent in the bit-by-bit reference scan
+	uint64_t word_cycles = 0; // Cycles spent in the word at a time scan
+	uint64_t alloc_cycles = 0; // Cycles spent in `bootmem_aligned_alloc`
+
+	// Page aligned allocations are never packed into the partly used page, so
+	//  each one searches the bitmap. Put back the packing state afterwards.
+	uint32_t last_pfn = bootmem_data.last_pfn;
+	uint32_t last_offset = bootmem_data.last_offset;
+	uintptr_t* paddrs = bootmem_aligned_alloc(PAGE_SIZE);
+	if (paddrs == NULL) {
+		klog_warning("benchmark_bootmem: No room to record the allocations\n");
+		return;
+	}
+
+	uint32_t allocs = 0;
+	for (; allocs < BENCH_BOOTMEM_ALLOCS; ++allocs) {
+		// Time both scans from the start of ZONE_NORMAL over the same bitmap
+		//  state, which fills up with reserved pages as the allocations go on
+		uint32_t goal_pfn = ZONE_NORMAL_OFFSET / PAGE_SIZE;
+		uint64_t start = rdtsc();
+		volatile uint32_t pfn = _bench_bootmem_bit_scan(goal_pfn, 1);
+		uint64_t mid = rdtsc();
+		pfn = _bench_bootmem_word_scan(goal_pfn, 1);
+		uint64_t end = rdtsc();
+		(void)pfn;
+		bit_cycles += mid - start;
+		word_cycles += end - mid;
+
+		// A real allocation only scans from the zone's cursor
+		start = rdtsc();
+		void* ptr = bootmem_aligned_alloc(PAGE_SIZE);
+		alloc_cycles += rdtsc() - start;
+		if (ptr == NULL) {
+			klog_warning("benchmark_bootmem: Ran out of memory after %d allocations\n", allocs);
+			break;
+		}
+		paddrs[allocs] = __to_phys(ptr);
+	}
+
+	// Every allocation was a whole page, so they can all be freed
+	for (uint32_t i = 0; i < allocs; ++i)
+		bootmem_free(paddrs[i], PAGE_SIZE);
+	bootmem_free(__to_phys(paddrs), PAGE_SIZE);
+	bootmem_data.last_pfn = last_pfn;
+	bootmem_data.last_offset = last_offset;
+	if (allocs == 0)
+		return;
+
+	klog_info(
+		"bootmem: Scanning %d times from ZONE_NORMAL, bit scan %lu cycles/scan, word scan %lu cycles/scan\n",
+		allocs, bit_cycles / allocs, word_cycles / allocs);
+	if (word_cycles != 0)
+		klog_info("bootmem: word scan is %lux faster\n", bit_cycles / word_cycles);
+	klog_info("bootmem: Single page allocs from the cursor take %lu cycles/alloc\n", alloc_cycles / allocs);
+}
+
+uint32_t _bench_bootmem_bit_scan(uint32_t pfn, uint32_t needed_pfns) {
+	uint32_t block_pfn = pfn;
+	uint32_t found_pfns = 0;
+	for (; pfn < bootmem_data.pfn_end; ++pfn) {
+		uint32_t bit = pfn - bootmem_data.pfn_start;
+		if (bootmem_data.bitmap[bit / BOOTMEM_BITS_PER_WORD] & (1U << (bit % BOOTMEM_BITS_PER_WORD))) {
+			block_pfn = pfn + 1;
+			found_pfns = 0;
+			continue;
+		}
+
+		found_pfns += 1;
+		if (found_pfns >= needed_pfns)
+			break;
+	}
+	return block_pfn;
+}
+
+uint32_t _bench_bootmem_word_scan(uint32_t pfn, uint32_t needed_pfns) {
+	while (pfn < bootmem_data.pfn_end) {
+		uint32_t block_pfn = _bitmap_find_zero(pfn, bootmem_data.pfn_end);
+		if (block_pfn >= bootmem_data.pfn_end || needed_pfns > bootmem_data.pfn_end - block_pfn)
+			break;
+
+		pfn = _bitmap_find_set(block_pfn, block_pfn + needed_pfns);
+		if (pfn == block_pfn + needed_pfns)
+			return block_pfn;
+	}
+	return bootmem_data.pfn_end;
+}
@@ -0,0 +1,76 @@
+/// @file heap.c
+
+#include <namuos/benchmark.h> // Implements
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <namuos/cpu.h>
+#include <namuos/terminal.h>
+
+
+// Number of allocations live at once in each round, and the number of rounds
+//  of each kind of free
+#define BENCH_HEAP_OBJECTS 1024
+#define BENCH_HEAP_ROUNDS  8
+
+// Allocations live during a round, and their sizes
+static void* _bench_heap_objects[BENCH_HEAP_OBJECTS];
+static size_t _bench_heap_sizes[BENCH_HEAP_OBJECTS];
+
+/// Allocates every object in @ref _bench_heap_sizes, then frees them all, with
+///  `free_sized` if `sized` is set and `free` otherwise. Returns the cycles
+///  taken by the frees, or 0 if an allocation failed.
+uint64_t _bench_heap_round(bool sized);
+
+
+void benchmark_heap() {
+	// Mostly small objects across the size classes, with the odd span
+	uint32_t state = 0x2545F491;
+	for (uint32_t i = 0; i < BENCH_HEAP_OBJECTS; ++i) {
+		uint32_t random = benchmark_random(&state);
+		if (random % 16 == 0)
+			_bench_heap_sizes[i] = 4097 + random % (3 * 4096);
+		else if (random % 4 == 0)
+			_bench_heap_sizes[i] = 1 + random % 4096;
+		else
+			_bench_heap_sizes[i] = 1 + random % 256;
+	}
+
+	// Alternate the two, so neither gets warmer caches than the other
+	uint64_t free_cycles = 0, sized_cycles = 0;
+	for (uint32_t round = 0; round < BENCH_HEAP_ROUNDS; ++round) {
+		uint64_t cycles = _bench_heap_round(false);
+		uint64_t sized = _bench_heap_round(true);
+		if (cycles == 0 || sized == 0) {
+			klog_warning("benchmark_heap: Ran out of memory\n");
+			return;
+		}
+		free_cycles += cycles;
+		sized_cycles += sized;
+	}
+
+	uint32_t frees = BENCH_HEAP_OBJECTS * BENCH_HEAP_ROUNDS;
+	klog_info(
+		"heap: free takes %lu cycles, free_sized %lu cycles, over %d mixed-size objects\n",
+		free_cycles / frees, sized_cycles / frees, frees);
+}
+
+uint64_t _bench_heap_round(bool sized) {
+	bool failed = false;
+	for (uint32_t i = 0; i < BENCH_HEAP_OBJECTS; ++i) {
+		_bench_heap_objects[i] = malloc(_bench_heap_sizes[i]);
+		failed |= _bench_heap_objects[i] == NULL;
+	}
+
+	uint64_t begin = rdtsc();
+	if (sized) {
+		for (uint32_t i = 0; i < BENCH_HEAP_OBJECTS; ++i)
+			free_sized(_bench_heap_objects[i], _bench_heap_sizes[i]);
+	}
+	else {
+		for (uint32_t i = 0; i < BENCH_HEAP_OBJECTS; ++i)
+			free(_bench_heap_objects[i]);
+	}
+	uint64_t cycles = rdtsc() - begin;
+	return failed ? 0 : cycles;
+}
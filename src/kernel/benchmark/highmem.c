@@ -0,0 +1,118 @@
+/// @file highmem.c
+
+#include <namuos/benchmark.h> // Implements
+
+#include <stdbool.h>
+#include <namuos/cpu.h>
+#include <namuos/highmem.h>
+#include <namuos/page_allocator.h>
+#include <namuos/page_mem.h>
+#include <namuos/terminal.h>
+
+
+// Pages copied each round on each side of the boundary, and the number of
+//  rounds
+#define BENCH_HIGHMEM_PAGES  64
+#define BENCH_HIGHMEM_ROUNDS 16
+
+// Ways of getting at the pages while copying
+#define BENCH_HIGHMEM_LINEAR 0 // Straight through the linear mapping
+#define BENCH_HIGHMEM_ATOMIC 1 // kmap_atomic on both sides
+#define BENCH_HIGHMEM_KMAP   2 // kmap on both sides
+
+/// Copies @ref BENCH_HIGHMEM_PAGES pages from `src` to `dest` for each round,
+///  mapping them with `how`. Returns the cycles taken per page.
+uint64_t _bench_highmem_copy(page_t* dest, page_t* src, uint32_t how);
+
+/// Maps and unmaps each page from `pages` for each round with kmap_atomic, or
+///  kmap if `persistent` is set, without touching them. Returns the cycles
+///  taken per page.
+uint64_t _bench_highmem_map(page_t* pages, bool persistent);
+
+
+void benchmark_highmem() {
+	uint32_t low_pfn = page_alloc_pfn_exact(BENCH_HIGHMEM_PAGES, GFP_KERNEL);
+	uint32_t high_pfn = page_alloc_pfn_exact(BENCH_HIGHMEM_PAGES, GFP_HIGHMEM);
+	if (low_pfn == PAGE_PFN_NONE || high_pfn == PAGE_PFN_NONE) {
+		klog_warning("benchmark_highmem: Ran out of memory\n");
+		if (low_pfn != PAGE_PFN_NONE)
+			page_free_pfn_exact(low_pfn, BENCH_HIGHMEM_PAGES);
+		if (high_pfn != PAGE_PFN_NONE)
+			page_free_pfn_exact(high_pfn, BENCH_HIGHMEM_PAGES);
+		return;
+	}
+	page_t* low = pfn_to_page(low_pfn);
+	page_t* high = pfn_to_page(high_pfn);
+
+	// Without enough RAM for ZONE_HIGHMEM, both sides come from the linear
+	//  mapping, and the mapping functions hand back their linear addresses
+	if (!page_is_highmem(high))
+		klog_info("highmem: No ZONE_HIGHMEM pages, only measuring the lowmem paths\n");
+
+	kmap_stats_t before = kmap_stats;
+	uint64_t linear_cycles = _bench_highmem_copy(low, low + BENCH_HIGHMEM_PAGES / 2, BENCH_HIGHMEM_LINEAR);
+	uint64_t to_high_atomic = _bench_highmem_copy(high, low, BENCH_HIGHMEM_ATOMIC);
+	uint64_t from_high_atomic = _bench_highmem_copy(low, high, BENCH_HIGHMEM_ATOMIC);
+	uint64_t to_high_kmap = _bench_highmem_copy(high, low, BENCH_HIGHMEM_KMAP);
+	uint64_t from_high_kmap = _bench_highmem_copy(low, high, BENCH_HIGHMEM_KMAP);
+	uint64_t atomic_map = _bench_highmem_map(high, false);
+	uint64_t kmap_map = _bench_highmem_map(high, true);
+
+	page_free_pfn_exact(high_pfn, BENCH_HIGHMEM_PAGES);
+	page_free_pfn_exact(low_pfn, BENCH_HIGHMEM_PAGES);
+
+	klog_info("highmem: lowmem to lowmem copy_page %lu cycles/page\n", linear_cycles);
+	klog_info(
+		"highmem: kmap_atomic copies %lu cycles/page to highmem, %lu cycles/page from highmem\n",
+		to_high_atomic, from_high_atomic);
+	klog_info(
+		"highmem: kmap copies %lu cycles/page to highmem, %lu cycles/page from highmem\n",
+		to_high_kmap, from_high_kmap);
+	klog_info(
+		"highmem: Mapping and unmapping alone: kmap_atomic %lu cycles/page, kmap %lu cycles/page\n",
+		atomic_map, kmap_map);
+	klog_info(
+		"highmem: kmap hit %d times, mapped %d pages, flushed %d times\n",
+		kmap_stats.hits - before.hits, kmap_stats.maps - before.maps,
+		kmap_stats.flushes - before.flushes);
+}
+
+uint64_t _bench_highmem_copy(page_t* dest, page_t* src, uint32_t how) {
+	// Lowmem to lowmem only has half the pages on each side
+	uint32_t pages = (how == BENCH_HIGHMEM_LINEAR) ? BENCH_HIGHMEM_PAGES / 2 : BENCH_HIGHMEM_PAGES;
+	uint64_t begin = rdtsc();
+	for (uint32_t round = 0; round < BENCH_HIGHMEM_ROUNDS; ++round) {
+		for (uint32_t i = 0; i < pages; ++i) {
+			if (how == BENCH_HIGHMEM_LINEAR)
+				copy_page(page_to_virt(&dest[i]), page_to_virt(&src[i]));
+			else if (how == BENCH_HIGHMEM_ATOMIC)
+				copy_highpage(&dest[i], &src[i]);
+			else {
+				void* dest_addr = kmap(&dest[i]);
+				void* src_addr = kmap(&src[i]);
+				if (dest_addr != NULL && src_addr != NULL)
+					copy_page(dest_addr, src_addr);
+				if (src_addr != NULL)
+					kunmap(&src[i]);
+				if (dest_addr != NULL)
+					kunmap(&dest[i]);
+			}
+		}
+	}
+	return (rdtsc() - begin) / (BENCH_HIGHMEM_ROUNDS * pages);
+}
+
+uint64_t _bench_highmem_map(page_t* pages, bool persistent) {
+	uint64_t begin = rdtsc();
+	for (uint32_t round = 0; round < BENCH_HIGHMEM_ROUNDS; ++round) {
+		for (uint32_t i = 0; i < BENCH_HIGHMEM_PAGES; ++i) {
+			if (persistent) {
+				if (kmap(&pages[i]) != NULL)
+					kunmap(&pages[i]);
+			}
+			else
+				kunmap_atomic(kmap_atomic(&pages[i]));
+		}
+	}
+	return (rdtsc() - begin) / (BENCH_HIGHMEM_ROUNDS * BENCH_HIGHMEM_PAGES);
+}
@@ -0,0 +1,88 @@
+/// @file idt.c
+
+#include <namuos/benchmark.h> // Implements
+
+#include <stdint.h>
+#include <namuos/cpu.h>
+#include <namuos/idt.h>
+#include <namuos/terminal.h>
+
+
+// Software interrupts raised for each vector
+#define BENCH_IDT_ROUNDS 10000
+
+// Interrupt vectors to raise, one whose stub pushes its vector as a byte and
+//  one as a whole word
+#define BENCH_IDT_VECTOR_LOW  0x30
+#define BENCH_IDT_VECTOR_HIGH 0xF0
+
+/// Raises `vector` with `int` for each round, and adds up the cycles from
+///  before the `int` to the handler, and from the handler to after `iret`. The
+///  vector has to be a constant, as `int` only takes an immediate.
+#define _BENCH_IDT_RAISE(vector, entry, exit) \
+	for (uint32_t round = 0; round < BENCH_IDT_ROUNDS; ++round) { \
+		uint64_t begin = rdtsc(); \
+		asm volatile ("int %0" : : "i"(vector) : "memory"); \
+		uint64_t end = rdtsc(); \
+		entry += _bench_idt_entered - begin; \
+		exit += end - _bench_idt_entered; \
+	}
+
+/// Logs the cycles per interrupt taken by `vector` on the way in and out
+void _bench_idt_report(const char* path, uint32_t vector, uint64_t entry, uint64_t exit);
+
+/// Handlers for each path, which note when they were reached
+void _bench_idt_exception(interrupt_frame_t* frame);
+void _bench_idt_interrupt(interrupt_fast_frame_t* frame);
+
+
+// When the last handler was reached
+static volatile uint64_t _bench_idt_entered;
+
+
+void benchmark_idt() {
+	// Time reading the TSC alone, which is in every figure below
+	uint64_t overhead = 0;
+	for (uint32_t round = 0; round < BENCH_IDT_ROUNDS; ++round) {
+		uint64_t begin = rdtsc();
+		overhead += rdtsc() - begin;
+	}
+	klog_info("idt: Reading the TSC takes %lu cycles\n", overhead / BENCH_IDT_ROUNDS);
+
+	// An exception saves and restores every register
+	uint64_t entry = 0, exit = 0;
+	idt_exception_handler_t old_exception = idt_set_exception_handler(IDT_VECTOR_BREAKPOINT, _bench_idt_exception);
+	_BENCH_IDT_RAISE(IDT_VECTOR_BREAKPOINT, entry, exit);
+	idt_set_exception_handler(IDT_VECTOR_BREAKPOINT, old_exception);
+	_bench_idt_report("full", IDT_VECTOR_BREAKPOINT, entry, exit);
+
+	// Other interrupts only save what the handler may clobber
+	entry = exit = 0;
+	idt_interrupt_handler_t old_interrupt = idt_set_interrupt_handler(BENCH_IDT_VECTOR_LOW, _bench_idt_interrupt);
+	_BENCH_IDT_RAISE(BENCH_IDT_VECTOR_LOW, entry, exit);
+	idt_set_interrupt_handler(BENCH_IDT_VECTOR_LOW, old_interrupt);
+	_bench_idt_report("fast", BENCH_IDT_VECTOR_LOW, entry, exit);
+
+	entry = exit = 0;
+	old_interrupt = idt_set_interrupt_handler(BENCH_IDT_VECTOR_HIGH, _bench_idt_interrupt);
+	_BENCH_IDT_RAISE(BENCH_IDT_VECTOR_HIGH, entry, exit);
+	idt_set_interrupt_handler(BENCH_IDT_VECTOR_HIGH, old_interrupt);
+	_bench_idt_report("fast", BENCH_IDT_VECTOR_HIGH, entry, exit);
+}
+
+void _bench_idt_report(const char* path, uint32_t vector, uint64_t entry, uint64_t exit) {
+	klog_info(
+		"idt: Vector %d (%s path) takes %lu cycles to enter, %lu to return, %lu in all\n",
+		vector, path, entry / BENCH_IDT_ROUNDS, exit / BENCH_IDT_ROUNDS,
+		(entry + exit) / BENCH_IDT_ROUNDS);
+}
+
+void _bench_idt_exception(interrupt_frame_t* frame) {
+	(void)frame;
+	_bench_idt_entered = rdtsc();
+}
+
+void _bench_idt_interrupt(interrupt_fast_frame_t* frame) {
+	(void)frame;
+	_bench_idt_entered = rdtsc();
+}
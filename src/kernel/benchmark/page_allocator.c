@@ -0,0 +1,313 @@
+/// @file page_allocator.c
+
+#include <namuos/benchmark.h> // Implements
+
+#include <namuos/cpu.h>
+#include <namuos/page_allocator.h>
+#include <namuos/terminal.h>
+
+
+// Number of allocations that can be live at once, and how many random
+//  operations are run. Each operation picks a slot, allocating into it if it's
+//  empty and freeing it otherwise, so about half the slots stay in use.
+#define BENCH_BUDDY_SLOTS 512
+#define BENCH_BUDDY_OPS   100000
+
+// Largest order allocated. Each order is half as likely as the one below it.
+#define BENCH_BUDDY_MAX_ORDER 4
+
+// Order to measure fragmentation at while the workload is still allocated
+#define BENCH_BUDDY_FRAG_ORDER 4
+
+// Single pages allocated then freed together in each round of the per-CPU
+//  list benchmark, and the number of rounds
+#define BENCH_PCP_BURST  32
+#define BENCH_PCP_ROUNDS 2048
+
+// Zeroed single pages allocated at once in the zeroed pool benchmark. No more
+//  than the pool holds.
+#define BENCH_ZERO_PAGES 128
+
+// Most single pages live at once in the compaction stress test, and the
+//  number of phases of filling memory and freeing half of it. One page in
+//  `BENCH_COMPACT_PIN_RATE` is unmovable instead of movable.
+#define BENCH_COMPACT_SLOTS    16384
+#define BENCH_COMPACT_PHASES   16
+#define BENCH_COMPACT_PIN_RATE 64
+
+// Most pageblocks held back from ZONE_DMA during the compaction stress test
+#define BENCH_COMPACT_DMA_BLOCKS 8
+
+// Allocations live during the workload
+static struct {
+	uint32_t pfn;
+	uint32_t order;
+} _bench_buddy_slots[BENCH_BUDDY_SLOTS];
+
+// Pages live during the compaction stress test, and the number of times
+//  compaction moved one
+static uint32_t _bench_compact_slots[BENCH_COMPACT_SLOTS];
+static uint32_t _bench_compact_moves;
+static uint32_t _bench_compact_dma[BENCH_COMPACT_DMA_BLOCKS];
+
+/// Points the slot of a movable page, kept in its `index`, at its new frame
+bool _bench_compact_migrate(page_t* page, page_t* new_page);
+
+static const page_movable_ops_t _bench_compact_ops = {
+	.migrate = _bench_compact_migrate,
+};
+
+/// Allocates and frees bursts of single pages, returning the cycles taken
+uint64_t _bench_pcp_rounds();
+
+/// Gets the number of per-CPU list hits for allocations and frees in `zone`
+uint32_t _bench_pcp_hits(zone_t* zone);
+
+/// Allocates then frees @ref BENCH_ZERO_PAGES zeroed single pages, returning
+///  the cycles taken by the allocations
+uint64_t _bench_zero_round();
+
+/// Converts `count` operations in `cycles` to operations per second, or 0 if
+///  the TSC frequency isn't known
+uint64_t _bench_per_second(uint32_t count, uint64_t cycles);
+
+
+void benchmark_page_allocator() {
+	zone_t* zone = &page_allocator.zones[PAGE_ZONE_NORMAL];
+	if (zone->managed_pages == 0)
+		zone = &page_allocator.zones[PAGE_ZONE_DMA];
+	// Start and finish with everything back in the buddy lists, so the free
+	//  blocks can be compared
+	page_pcp_drain_all();
+	uint32_t free_before = page_allocator.free_pages;
+	uint32_t max_blocks_before = zone->nr_free[PAGE_MAX_ORDER - 1];
+
+	for (uint32_t i = 0; i < BENCH_BUDDY_SLOTS; ++i)
+		_bench_buddy_slots[i].pfn = PAGE_PFN_NONE;
+
+	uint32_t state = 0x9e3779b9;
+	uint32_t allocs = 0, frees = 0, failed = 0;
+	uint64_t alloc_cycles = 0, free_cycles = 0;
+	uint32_t unusable_index = 0;
+	for (uint32_t op = 0; op < BENCH_BUDDY_OPS; ++op) {
+		uint32_t slot = benchmark_random(&state) % BENCH_BUDDY_SLOTS;
+		if (_bench_buddy_slots[slot].pfn == PAGE_PFN_NONE) {
+			uint32_t order = __builtin_ctz(benchmark_random(&state) | (1U << BENCH_BUDDY_MAX_ORDER));
+			uint64_t begin = rdtsc();
+			uint32_t pfn = page_alloc_pfn(order, GFP_KERNEL);
+			alloc_cycles += rdtsc() - begin;
+
+			if (pfn == PAGE_PFN_NONE) {
+				++failed;
+				continue;
+			}
+			_bench_buddy_slots[slot].pfn = pfn;
+			_bench_buddy_slots[slot].order = order;
+			++allocs;
+		}
+		else {
+			uint64_t begin = rdtsc();
+			page_free_pfn(_bench_buddy_slots[slot].pfn, _bench_buddy_slots[slot].order);
+			free_cycles += rdtsc() - begin;
+			_bench_buddy_slots[slot].pfn = PAGE_PFN_NONE;
+			++frees;
+		}
+
+		// Measure fragmentation half way, once the workload has settled
+		if (op == BENCH_BUDDY_OPS / 2)
+			unusable_index = page_zone_unusable_index(zone, BENCH_BUDDY_FRAG_ORDER);
+	}
+
+	// Free whatever's left. Every block should merge back with its buddies.
+	for (uint32_t i = 0; i < BENCH_BUDDY_SLOTS; ++i) {
+		if (_bench_buddy_slots[i].pfn != PAGE_PFN_NONE)
+			page_free_pfn(_bench_buddy_slots[i].pfn, _bench_buddy_slots[i].order);
+	}
+	page_pcp_drain_all();
+	bool merged = page_allocator.free_pages == free_before
+		&& zone->nr_free[PAGE_MAX_ORDER - 1] == max_blocks_before;
+
+	klog_info(
+		"page allocator: %d allocs (%d failed), %lu cycles/alloc, %lu allocs/s\n",
+		allocs, failed, allocs ? alloc_cycles / allocs : 0, _bench_per_second(allocs, alloc_cycles));
+	klog_info(
+		"page allocator: %d frees, %lu cycles/free, %lu frees/s\n",
+		frees, frees ? free_cycles / frees : 0, _bench_per_second(frees, free_cycles));
+	klog_info(
+		"page allocator: %s unusable index %d/1000 at order %d under load, %s afterwards\n",
+		zone->name, unusable_index, BENCH_BUDDY_FRAG_ORDER,
+		merged ? "fully merged" : "NOT fully merged");
+}
+
+void benchmark_page_pcp() {
+	zone_t* zone = &page_allocator.zones[PAGE_ZONE_NORMAL];
+	if (zone->managed_pages == 0)
+		zone = &page_allocator.zones[PAGE_ZONE_DMA];
+	uint32_t ops = 2 * BENCH_PCP_BURST * BENCH_PCP_ROUNDS;
+
+	// Only the boot CPU runs for now, so this measures the single CPU fast
+	//  path against going through the zone lock for every page
+	uint32_t hits_before = _bench_pcp_hits(zone);
+	uint64_t list_cycles = _bench_pcp_rounds();
+	uint32_t hits = _bench_pcp_hits(zone) - hits_before;
+
+	// With a list of at most one page, nearly every page goes to the zone
+	page_pcp_set_watermarks(0, 1, 1);
+	uint64_t zone_cycles = _bench_pcp_rounds();
+	page_pcp_set_watermarks(PAGE_PCP_LOW, PAGE_PCP_HIGH, PAGE_PCP_BATCH);
+	page_pcp_drain_all();
+
+	klog_info(
+		"page pcp: %lu cycles/op with per-CPU lists (%d/1000 hits), %lu cycles/op through the zone\n",
+		list_cycles / ops, (uint32_t)((uint64_t)hits * 1000 / ops), zone_cycles / ops);
+}
+
+void benchmark_page_zero() {
+	// Time zeroed allocations with the pools empty, so each page is zeroed as
+	//  it's allocated, then again once the idle loop has filled them
+	page_zero_drain_all();
+	page_pcp_drain_all();
+	uint64_t miss_cycles = _bench_zero_round();
+
+	uint32_t pages = 0;
+	uint64_t begin = rdtsc();
+	for (uint32_t added; (added = page_zero_idle(PAGE_ZERO_IDLE_BATCH)) != 0; )
+		pages += added;
+	uint64_t idle_cycles = rdtsc() - begin;
+	uint64_t hit_cycles = _bench_zero_round();
+
+	klog_info(
+		"page zero: %lu cycles/page zeroing on allocation, %lu cycles/page from the pool, %lu cycles/page zeroing %d pages while idle\n",
+		miss_cycles / BENCH_ZERO_PAGES, hit_cycles / BENCH_ZERO_PAGES,
+		pages ? idle_cycles / pages : 0, pages);
+}
+
+void benchmark_page_compaction() {
+	zone_t* zone = &page_allocator.zones[PAGE_ZONE_NORMAL];
+	if (zone->managed_pages == 0)
+		return;
+
+	page_pcp_drain_all();
+	uint32_t slots = (zone->free_pages < BENCH_COMPACT_SLOTS) ? zone->free_pages : BENCH_COMPACT_SLOTS;
+	for (uint32_t i = 0; i < slots; ++i)
+		_bench_compact_slots[i] = PAGE_PFN_NONE;
+	_bench_compact_moves = 0;
+
+	// Allocations fall back to ZONE_DMA, so hold its whole pageblocks until
+	//  the end, or it would serve the pageblock allocations instead
+	uint32_t dma_blocks = 0;
+	while (dma_blocks < BENCH_COMPACT_DMA_BLOCKS
+			&& page_allocator.zones[PAGE_ZONE_DMA].nr_free[PAGEBLOCK_ORDER] > 0)
+		_bench_compact_dma[dma_blocks++] = page_alloc_pfn(PAGEBLOCK_ORDER, GFP_DMA);
+
+	uint32_t state = 0x1D872B41;
+	uint32_t successes = 0, dirty = 0;
+	for (uint32_t phase = 0; phase < BENCH_COMPACT_PHASES; ++phase) {
+		// Fill the zone up, leaving a pageblock's worth free, then free a
+		//  random half of what's in it. That leaves the free memory scattered
+		//  across every pageblock, as it would be after a long uptime.
+		for (uint32_t i = 0; i < slots && zone->free_pages > (1U << PAGEBLOCK_ORDER); ++i) {
+			if (_bench_compact_slots[i] != PAGE_PFN_NONE)
+				continue;
+			bool pinned = i % BENCH_COMPACT_PIN_RATE == 0;
+			uint32_t pfn = page_alloc_pfn(0, (pinned ? GFP_KERNEL : GFP_MOVABLE) | GFP_ZERO);
+			if (pfn != PAGE_PFN_NONE) {
+				// Zeroed pages stay marked PG_ZERO while they're used, so mark
+				//  each one to catch it being freed as still zero, such as by
+				//  compaction after moving it
+				uint32_t* mark = page_to_virt(pfn_to_page(pfn));
+				dirty += (*mark != 0) ? 1 : 0;
+				*mark = i + 1;
+				if (!pinned) {
+					pfn_to_page(pfn)->index = i;
+					page_set_movable(pfn, &_bench_compact_ops);
+				}
+			}
+			_bench_compact_slots[i] = pfn;
+		}
+		for (uint32_t i = 0; i < slots; ++i) {
+			if (_bench_compact_slots[i] != PAGE_PFN_NONE && benchmark_random(&state) & 1) {
+				page_free_pfn(_bench_compact_slots[i], 0);
+				_bench_compact_slots[i] = PAGE_PFN_NONE;
+			}
+		}
+
+		// See if a whole pageblock is free before and after compaction, which
+		//  page_alloc_pfn does itself when it would help
+		page_pcp_drain_all();
+		bool free_before = zone->nr_free[PAGEBLOCK_ORDER] > 0;
+		int32_t index = page_zone_fragmentation_index(zone, PAGEBLOCK_ORDER);
+		uint32_t moves = _bench_compact_moves;
+		uint32_t block = page_alloc_pfn(PAGEBLOCK_ORDER, GFP_KERNEL);
+		if (block != PAGE_PFN_NONE) {
+			++successes;
+			page_free_pfn(block, PAGEBLOCK_ORDER);
+		}
+
+		klog_info(
+			"page compaction: phase %d: order-%d %s, %s before compaction (fragmentation index %d, %d pages moved)\n",
+			phase, PAGEBLOCK_ORDER, (block != PAGE_PFN_NONE) ? "allocated" : "FAILED",
+			free_before ? "free" : "not free", index, _bench_compact_moves - moves);
+	}
+
+	for (uint32_t i = 0; i < slots; ++i) {
+		if (_bench_compact_slots[i] != PAGE_PFN_NONE)
+			page_free_pfn(_bench_compact_slots[i], 0);
+	}
+	for (uint32_t i = 0; i < dma_blocks; ++i)
+		page_free_pfn(_bench_compact_dma[i], PAGEBLOCK_ORDER);
+	page_pcp_drain_all();
+
+	if (dirty > 0)
+		klog_warning("benchmark_page_compaction: %d zeroed pages weren't zero\n", dirty);
+
+	klog_info(
+		"page compaction: order-%d allocations succeeded %d/%d times, %d pages moved in total\n",
+		PAGEBLOCK_ORDER, successes, BENCH_COMPACT_PHASES, _bench_compact_moves);
+}
+
+uint64_t _bench_zero_round() {
+	uint32_t pfns[BENCH_ZERO_PAGES];
+	uint64_t begin = rdtsc();
+	for (uint32_t i = 0; i < BENCH_ZERO_PAGES; ++i)
+		pfns[i] = page_alloc_pfn(0, GFP_MOVABLE | GFP_ZERO);
+	uint64_t cycles = rdtsc() - begin;
+
+	for (uint32_t i = 0; i < BENCH_ZERO_PAGES; ++i) {
+		if (pfns[i] != PAGE_PFN_NONE)
+			page_free_pfn(pfns[i], 0);
+	}
+	return cycles;
+}
+
+uint64_t _bench_pcp_rounds() {
+	uint32_t pfns[BENCH_PCP_BURST];
+	uint64_t begin = rdtsc();
+	for (uint32_t round = 0; round < BENCH_PCP_ROUNDS; ++round) {
+		for (uint32_t i = 0; i < BENCH_PCP_BURST; ++i)
+			pfns[i] = page_alloc_pfn(0, GFP_KERNEL);
+		for (uint32_t i = 0; i < BENCH_PCP_BURST; ++i) {
+			if (pfns[i] != PAGE_PFN_NONE)
+				page_free_pfn(pfns[i], 0);
+		}
+	}
+	return rdtsc() - begin;
+}
+
+uint32_t _bench_pcp_hits(zone_t* zone) {
+	per_cpu_pages_t* pcp = &zone->pcp[smp_processor_id()];
+	return pcp->alloc_hits + pcp->free_hits;
+}
+
+bool _bench_compact_migrate(page_t* page, page_t* new_page) {
+	(void)page;
+	_bench_compact_slots[new_page->index] = page_to_pfn(new_page);
+	++_bench_compact_moves;
+	return true;
+}
+
+uint64_t _bench_per_second(uint32_t count, uint64_t cycles) {
+	if (cpu_info.tsc_khz == 0 || cycles == 0)
+		return 0;
+	return (uint64_t)count * cpu_info.tsc_khz * 1000 / cycles;
+}
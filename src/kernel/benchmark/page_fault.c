@@ -0,0 +1,99 @@
+/// @file page_fault.c
+
+#include <namuos/benchmark.h> // Implements
+
+#include <stdint.h>
+#include <namuos/cpu.h>
+#include <namuos/page_fault.h>
+#include <namuos/paging.h>
+#include <namuos/terminal.h>
+#include <namuos/vmalloc.h>
+
+
+// Pages in each area, and how sparsely they're touched, as one page in each
+//  stride
+#define BENCH_FAULT_PAGES 1024
+static const uint32_t _bench_fault_strides[] = { 64, 8, 1 };
+
+// Pages shared copy-on-write
+#define BENCH_FAULT_COW_PAGES 256
+
+/// Writes to the first byte of one page in every `stride` from `addr`
+void _bench_fault_touch(uint8_t* addr, uint32_t stride);
+
+
+void benchmark_page_fault() {
+	// Compare allocating an area, touching some of it, and freeing it again,
+	//  with every page allocated up front and with each allocated on first
+	//  touch
+	page_fault_stats_t* stats = &page_fault_stats[smp_processor_id()];
+	for (uint32_t i = 0; i < sizeof(_bench_fault_strides) / sizeof(_bench_fault_strides[0]); ++i) {
+		uint32_t stride = _bench_fault_strides[i];
+		uint64_t begin = rdtsc();
+		uint8_t* eager = vzalloc(BENCH_FAULT_PAGES << PAGE_SHIFT);
+		if (eager == NULL) {
+			klog_warning("benchmark_page_fault: Ran out of memory\n");
+			return;
+		}
+		_bench_fault_touch(eager, stride);
+		vfree(eager);
+		uint64_t eager_cycles = rdtsc() - begin;
+
+		page_fault_stats_t before = *stats;
+		begin = rdtsc();
+		uint8_t* demand = vmalloc_demand(BENCH_FAULT_PAGES << PAGE_SHIFT);
+		if (demand == NULL) {
+			klog_warning("benchmark_page_fault: Ran out of memory\n");
+			return;
+		}
+		_bench_fault_touch(demand, stride);
+		vfree(demand);
+		uint64_t demand_cycles = rdtsc() - begin;
+
+		uint32_t faults = stats->major - before.major;
+		klog_info(
+			"page fault: touching 1 in %d of %d pages takes %lu cycles allocated up front, %lu on demand (%d faults at %lu cycles)\n",
+			stride, BENCH_FAULT_PAGES, eager_cycles, demand_cycles,
+			faults, (stats->cycles - before.cycles) / (faults ? faults : 1));
+	}
+
+	// Share an area copy-on-write, then write to every page of the copy, which
+	//  copies each page, and of the original, which then has them to itself
+	uint8_t* src = vmalloc_demand(BENCH_FAULT_COW_PAGES << PAGE_SHIFT);
+	uint8_t* dest = vmalloc_demand(BENCH_FAULT_COW_PAGES << PAGE_SHIFT);
+	if (src == NULL || dest == NULL) {
+		klog_warning("benchmark_page_fault: Ran out of memory\n");
+		vfree(src);
+		vfree(dest);
+		return;
+	}
+	for (uint32_t page = 0; page < BENCH_FAULT_COW_PAGES; ++page)
+		src[page << PAGE_SHIFT] = (uint8_t)page;
+	if (!paging_share_anon(kernel_pgd, (uintptr_t)dest, (uintptr_t)src, BENCH_FAULT_COW_PAGES))
+		klog_warning("benchmark_page_fault: Failed to share pages\n");
+
+	page_fault_stats_t before = *stats;
+	for (uint32_t page = 0; page < BENCH_FAULT_COW_PAGES; ++page)
+		dest[page << PAGE_SHIFT] = (uint8_t)~page;
+	page_fault_stats_t copied = *stats;
+	for (uint32_t page = 0; page < BENCH_FAULT_COW_PAGES; ++page) {
+		if (src[page << PAGE_SHIFT] != (uint8_t)page)
+			klog_warning("benchmark_page_fault: Write to a copy reached the original at page %d\n", page);
+		src[page << PAGE_SHIFT] = 0;
+	}
+
+	uint32_t copies = copied.major - before.major;
+	uint32_t reuses = stats->minor - copied.minor;
+	klog_info(
+		"page fault: %d copy-on-write faults copied the page at %lu cycles, %d had it to themselves at %lu cycles\n",
+		copies, (copied.cycles - before.cycles) / (copies ? copies : 1),
+		reuses, (stats->cycles - copied.cycles) / (reuses ? reuses : 1));
+	vfree(src);
+	vfree(dest);
+	page_fault_dump_stats();
+}
+
+void _bench_fault_touch(uint8_t* addr, uint32_t stride) {
+	for (uint32_t page = 0; page < BENCH_FAULT_PAGES; page += stride)
+		addr[page << PAGE_SHIFT] = 1;
+}
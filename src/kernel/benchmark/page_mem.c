@@ -0,0 +1,69 @@
+/// @file page_mem.c
+
+#include <namuos/benchmark.h> // Implements
+
+#include <stdbool.h>
+#include <string.h> // memcpy, memset
+#include <namuos/cpu.h>
+#include <namuos/page_allocator.h>
+#include <namuos/page_mem.h>
+#include <namuos/terminal.h>
+
+
+// Pages cleared and copied each round, and the number of rounds
+#define BENCH_PAGE_MEM_PAGES  64
+#define BENCH_PAGE_MEM_ROUNDS 16
+
+/// Clears (or copies, if `src` is set) @ref BENCH_PAGE_MEM_PAGES pages at
+///  `dest` for each round, with memset and memcpy if `libc` is set, and
+///  clear_page and copy_page otherwise. Returns the cycles taken per page.
+uint64_t _bench_page_mem_round(uint8_t* dest, const uint8_t* src, bool libc);
+
+
+void benchmark_page_mem() {
+	uint32_t pfn = page_alloc_pfn_exact(2 * BENCH_PAGE_MEM_PAGES, GFP_KERNEL);
+	if (pfn == PAGE_PFN_NONE) {
+		klog_warning("benchmark_page_mem: Ran out of memory\n");
+		return;
+	}
+	uint8_t* dest = (uint8_t*)page_to_virt(pfn_to_page(pfn));
+	uint8_t* src = dest + BENCH_PAGE_MEM_PAGES * PAGE_SIZE;
+
+	uint64_t memset_cycles = _bench_page_mem_round(dest, NULL, true);
+	uint64_t clear_cycles = _bench_page_mem_round(dest, NULL, false);
+	uint64_t memcpy_cycles = _bench_page_mem_round(dest, src, true);
+	uint64_t copy_cycles = _bench_page_mem_round(dest, src, false);
+	page_free_pfn_exact(pfn, 2 * BENCH_PAGE_MEM_PAGES);
+
+	// What page_mem_initialise measured for each variant, 0 if unsupported
+	page_mem_cpu_t* cpu = &page_mem_cpu[smp_processor_id()];
+	for (uint32_t variant = 0; variant < PAGE_MEM_VARIANTS; ++variant) {
+		klog_info(
+			"page mem: %s probed at %d cycles/page clearing, %d cycles/page copying\n",
+			page_mem_variant_name(variant), cpu->clear_cycles[variant], cpu->copy_cycles[variant]);
+	}
+	klog_info(
+		"page mem: memset %lu cycles/page, clear_page (%s) %lu cycles/page\n",
+		memset_cycles, page_mem_variant_name(cpu->clear_variant), clear_cycles);
+	klog_info(
+		"page mem: memcpy %lu cycles/page, copy_page (%s) %lu cycles/page\n",
+		memcpy_cycles, page_mem_variant_name(cpu->copy_variant), copy_cycles);
+}
+
+uint64_t _bench_page_mem_round(uint8_t* dest, const uint8_t* src, bool libc) {
+	uint64_t begin = rdtsc();
+	for (uint32_t round = 0; round < BENCH_PAGE_MEM_ROUNDS; ++round) {
+		for (uint32_t i = 0; i < BENCH_PAGE_MEM_PAGES; ++i) {
+			uint8_t* page = dest + i * PAGE_SIZE;
+			if (src != NULL && libc)
+				memcpy(page, src + i * PAGE_SIZE, PAGE_SIZE);
+			else if (src != NULL)
+				copy_page(page, src + i * PAGE_SIZE);
+			else if (libc)
+				memset(page, 0, PAGE_SIZE);
+			else
+				clear_page(page);
+		}
+	}
+	return (rdtsc() - begin) / (BENCH_PAGE_MEM_ROUNDS * BENCH_PAGE_MEM_PAGES);
+}
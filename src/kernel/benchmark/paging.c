@@ -0,0 +1,156 @@
+/// @file paging.c
+
+#include <namuos/benchmark.h> // Implements
+
+#include <namuos/cpu.h>
+#include <namuos/memblock.h>
+#include <namuos/page_allocator.h>
+#include <namuos/paging.h>
+#include <namuos/terminal.h>
+
+
+// Region of the linear mapping swept, and how many times. 64 MiB is far more
+//  pages than the TLB can hold with 4 KiB pages, but only 16 with 4 MiB pages
+//  (or 32 with PAE's 2 MiB pages).
+#define BENCH_SWEEP_START  ZONE_NORMAL_OFFSET
+#define BENCH_SWEEP_PDES   (0x04000000 / PGDIR_SIZE)
+#define BENCH_SWEEP_PASSES 8
+
+// Kernel pages re-touched after each page directory switch, and how many
+//  switches are timed. These are in the kernel image, mapped by `boot.S`.
+#define BENCH_SWITCH_START  0x00100000
+#define BENCH_SWITCH_PAGES  256
+#define BENCH_SWITCH_ROUNDS 64
+
+/// Switches page directory and re-touches the kernel pages, `rounds` times.
+///  Returns the number of cycles taken, not counting the warm up before each.
+uint64_t _bench_switch(uint32_t rounds);
+
+/// Reads one word from every page in `[start, start + size)`, `passes` times.
+///  Returns the number of cycles taken.
+uint64_t _bench_sweep(uintptr_t start, uint32_t size, uint32_t passes);
+
+
+void benchmark_linear_sweep() {
+	if (!paging_pse_enabled) {
+		klog_info("linear sweep: Large pages not enabled, skipping\n");
+		return;
+	}
+
+	// Don't sweep past the end of RAM
+	uint32_t pdes = BENCH_SWEEP_PDES;
+	uint64_t ram_end = memblock_end_of_ram();
+	if (ram_end < BENCH_SWEEP_START + PGDIR_SIZE) {
+		klog_info("linear sweep: Not enough RAM, skipping\n");
+		return;
+	}
+	if (ram_end < BENCH_SWEEP_START + pdes * PGDIR_SIZE)
+		pdes = (ram_end - BENCH_SWEEP_START) / PGDIR_SIZE;
+
+	uintptr_t start = (uintptr_t)__to_virt(BENCH_SWEEP_START);
+	uint32_t size = pdes * PGDIR_SIZE;
+	uint32_t pages = pdes * PTRS_PER_PTE * BENCH_SWEEP_PASSES;
+
+	// Time the sweep with the large pages set up by `paging_initialise`
+	_bench_sweep(start, size, 1); // Warm up
+	uint64_t pse_cycles = _bench_sweep(start, size, BENCH_SWEEP_PASSES);
+
+	// Temporarily remap the same region with 4 KiB page tables
+	uint32_t order = 0;
+	while ((1U << order) < pdes)
+		++order;
+	PTE_t* tables = (PTE_t*)page_alloc(order);
+	if (tables == NULL) {
+		klog_warning("linear sweep: No memory for page tables\n");
+		return;
+	}
+
+	PDE_t* pdes_start = &kernel_pgd[start >> PGDIR_SHIFT];
+	PDE_t saved[BENCH_SWEEP_PDES];
+	for (uint32_t i = 0; i < pdes; ++i) {
+		for (uint32_t j = 0; j < PTRS_PER_PTE; ++j) {
+			PTE_t* pte = &tables[i * PTRS_PER_PTE + j];
+			pte->raw = 0;
+			pte->present = 1;
+			pte->rw = 1;
+			pte->addr = (BENCH_SWEEP_START >> PAGE_SHIFT) + i * PTRS_PER_PTE + j;
+		}
+		saved[i] = pdes_start[i];
+		pdes_start[i].raw = 0;
+		pdes_start[i].present = 1;
+		pdes_start[i].rw = 1;
+		pdes_start[i].addr = (__to_phys(&tables[i * PTRS_PER_PTE]) >> PAGE_SHIFT);
+	}
+	paging_flush_tlb_all(); // Flush the old large page entries, which are global
+
+	_bench_sweep(start, size, 1); // Warm up
+	uint64_t small_cycles = _bench_sweep(start, size, BENCH_SWEEP_PASSES);
+
+	// Put the large pages back
+	for (uint32_t i = 0; i < pdes; ++i)
+		pdes_start[i] = saved[i];
+	paging_flush_tlb_all();
+	page_free(tables, order);
+
+	klog_info(
+		"linear sweep: %d MiB, 4 KiB pages %lu cycles/page, %d MiB pages %lu cycles/page\n",
+		size >> 20, small_cycles / pages, PGDIR_SIZE >> 20, pse_cycles / pages);
+}
+
+void benchmark_pgd_switch() {
+	if (!paging_pge_enabled) {
+		klog_info("pgd switch: PGE not enabled, skipping\n");
+		return;
+	}
+
+	// Time switches with global pages, then again with PGE turned off so that
+	//  every switch throws away the kernel's TLB entries too
+	uint64_t pge_cycles = _bench_switch(BENCH_SWITCH_ROUNDS);
+	write_cr4(read_cr4() & ~CR4_PGE);
+	uint64_t nopge_cycles = _bench_switch(BENCH_SWITCH_ROUNDS);
+	write_cr4(read_cr4() | CR4_PGE);
+
+	// Misses aren't counted, so assume every page re-touched without PGE
+	//  missed the TLB, and none did with it. The extra cost spread over the
+	//  re-touches then estimates what each kernel TLB miss costs.
+	uint32_t retouches = BENCH_SWITCH_PAGES * BENCH_SWITCH_ROUNDS;
+	uint64_t miss_cycles = (nopge_cycles > pge_cycles) ? (nopge_cycles - pge_cycles) / retouches : 0;
+	klog_info(
+		"pgd switch: %d kernel pages re-touched, %lu cycles/switch with PGE, %lu without (~%lu cycles per miss, if every re-touch missed)\n",
+		BENCH_SWITCH_PAGES, pge_cycles / BENCH_SWITCH_ROUNDS, nopge_cycles / BENCH_SWITCH_ROUNDS,
+		miss_cycles);
+}
+
+uint64_t _bench_switch(uint32_t rounds) {
+	uintptr_t start = (uintptr_t)__to_virt(BENCH_SWITCH_START);
+	uintptr_t end = start + BENCH_SWITCH_PAGES * PAGE_SIZE;
+	uint32_t sum = 0;
+	uint64_t cycles = 0;
+
+	for (uint32_t round = 0; round < rounds; ++round) {
+		// Make sure every page is in the TLB before switching
+		for (uintptr_t addr = start; addr < end; addr += PAGE_SIZE)
+			sum += *(volatile uint32_t*)addr;
+
+		uint64_t begin = rdtsc();
+		paging_change_pgd(current_pgd);
+		for (uintptr_t addr = start; addr < end; addr += PAGE_SIZE)
+			sum += *(volatile uint32_t*)addr;
+		cycles += rdtsc() - begin;
+	}
+
+	(void)sum;
+	return cycles;
+}
+
+uint64_t _bench_sweep(uintptr_t start, uint32_t size, uint32_t passes) {
+	uint32_t sum = 0;
+	uint64_t begin = rdtsc();
+	for (uint32_t pass = 0; pass < passes; ++pass) {
+		for (uintptr_t addr = start; addr < start + size; addr += PAGE_SIZE)
+			sum += *(volatile uint32_t*)addr;
+	}
+	uint64_t cycles = rdtsc() - begin;
+	(void)sum;
+	return cycles;
+}
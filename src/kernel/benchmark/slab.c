@@ -0,0 +1,64 @@
+/// @file slab.c
+
+#include <namuos/benchmark.h> // Implements
+
+#include <namuos/cpu.h>
+#include <namuos/page_allocator.h>
+#include <namuos/slab.h>
+#include <namuos/terminal.h>
+
+
+// Number of objects live at once in each round
+#define BENCH_SLAB_OBJECTS 1024
+
+// Object sizes to compare
+static const uint32_t _bench_slab_sizes[] = { 32, 64, 128, 256, 512 };
+
+// Objects live during a round
+static void* _bench_slab_objects[BENCH_SLAB_OBJECTS];
+
+/// Allocates @ref BENCH_SLAB_OBJECTS objects from `cache`, or pages if `cache`
+///  is NULL, then frees them all. Returns the cycles taken, and sets `pages`
+///  to the number of pages in use at the peak.
+uint64_t _bench_slab_round(kmem_cache_t* cache, uint32_t* pages);
+
+
+void benchmark_slab() {
+	for (uint32_t i = 0; i < sizeof(_bench_slab_sizes) / sizeof(_bench_slab_sizes[0]); ++i) {
+		uint32_t size = _bench_slab_sizes[i];
+		kmem_cache_t* cache = kmem_cache_create("benchmark", size, 0, NULL);
+		if (cache == NULL)
+			continue;
+
+		// Time the second round of each, once the caches and lists are warm
+		uint32_t slab_pages, page_pages;
+		_bench_slab_round(cache, &slab_pages);
+		uint64_t slab_cycles = _bench_slab_round(cache, &slab_pages);
+		_bench_slab_round(NULL, &page_pages);
+		uint64_t page_cycles = _bench_slab_round(NULL, &page_pages);
+		kmem_cache_destroy(cache);
+
+		klog_info(
+			"slab: %d-byte objects: %lu cycles/object in %d pages, vs %lu cycles/object in %d pages\n",
+			size, slab_cycles / BENCH_SLAB_OBJECTS, slab_pages,
+			page_cycles / BENCH_SLAB_OBJECTS, page_pages);
+	}
+}
+
+uint64_t _bench_slab_round(kmem_cache_t* cache, uint32_t* pages) {
+	uint64_t begin = rdtsc();
+	for (uint32_t i = 0; i < BENCH_SLAB_OBJECTS; ++i)
+		_bench_slab_objects[i] = cache ? kmem_cache_alloc(cache) : page_alloc(0);
+	uint64_t cycles = rdtsc() - begin;
+
+	*pages = cache ? cache->nr_slabs << cache->order : BENCH_SLAB_OBJECTS;
+
+	begin = rdtsc();
+	for (uint32_t i = 0; i < BENCH_SLAB_OBJECTS; ++i) {
+		if (cache)
+			kmem_cache_free(cache, _bench_slab_objects[i]);
+		else
+			page_free(_bench_slab_objects[i], 0);
+	}
+	return cycles + rdtsc() - begin;
+}
@@ -0,0 +1,76 @@
+/// @file terminal.c
+
+#include <namuos/benchmark.h> // Implements
+
+#include <namuos/bios_defines.h>
+#include <namuos/cpu.h>
+#include <namuos/paging.h>
+#include <namuos/terminal.h>
+
+
+// Number of scrolls and clears timed for each caching attribute
+#define BENCH_TERMINAL_ROUNDS 64
+
+// Newlines written to reach the bottom of the screen before timing scrolls.
+//  More than any text mode has rows.
+#define BENCH_TERMINAL_FILL 64
+
+/// Remaps video memory with the caching attribute `cache`
+void _bench_video_cache(enum page_cache cache);
+
+/// Times `BENCH_TERMINAL_ROUNDS` full-screen scrolls and clears, setting
+///  `scroll` and `clear` to the cycles taken for each
+void _bench_terminal(uint64_t* scroll, uint64_t* clear);
+
+
+void benchmark_terminal() {
+	if (!paging_pat_enabled) {
+		klog_info("terminal: PAT not enabled, skipping\n");
+		return;
+	}
+
+	// Time with the write-combining mapping from `paging_initialise`, and then
+	//  with the default write-back mapping. Video memory is left uncached by
+	//  the MTRRs, so write-back behaves as uncached here.
+	uint64_t wc_scroll, wc_clear, wb_scroll, wb_clear;
+	_bench_terminal(&wc_scroll, &wc_clear);
+	_bench_video_cache(PAGE_CACHE_WB);
+	_bench_terminal(&wb_scroll, &wb_clear);
+	_bench_video_cache(PAGE_CACHE_WC);
+	terminal_clear();
+
+	// Scrolls shift the terminal's write-back copy of the screen, so they only
+	//  read video memory if the mode is too large for it
+	klog_info(
+		"terminal: scroll %lu cycles write-back, %lu write-combining (%s)\n",
+		wb_scroll / BENCH_TERMINAL_ROUNDS, wc_scroll / BENCH_TERMINAL_ROUNDS,
+		terminal_shadowed() ? "shifted in a write-back copy, video memory only written"
+			: "shifted in video memory, so every read is uncached");
+	klog_info(
+		"terminal: clear %lu cycles write-back, %lu write-combining\n",
+		wb_clear / BENCH_TERMINAL_ROUNDS, wc_clear / BENCH_TERMINAL_ROUNDS);
+}
+
+void _bench_video_cache(enum page_cache cache) {
+	paging_map_range(
+		kernel_pgd, (uintptr_t)__to_virt(VIDEO_MEMORY_START), VIDEO_MEMORY_START,
+		(VIDEO_MEMORY_END - VIDEO_MEMORY_START) / PAGE_SIZE, PAGE_KERNEL, cache);
+	wbinvd();
+}
+
+void _bench_terminal(uint64_t* scroll, uint64_t* clear) {
+	// Once at the bottom of the screen, every newline scrolls the whole screen
+	terminal_clear();
+	for (uint32_t i = 0; i < BENCH_TERMINAL_FILL; ++i)
+		terminal_write_char('\n');
+
+	uint64_t begin = rdtsc();
+	for (uint32_t i = 0; i < BENCH_TERMINAL_ROUNDS; ++i)
+		terminal_write_char('\n');
+	*scroll = rdtsc() - begin;
+
+	begin = rdtsc();
+	for (uint32_t i = 0; i < BENCH_TERMINAL_ROUNDS; ++i)
+		terminal_clear();
+	*clear = rdtsc() - begin;
+}
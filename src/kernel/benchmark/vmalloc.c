@@ -0,0 +1,111 @@
+/// @file vmalloc.c
+
+#include <namuos/benchmark.h> // Implements
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <namuos/cpu.h>
+#include <namuos/page_allocator.h>
+#include <namuos/terminal.h>
+#include <namuos/vmalloc.h>
+
+
+// Number of areas live at once, the number of times one is replaced, and the
+//  largest area in pages
+#define BENCH_VMALLOC_AREAS     256
+#define BENCH_VMALLOC_STEPS     4096
+#define BENCH_VMALLOC_MAX_PAGES 32
+
+// Pages in each large allocation, and the number of them made each way
+#define BENCH_VMALLOC_LARGE_PAGES  512
+#define BENCH_VMALLOC_LARGE_ROUNDS 8
+
+// Areas live during the churn, and their sizes in bytes
+static uint8_t* _bench_vmalloc_areas[BENCH_VMALLOC_AREAS];
+static uint32_t _bench_vmalloc_sizes[BENCH_VMALLOC_AREAS];
+
+/// Allocates `size` bytes with vmalloc into slot `slot`, touching both ends of
+///  it so the mapping is used. Adds the cycles the allocation took to
+///  `cycles`, and returns false if it failed.
+bool _bench_vmalloc_fill(uint32_t slot, uint32_t size, uint64_t* cycles);
+
+
+void benchmark_vmalloc() {
+	// Churn areas of random sizes, so the free ranges fragment and the lazily
+	//  unmapped areas build up
+	uint32_t state = 0x9E3779B9;
+	uint64_t alloc_cycles = 0, free_cycles = 0;
+	uint32_t allocs = 0, frees = 0;
+	vmalloc_stats_t before = vmalloc_stats;
+	for (uint32_t step = 0; step < BENCH_VMALLOC_AREAS + BENCH_VMALLOC_STEPS; ++step) {
+		uint32_t slot = (step < BENCH_VMALLOC_AREAS) ? step : benchmark_random(&state) % BENCH_VMALLOC_AREAS;
+		uint8_t* addr = _bench_vmalloc_areas[slot];
+		if (addr != NULL) {
+			// Both ends should still hold what was written through the mapping
+			uint32_t size = _bench_vmalloc_sizes[slot];
+			if (addr[0] != (uint8_t)slot || addr[size - 1] != (uint8_t)slot)
+				klog_warning("benchmark_vmalloc: Area at 0x%p lost its contents\n", addr);
+
+			uint64_t begin = rdtsc();
+			vfree(addr);
+			free_cycles += rdtsc() - begin;
+			_bench_vmalloc_areas[slot] = NULL;
+			++frees;
+		}
+
+		uint32_t pages = 1 + benchmark_random(&state) % BENCH_VMALLOC_MAX_PAGES;
+		if (!_bench_vmalloc_fill(slot, pages << PAGE_SHIFT, &alloc_cycles)) {
+			klog_warning("benchmark_vmalloc: Ran out of memory\n");
+			break;
+		}
+		++allocs;
+	}
+	for (uint32_t slot = 0; slot < BENCH_VMALLOC_AREAS; ++slot) {
+		vfree(_bench_vmalloc_areas[slot]);
+		_bench_vmalloc_areas[slot] = NULL;
+	}
+	uint32_t purges = vmalloc_stats.purges - before.purges;
+
+	klog_info(
+		"vmalloc: %d allocs of 1-%d pages at %lu cycles, %d frees at %lu cycles\n",
+		allocs, BENCH_VMALLOC_MAX_PAGES, alloc_cycles / (allocs ? allocs : 1),
+		frees, free_cycles / (frees ? frees : 1));
+	klog_info(
+		"vmalloc: %d TLB flushes for %d areas unmapped lazily\n",
+		purges, vmalloc_stats.purged_areas - before.purged_areas);
+
+	// Large allocations, which vmalloc builds from single pages instead of
+	//  needing one free block
+	uint64_t vmalloc_cycles = 0, exact_cycles = 0;
+	for (uint32_t round = 0; round < BENCH_VMALLOC_LARGE_ROUNDS; ++round) {
+		uint64_t begin = rdtsc();
+		void* addr = vmalloc(BENCH_VMALLOC_LARGE_PAGES << PAGE_SHIFT);
+		vfree(addr);
+		vmalloc_cycles += rdtsc() - begin;
+
+		begin = rdtsc();
+		uint32_t pfn = page_alloc_pfn_exact(BENCH_VMALLOC_LARGE_PAGES, GFP_KERNEL);
+		if (pfn != PAGE_PFN_NONE)
+			page_free_pfn_exact(pfn, BENCH_VMALLOC_LARGE_PAGES);
+		exact_cycles += rdtsc() - begin;
+	}
+	klog_info(
+		"vmalloc: %d pages take %lu cycles with vmalloc, %lu cycles as a contiguous block\n",
+		BENCH_VMALLOC_LARGE_PAGES, vmalloc_cycles / BENCH_VMALLOC_LARGE_ROUNDS,
+		exact_cycles / BENCH_VMALLOC_LARGE_ROUNDS);
+	vmalloc_dump_stats();
+}
+
+bool _bench_vmalloc_fill(uint32_t slot, uint32_t size, uint64_t* cycles) {
+	uint64_t begin = rdtsc();
+	uint8_t* addr = vmalloc(size);
+	*cycles += rdtsc() - begin;
+	if (addr == NULL)
+		return false;
+
+	addr[0] = (uint8_t)slot;
+	addr[size - 1] = (uint8_t)slot;
+	_bench_vmalloc_areas[slot] = addr;
+	_bench_vmalloc_sizes[slot] = size;
+	return true;
+}
@@ -3,6 +3,9 @@
 #include <namuos/boot_allocator.h> // Implements
 
 #include <string.h> // memset
+#include <namuos/cpu.h>
+#include <namuos/memblock.h>
+#include <namuos/page_allocator.h>
 #include <namuos/paging.h>
 #include <namuos/panic.h>
 #include <namuos/terminal.h>
@@ -15,42 +18,98 @@ bootmem_data_t bootmem_data;
 //  end of the kernel image.
 extern void* _paddr_kernel_end;
 
-// Helpers to set, clear, and test bitmap bits
-void _bitmap_set(uint32_t pfn);
-void _bitmap_clear(uint32_t pfn);
-char _bitmap_test(uint32_t pfn);
+// Helpers to set and clear bitmap bits for a range of PFNs [pfn_start, pfn_end),
+//  working a whole word at a time where possible. Clearing panics if any of
+//  the bits were already clear.
+void _bitmap_set_range(uint32_t pfn_start, uint32_t pfn_end);
+void _bitmap_clear_range(uint32_t pfn_start, uint32_t pfn_end);
+
+// Size of the bitmap in bytes, rounded up to a whole number of words
+uint32_t _bitmap_size();
+
+// Length of the longest run of free frames in the bitmap
+uint32_t _bitmap_largest_free_run();
+
+// Helpers to find the first clear (free) or set (reserved) bit at or after
+//  `pfn`, but before `pfn_end`. Returns `pfn_end` if there is no such bit.
+uint32_t _bitmap_find_zero(uint32_t pfn, uint32_t pfn_end);
+uint32_t _bitmap_find_set(uint32_t pfn, uint32_t pfn_end);
+
+// Hands the free frames `[pfn_start, pfn_end)` to the page allocator as the
+//  largest naturally aligned blocks that fit. Returns number of pages given.
+uint32_t _bootmem_release_range(uint32_t pfn_start, uint32_t pfn_end);
 
 // Actual allocation method, wrapped by bootmem methods
 void* __bootmem_alloc(size_t size, uint32_t align, uintptr_t goal);
 
+// First PFN of each bootmem zone, where its cursor starts
+static const uint32_t _bootmem_zone_start_pfn[BOOTMEM_NR_ZONES] = {
+	ZONE_DMA_OFFSET / PAGE_SIZE,
+	ZONE_NORMAL_OFFSET / PAGE_SIZE,
+};
+
+// Which of the bootmem zone cursors a search starting at `pfn` uses
+uint32_t _bootmem_zone(uint32_t pfn);
+
+// Tries to pack an allocation into the partly used page at the end of the last
+//  allocation. Returns physical address of the allocation, or 0 if it won't fit.
+uintptr_t _bootmem_pack(size_t size, uint32_t align, uint32_t goal_pfn);
+
 
 void bootmem_initialise(multiboot_info_t* mb_info) {
-	// TODO: Check mb_info to see if we've got enough RAM to span ZONE_NORMAL
-	(void)mb_info; // Currently unused.
+	// Build the physical memory layout from the multiboot memory map
+	memblock_initialise(mb_info);
 
 	// Set up the boot allocator to span from the very start of physical memory
-	//  to the end of ZONE_NORMAL
+	//  to the end of RAM, or the end of ZONE_NORMAL if there's more than that.
+	uint64_t ram_end = memblock_end_of_ram();
+	if (ram_end > ZONE_HIGHMEM_OFFSET)
+		ram_end = ZONE_HIGHMEM_OFFSET;
 	bootmem_data.pfn_start = 0;
-	bootmem_data.pfn_end = ZONE_HIGHMEM_OFFSET / PAGE_SIZE;
-	bootmem_data.last_pfn = bootmem_data.pfn_start;
+	bootmem_data.pfn_end = ram_end / PAGE_SIZE;
+
+	// Round up the number of bytes needed to map all the PFNs in bitmap to a
+	//  whole number of words.
+	uint32_t bitmap_size = _bitmap_size();
+
+	// Place the bitmap in the first free pages of ZONE_NORMAL covered by the
+	//  boot mapping, leaving ZONE_DMA for devices. Without any ZONE_NORMAL,
+	//  it goes right after the kernel image. It gets whole pages to itself so
+	//  freeing is easier, so we'll say the last offset is 0.
+	uint64_t bitmap_paddr = memblock_alloc_range(
+		bitmap_size, PAGE_SIZE, ZONE_NORMAL_OFFSET, paging_boot_mapped_end());
+	if (bitmap_paddr == 0) {
+		bitmap_paddr = memblock_alloc_range(
+			bitmap_size, PAGE_SIZE, (uintptr_t)&_paddr_kernel_end, BOOT_MAPPED_SIZE);
+	}
+	if (bitmap_paddr == 0)
+		panic("bootmem_initialise: No room for bitmap\n");
+	bootmem_data.bitmap = (uint32_t*)__to_virt((uintptr_t)bitmap_paddr);
+	bootmem_data.last_pfn = (bitmap_paddr + bitmap_size + PAGE_SIZE - 1) / PAGE_SIZE;
 	bootmem_data.last_offset = 0;
 
-	// Round up the number of bytes needed to map all the PFNs in bitmap, and
-	//  find the address of the first frame after kernel image for allocation.
-	uint32_t bitmap_size = (bootmem_data.pfn_end - bootmem_data.pfn_start + 7) / 8;
-	uint32_t bitmap_alloc_pfn = ((uintptr_t)&_paddr_kernel_end + PAGE_SIZE - 1) / PAGE_SIZE;
+	// Each zone's next-fit cursor starts at the beginning of the zone. Freeing
+	//  frames below a cursor moves it back.
+	for (uint32_t zone = 0; zone < BOOTMEM_NR_ZONES; ++zone)
+		bootmem_data.next_pfn[zone] = _bootmem_zone_start_pfn[zone];
+
+	// Start with every frame reserved, then free only the whole frames that
+	//  memblock says are RAM and not in use. Holes in the memory map stay
+	//  reserved so we never allocate into them.
+	memset(bootmem_data.bitmap, 0xff, bitmap_size);
+	uint64_t free_start, free_end;
+	for (uint64_t addr = 0; memblock_next_free_range(addr, &free_start, &free_end); addr = free_end) {
+		if (free_start >= ram_end)
+			break;
+		if (free_end > ram_end)
+			free_end = ram_end;
+		bootmem_free(free_start, free_end - free_start);
+	}
 
-	// Make a naive allocation for the bitmap, and clear all bits to free the
-	//  frames. We'll say the last offset is 0 to indicate we should dedicate
-	//  all used pages as just for the bitmap so freeing is easier.
-	bootmem_data.bitmap = (char*)__to_virt(bitmap_alloc_pfn << PAGE_SHIFT);
-	bootmem_data.last_pfn = bitmap_alloc_pfn + (bitmap_size + PAGE_SIZE - 1) / PAGE_SIZE;
-	bootmem_data.last_offset = 0;
-	memset(bootmem_data.bitmap, 0, bitmap_size);
+	// Freeing the memory map's ranges may have refused partial pages at their
+	//  ends. Those aren't interesting, so start the stats from scratch.
+	bootmem_data.stats.refused_partial_pages = 0;
 
-	// Reserve all the frames in the kernel image up to the end of bitmap
-	bootmem_reserve(0x00000000, __to_phys(bootmem_data.bitmap) + bitmap_size);
-	
 	klog_debug(
 		"Initialsied boot allocator up to physical address 0x%p\n",
 		bootmem_data.pfn_end << PAGE_SHIFT);
@@ -61,9 +120,9 @@ void bootmem_reserve(uintptr_t paddr, size_t size) {
 	//  Round the start PFN down, and round the end PFN up.
 	uint32_t pfn_start = paddr / PAGE_SIZE;
 	uint32_t pfn_end = (paddr + size + PAGE_SIZE - 1) / PAGE_SIZE;
-	for (uint32_t pfn = pfn_start; pfn < pfn_end; ++pfn)
-		_bitmap_set(pfn);
-	// NOTE: Could possibly do this in bulk, setting whole bytes
+	if (pfn_end > bootmem_data.pfn_end)
+		pfn_end = bootmem_data.pfn_end; // Outside of the bitmap
+	_bitmap_set_range(pfn_start, pfn_end);
 }
 
 void bootmem_free(uintptr_t paddr, size_t size) {
@@ -71,26 +130,43 @@ void bootmem_free(uintptr_t paddr, size_t size) {
 	//  address raneg. Round the start PFN up, and round the end PFN down.
 	uint32_t pfn_start = (paddr + PAGE_SIZE - 1) / PAGE_SIZE;
 	uint32_t pfn_end = (paddr + size) / PAGE_SIZE;
-
-	for (uint32_t pfn = pfn_start; pfn < pfn_end; ++pfn) {
-		// If already cleared, panic for double free
-		if (_bitmap_test(pfn) == 0)
-			panic("Bootmem double free for PFN %d\n", pfn);
-		_bitmap_clear(pfn);
+	if (pfn_end > bootmem_data.pfn_end)
+		pfn_end = bootmem_data.pfn_end; // Outside of the bitmap
+	_bitmap_clear_range(pfn_start, pfn_end);
+
+	// Count the partial pages at either end that had to stay reserved
+	uint32_t spanned_start = paddr / PAGE_SIZE;
+	uint32_t spanned_end = (paddr + size + PAGE_SIZE - 1) / PAGE_SIZE;
+	if (pfn_start > pfn_end)
+		bootmem_data.stats.refused_partial_pages += spanned_end - spanned_start;
+	else
+		bootmem_data.stats.refused_partial_pages += (pfn_start - spanned_start) + (spanned_end - pfn_end);
+
+	// Pull back any cursor that has moved past the newly freed frames, so the
+	//  next search from that zone can find them.
+	for (uint32_t zone = 0; zone < BOOTMEM_NR_ZONES; ++zone) {
+		if (pfn_start < pfn_end && pfn_start < bootmem_data.next_pfn[zone]
+			&& pfn_end > _bootmem_zone_start_pfn[zone])
+			bootmem_data.next_pfn[zone] = (pfn_start > _bootmem_zone_start_pfn[zone])
+				? pfn_start : _bootmem_zone_start_pfn[zone];
 	}
-	// NOTE: Could possibly do this in bulk, clearing whole bytes
 }
 
 void* bootmem_alloc(size_t size) {
-	// Call actual allocator with the goal of allocating within ZONE_NORMAL
-	// TODO: Align with L1 cache size
-	return __bootmem_alloc(size, 1, ZONE_NORMAL_OFFSET);
+	// Call actual allocator with the goal of allocating within ZONE_NORMAL.
+	//  Aligned to a cache line so separate allocations never share one.
+	return __bootmem_alloc(size, cpu_info.cache_line_size, ZONE_NORMAL_OFFSET);
 }
 
 void* bootmem_alloc_low(size_t size) {
-	// Call actual allocator with the goal of allocating within ZONE_DMA
-	// TODO: Align with L1 cache size
-	return __bootmem_alloc(size, 1, ZONE_DMA_OFFSET);
+	// Call actual allocator with the goal of allocating within ZONE_DMA.
+	//  Aligned to a cache line so separate allocations never share one.
+	return __bootmem_alloc(size, cpu_info.cache_line_size, ZONE_DMA_OFFSET);
+}
+
+void* bootmem_alloc_aligned(size_t size, uint32_t align, uintptr_t goal) {
+	// Call actual allocator with the given alignment and goal
+	return __bootmem_alloc(size, align, goal);
 }
 
 void* bootmem_aligned_alloc(size_t size) {
@@ -105,81 +181,302 @@ void* bootmem_aligned_alloc_low(size_t size) {
 	return __bootmem_alloc(size, PAGE_SIZE, ZONE_DMA_OFFSET);
 }
 
-void _bitmap_set(uint32_t pfn) {
-	// Calculate index and bit number in bitmap
-	uint32_t index = (pfn - bootmem_data.pfn_start) / 8; // 8 bits per value
-	uint32_t bit_index = (pfn - bootmem_data.pfn_start) % 8;
+uint32_t bootmem_free_all() {
+	uint64_t start = rdtsc();
+	uint32_t released = 0;
+
+	// Walk the bitmap a word at a time for each run of free frames, and give
+	//  the whole run to the page allocator.
+	uint32_t pfn = bootmem_data.pfn_start;
+	while (pfn < bootmem_data.pfn_end) {
+		uint32_t run_start = _bitmap_find_zero(pfn, bootmem_data.pfn_end);
+		if (run_start >= bootmem_data.pfn_end)
+			break;
+		pfn = _bitmap_find_set(run_start, bootmem_data.pfn_end);
+		released += _bootmem_release_range(run_start, pfn);
+
+		// Remember the largest run for the stats, as the bitmap is going away
+		if (pfn - run_start > bootmem_data.stats.largest_free_run)
+			bootmem_data.stats.largest_free_run = pfn - run_start;
+	}
+
+	// The bitmap isn't needed anymore, so its pages can go too
+	uint32_t bitmap_size = _bitmap_size();
+	uintptr_t bitmap_paddr = __to_phys(bootmem_data.bitmap);
+	memblock_free(bitmap_paddr, bitmap_size);
+	bootmem_data.bitmap = NULL;
+	released += _bootmem_release_range(
+		bitmap_paddr / PAGE_SIZE,
+		(bitmap_paddr + bitmap_size + PAGE_SIZE - 1) / PAGE_SIZE);
+
+	// Frames in ZONE_HIGHMEM were never tracked by the bitmap, so hand over
+	//  whatever memblock says is free there, up to the end of mem_map
+	uint64_t highmem_end = PFN_PHYS(mem_map_pages);
+	uint64_t free_start, free_end;
+	for (uint64_t addr = ZONE_HIGHMEM_OFFSET; memblock_next_free_range(addr, &free_start, &free_end); addr = free_end) {
+		if (free_start >= highmem_end)
+			break;
+		if (free_end > highmem_end)
+			free_end = highmem_end;
+		uint32_t pfn_start = (free_start + PAGE_SIZE - 1) >> PAGE_SHIFT;
+		uint32_t pfn_end = free_end >> PAGE_SHIFT;
+		if (pfn_start < pfn_end)
+			released += _bootmem_release_range(pfn_start, pfn_end);
+	}
+
+	klog_info(
+		"bootmem: Released %d pages (%d KiB) to page allocator in %lu cycles\n",
+		released, released * (PAGE_SIZE / 1024), rdtsc() - start);
+	return released;
+}
+
+void bootmem_dump_stats() {
+	static const char* zone_names[BOOTMEM_NR_ZONES] = { "DMA", "NORMAL" };
+	bootmem_stats_t* stats = &bootmem_data.stats;
+
+	klog_info("bootmem stats:\n");
+	for (uint32_t zone = 0; zone < BOOTMEM_NR_ZONES; ++zone) {
+		bootmem_zone_stats_t* zone_stats = &stats->zones[zone];
+		uint32_t reserved_bytes = zone_stats->pages_reserved * PAGE_SIZE;
+		klog_info(
+			"  %s: %d allocs, %d bytes requested, %d pages reserved, %d bytes wasted\n",
+			zone_names[zone], zone_stats->alloc_count, zone_stats->bytes_requested,
+			zone_stats->pages_reserved, reserved_bytes - zone_stats->bytes_requested);
+	}
+
+	// If the bitmap is still around, work out the largest free run now.
+	//  Otherwise we've got the one from when it was retired.
+	uint32_t largest_free_run = stats->largest_free_run;
+	if (bootmem_data.bitmap != NULL)
+		largest_free_run = _bitmap_largest_free_run();
+
+	// The bitmap usually lives in ZONE_NORMAL, unless there isn't one
+	uint32_t bitmap_size = _bitmap_size();
+	if (bootmem_data.bitmap != NULL) {
+		uintptr_t bitmap_paddr = __to_phys(bootmem_data.bitmap);
+		klog_info(
+			"  bitmap: %d bytes in %d pages of ZONE_%s at 0x%p\n",
+			bitmap_size, (bitmap_size + PAGE_SIZE - 1) / PAGE_SIZE,
+			zone_names[_bootmem_zone(bitmap_paddr / PAGE_SIZE)], bitmap_paddr);
+	} else {
+		klog_info(
+			"  bitmap: %d bytes in %d pages (released)\n",
+			bitmap_size, (bitmap_size + PAGE_SIZE - 1) / PAGE_SIZE);
+	}
+	klog_info(
+		"  largest free run %d pages, %d failed allocs, %d partly freed pages left reserved\n",
+		largest_free_run, stats->failed_allocs, stats->refused_partial_pages);
+}
+
+uint32_t _bootmem_release_range(uint32_t pfn_start, uint32_t pfn_end) {
+	uint32_t pfn = pfn_start;
+	while (pfn < pfn_end) {
+		// Largest order the PFN is aligned to that still fits in the range
+		uint32_t order = PAGE_MAX_ORDER - 1;
+		if (pfn != 0 && (uint32_t)__builtin_ctz(pfn) < order)
+			order = __builtin_ctz(pfn);
+		while ((1U << order) > pfn_end - pfn)
+			--order;
+
+		page_allocator_add_block(pfn, order);
+		pfn += 1U << order;
+	}
+	return pfn_end - pfn_start;
+}
+
+uint32_t _bitmap_size() {
+	uint32_t bitmap_words = (bootmem_data.pfn_end - bootmem_data.pfn_start
+		+ BOOTMEM_BITS_PER_WORD - 1) / BOOTMEM_BITS_PER_WORD;
+	return bitmap_words * sizeof(uint32_t);
+}
+
+uint32_t _bitmap_largest_free_run() {
+	uint32_t largest = 0;
+	uint32_t pfn = bootmem_data.pfn_start;
+	while (pfn < bootmem_data.pfn_end) {
+		uint32_t run_start = _bitmap_find_zero(pfn, bootmem_data.pfn_end);
+		if (run_start >= bootmem_data.pfn_end)
+			break;
+		pfn = _bitmap_find_set(run_start, bootmem_data.pfn_end);
+		if (pfn - run_start > largest)
+			largest = pfn - run_start;
+	}
+	return largest;
+}
+
+void _bitmap_set_range(uint32_t pfn_start, uint32_t pfn_end) {
+	if (pfn_start >= pfn_end)
+		return;
+
+	// Bit offsets within the bitmap of the first and one-past-last PFN
+	uint32_t first = pfn_start - bootmem_data.pfn_start;
+	uint32_t last = pfn_end - bootmem_data.pfn_start;
+	uint32_t index = first / BOOTMEM_BITS_PER_WORD;
+	uint32_t last_index = (last - 1) / BOOTMEM_BITS_PER_WORD;
+
+	// Masks for the partial words at either end of the range. If the range
+	//  starts and ends in the same word, only the overlap of the two is set.
+	uint32_t head_mask = ~0U << (first % BOOTMEM_BITS_PER_WORD);
+	uint32_t tail_mask = ~0U >> ((BOOTMEM_BITS_PER_WORD - last % BOOTMEM_BITS_PER_WORD) % BOOTMEM_BITS_PER_WORD);
+	if (index == last_index) {
+		bootmem_data.bitmap[index] |= head_mask & tail_mask;
+		return;
+	}
+
+	// Set the head, fill every full word in one store, then set the tail
+	bootmem_data.bitmap[index++] |= head_mask;
+	while (index < last_index)
+		bootmem_data.bitmap[index++] = ~0U;
+	bootmem_data.bitmap[last_index] |= tail_mask;
+}
 
-	// Mark that bit as 1
-	bootmem_data.bitmap[index] |= (char)1 << bit_index;
+void _bitmap_clear_range(uint32_t pfn_start, uint32_t pfn_end) {
+	if (pfn_start >= pfn_end)
+		return;
+
+	// Bit offsets within the bitmap of the first and one-past-last PFN
+	uint32_t first = pfn_start - bootmem_data.pfn_start;
+	uint32_t last = pfn_end - bootmem_data.pfn_start;
+	uint32_t last_index = (last - 1) / BOOTMEM_BITS_PER_WORD;
+
+	// Walk each word spanned by the range, building a mask of the bits within
+	//  the range. Full words end up with a mask of all ones.
+	for (uint32_t index = first / BOOTMEM_BITS_PER_WORD; index <= last_index; ++index) {
+		uint32_t mask = ~0U;
+		if (index == first / BOOTMEM_BITS_PER_WORD)
+			mask &= ~0U << (first % BOOTMEM_BITS_PER_WORD);
+		if (index == last_index)
+			mask &= ~0U >> ((BOOTMEM_BITS_PER_WORD - last % BOOTMEM_BITS_PER_WORD) % BOOTMEM_BITS_PER_WORD);
+
+		// If any bit in the range is already cleared, panic for double free
+		uint32_t already_free = ~bootmem_data.bitmap[index] & mask;
+		if (already_free) {
+			uint32_t pfn = bootmem_data.pfn_start
+				+ index * BOOTMEM_BITS_PER_WORD + __builtin_ctz(already_free);
+			panic("Bootmem double free for PFN %d\n", pfn);
+		}
+		bootmem_data.bitmap[index] &= ~mask;
+	}
 }
 
-void _bitmap_clear(uint32_t pfn) {
-	// Calculate index and bit number in bitmap
-	uint32_t index = (pfn - bootmem_data.pfn_start) / 8; // 8 bits per value
-	uint32_t bit_index = (pfn - bootmem_data.pfn_start) % 8;
+uint32_t _bitmap_find_zero(uint32_t pfn, uint32_t pfn_end) {
+	// Walk the bitmap a word at a time. Inverting each word lets us use
+	//  `__builtin_ctz` (bsf) to find the lowest clear bit in one instruction.
+	//  Bits before `pfn` in the first word are masked off.
+	uint32_t bit = pfn - bootmem_data.pfn_start;
+	uint32_t end_bit = pfn_end - bootmem_data.pfn_start;
+	uint32_t index = bit / BOOTMEM_BITS_PER_WORD;
+	uint32_t word = ~bootmem_data.bitmap[index] & (~0U << (bit % BOOTMEM_BITS_PER_WORD));
+
+	while (!word) {
+		// Whole word reserved, move onto the next
+		if (++index * BOOTMEM_BITS_PER_WORD >= end_bit)
+			return pfn_end;
+		word = ~bootmem_data.bitmap[index];
+	}
 
-	// Mark that bit as 0
-	bootmem_data.bitmap[index] &= ~((char)1 << bit_index);
+	bit = index * BOOTMEM_BITS_PER_WORD + __builtin_ctz(word);
+	return (bit < end_bit) ? bootmem_data.pfn_start + bit : pfn_end;
 }
 
-char _bitmap_test(uint32_t pfn) {
-	// Calculate index and bit number in bitmap
-	uint32_t index = (pfn - bootmem_data.pfn_start) / 8; // 8 bits per value
-	uint32_t bit_index = (pfn - bootmem_data.pfn_start) % 8;
+uint32_t _bitmap_find_set(uint32_t pfn, uint32_t pfn_end) {
+	// Same as `_bitmap_find_zero`, without inverting the words
+	uint32_t bit = pfn - bootmem_data.pfn_start;
+	uint32_t end_bit = pfn_end - bootmem_data.pfn_start;
+	uint32_t index = bit / BOOTMEM_BITS_PER_WORD;
+	uint32_t word = bootmem_data.bitmap[index] & (~0U << (bit % BOOTMEM_BITS_PER_WORD));
+
+	while (!word) {
+		// Whole word free, move onto the next
+		if (++index * BOOTMEM_BITS_PER_WORD >= end_bit)
+			return pfn_end;
+		word = bootmem_data.bitmap[index];
+	}
 
-	// Check if bit is 1
-	return bootmem_data.bitmap[index] & ((char)1 << bit_index);
+	bit = index * BOOTMEM_BITS_PER_WORD + __builtin_ctz(word);
+	return (bit < end_bit) ? bootmem_data.pfn_start + bit : pfn_end;
 }
 
 void* __bootmem_alloc(size_t size, uint32_t align, uintptr_t goal) {
+	if (bootmem_data.bitmap == NULL)
+		panic("__bootmem_alloc: Called after bootmem_free_all\n");
+
+	// Alignment has to be a power of two, and no larger than a 4 MiB page
+	if (align == 0 || (align & (align - 1)) || align > BOOTMEM_MAX_ALIGN) {
+		klog_warning("__bootmem_alloc: Invalid alignment %d\n", align);
+		return NULL;
+	}
+
 	// Find what PFN the goal lands in, and how many PFNs we need for allocation
 	uint32_t goal_pfn = goal / PAGE_SIZE;
 	uint32_t needed_pfns = (size + PAGE_SIZE - 1) / PAGE_SIZE; // Rounded up
 	// NOTE: Ideally, `goal` will be on a page boundary
 
-	// Starting from the goal, search for a linear string of pages that fit the
-	//  allocation.
-	uint32_t block_pfn = goal_pfn; // PFN of the start of the block
-	uint32_t found_pfns = 0; // Number of pages found in a row
-	for (uint32_t pfn = goal_pfn; pfn < bootmem_data.pfn_end; ++pfn) {
-		// If `pfn` is an occupied page, reset our count and block start
-		if (_bitmap_test(pfn)) {
-			block_pfn = pfn + 1; // Current PFN is reserved, we'll check next block
-			found_pfns = 0;
-			continue;
+	// Packing allocations: If the last page allocated is only partly used, try
+	//  to continue on from the end of the last allocation (given alignment).
+	//  This keeps small allocations from each taking a whole page.
+	uintptr_t alloc_paddr = _bootmem_pack(size, align, goal_pfn);
+	bool packed = (alloc_paddr != 0);
+	if (!packed) {
+		// Couldn't pack, so search for a fresh block. Every page in the goal's
+		//  zone before its cursor is known to be reserved, so start from
+		//  whichever of the goal and cursor is further along.
+		uint32_t* cursor = &bootmem_data.next_pfn[_bootmem_zone(goal_pfn)];
+		uint32_t pfn = (*cursor > goal_pfn) ? *cursor : goal_pfn;
+		bool from_cursor = (*cursor >= goal_pfn);
+		uint32_t first_free = bootmem_data.pfn_end; // First free page found
+
+		// Blocks aligned to more than a page have to start on a multiple of
+		//  that many pages.
+		uint32_t align_pfns = (align > PAGE_SIZE) ? align / PAGE_SIZE : 1;
+		bool found = false;
+		while (pfn < bootmem_data.pfn_end) {
+			// Skip to the next free page, and round up to the alignment
+			uint32_t block_pfn = _bitmap_find_zero(pfn, bootmem_data.pfn_end);
+			if (first_free == bootmem_data.pfn_end)
+				first_free = block_pfn;
+			block_pfn = (block_pfn + align_pfns - 1) & ~(align_pfns - 1);
+			if (block_pfn >= bootmem_data.pfn_end || needed_pfns > bootmem_data.pfn_end - block_pfn)
+				break;
+
+			// The block is ours if there's no reserved page in it. Otherwise,
+			//  carry on searching after the reserved page.
+			pfn = _bitmap_find_set(block_pfn, block_pfn + needed_pfns);
+			if (pfn == block_pfn + needed_pfns) {
+				alloc_paddr = block_pfn << PAGE_SHIFT;
+				found = true;
+				break;
+			}
 		}
 
-		// Otherwise, add one PFN to the block and check if we've got a large
-		//  enough region for the allocation
-		found_pfns += 1;
-		if (found_pfns >= needed_pfns)
-			break;
-	}
+		// Move the cursor up to the first page that might still be free. If
+		//  the block started at the first free page, that's the end of the
+		//  block; otherwise there's a gap before it we can use later.
+		if (from_cursor) {
+			if (found && (alloc_paddr >> PAGE_SHIFT) == first_free)
+				*cursor = first_free + needed_pfns;
+			else
+				*cursor = first_free;
+		}
 
-	// Check if we successfully found a large enough block. If not, log a
-	//  warning and return null pointer
-	if (found_pfns < needed_pfns) {
-		klog_warning("__bootmem_alloc: Not enough memory for allocation of size %d\n", size);
-		return NULL;
+		// Check if we successfully found a large enough block. If not, log a
+		//  warning and return null pointer
+		if (!found) {
+			bootmem_data.stats.failed_allocs += 1;
+			klog_warning("__bootmem_alloc: Not enough memory for allocation of size %d\n", size);
+			return NULL;
+		}
 	}
 
-	// This will be the physical address of allocation. May be adjusted by
-	//  merging allocations.
-	uintptr_t alloc_paddr = block_pfn << PAGE_SHIFT;
-
-	// Merging allocations: If the start of the new block is adjacent to the
-	//  last allocation, and there's enough space remaining on that last page,
-	//  we can merge the allocation onto that last page (given alignment)
-	if (
-		(block_pfn == bootmem_data.last_pfn - 1) && // Block is adjacent
-		(bootmem_data.last_offset != 0) && // Last page wasn't full
-		(align != PAGE_SIZE) // TODO: Handle alignment other than PAGE_SIZE
-	) {
-		// Cna merge the allocation! Shift our paddr back to start at the last
-		//  offset.
-		alloc_paddr -= (PAGE_SIZE - bootmem_data.last_offset);
-	}
+	// Record the allocation against the zone it landed in. Only pages that
+	//  weren't already partly used count as newly reserved.
+	bootmem_zone_stats_t* stats = &bootmem_data.stats.zones[_bootmem_zone(alloc_paddr / PAGE_SIZE)];
+	uint32_t new_pages = (alloc_paddr + size + PAGE_SIZE - 1) / PAGE_SIZE - alloc_paddr / PAGE_SIZE;
+	if (packed)
+		new_pages -= 1;
+	stats->alloc_count += 1;
+	stats->bytes_requested += size;
+	stats->pages_reserved += new_pages;
 
 	// Update the last PFN and offset for the last byte of allocation
 	bootmem_data.last_pfn = (alloc_paddr + size - 1) / PAGE_SIZE;
@@ -190,3 +487,36 @@ void* __bootmem_alloc(size_t size, uint32_t align, uintptr_t goal) {
 	bootmem_reserve(alloc_paddr, size);
 	return __to_virt(alloc_paddr);
 }
+
+uint32_t _bootmem_zone(uint32_t pfn) {
+	if (pfn < ZONE_NORMAL_OFFSET / PAGE_SIZE)
+		return BOOTMEM_ZONE_DMA;
+	return BOOTMEM_ZONE_NORMAL;
+}
+
+uintptr_t _bootmem_pack(size_t size, uint32_t align, uint32_t goal_pfn) {
+	// Only pack into a partly used page at or after the goal, and within the
+	//  same zone as the goal so low allocations don't end up in ZONE_NORMAL
+	if (bootmem_data.last_offset == 0 || bootmem_data.last_pfn < goal_pfn
+		|| _bootmem_zone(bootmem_data.last_pfn) != _bootmem_zone(goal_pfn))
+		return 0;
+
+	// Align the end of the last allocation. If that pushes us off the end of
+	//  the partly used page, there's nothing to pack into.
+	uintptr_t page_paddr = bootmem_data.last_pfn << PAGE_SHIFT;
+	uintptr_t start = (page_paddr + bootmem_data.last_offset + align - 1) & ~(uintptr_t)(align - 1);
+	if (start >= page_paddr + PAGE_SIZE)
+		return 0;
+
+	// If the allocation spills over the partly used page, the pages it spills
+	//  into must all be free
+	uint32_t end_pfn = (start + size + PAGE_SIZE - 1) / PAGE_SIZE;
+	if (end_pfn > bootmem_data.last_pfn + 1) {
+		if (end_pfn > bootmem_data.pfn_end)
+			return 0;
+		if (_bitmap_find_set(bootmem_data.last_pfn + 1, end_pfn) != end_pfn)
+			return 0;
+	}
+
+	return start;
+}
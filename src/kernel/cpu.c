@@ -0,0 +1,88 @@
+/// @file cpu.c
+
+#include <namuos/cpu.h> // Implements
+
+#include <namuos/io.h>
+#include <namuos/terminal.h>
+
+
+// CPU information
+cpu_info_t cpu_info = { .cache_line_size = CPU_DEFAULT_CACHE_LINE_SIZE };
+
+// PIT channel 2 is used to time the TSC. Its gate and output are wired to port
+//  0x61, so it can be polled without interrupts.
+#define PIT_FREQUENCY     1193182 // Hz
+#define PIT_CHANNEL2_PORT 0x42
+#define PIT_COMMAND_PORT  0x43
+#define PIT_GATE_PORT     0x61
+#define PIT_CALIBRATE_MS  10
+
+// Measures the TSC frequency, returning it in kHz, or 0 if it couldn't be
+//  measured
+uint32_t _cpu_calibrate_tsc();
+
+
+void cpu_initialise() {
+	uint32_t eax, ebx, ecx, edx;
+
+	// Leaf 0 gives the highest basic leaf supported
+	cpuid(0, &eax, &ebx, &ecx, &edx);
+	cpu_info.max_leaf = eax;
+	if (cpu_info.max_leaf < 1)
+		return;
+
+	// Leaf 1 gives the feature flags. If CLFLUSH is supported, bits 8-15 of
+	//  EBX give the cache line size in 8 byte units.
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	cpu_info.features_ecx = ecx;
+	cpu_info.features_edx = edx;
+	if ((edx & CPUID_EDX_CLFSH) && ((ebx >> 8) & 0xff) != 0)
+		cpu_info.cache_line_size = ((ebx >> 8) & 0xff) * 8;
+
+	// Extended leaves report features such as the execute-disable bit
+	cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+	cpu_info.max_ext_leaf = eax;
+	if (cpu_info.max_ext_leaf >= 0x80000001) {
+		cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+		cpu_info.ext_features_edx = edx;
+	}
+
+	// SSE instructions raise #UD until the OS says it saves their state. Only
+	//  the kernel runs, and nothing switches tasks yet, so there's no state to
+	//  save, but FXSAVE has to be supported to be allowed to turn them on.
+	uint32_t sse = CPUID_EDX_SSE | CPUID_EDX_FXSR;
+	if ((cpu_info.features_edx & sse) == sse) {
+		write_cr0((read_cr0() & ~CR0_EM) | CR0_MP);
+		write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+	}
+
+	// Time the TSC against the PIT, so cycle counts can be turned into time
+	if (cpu_info.features_edx & CPUID_EDX_TSC)
+		cpu_info.tsc_khz = _cpu_calibrate_tsc();
+
+	klog_debug(
+		"cpu: Cache line size %d bytes, TSC %d kHz\n",
+		cpu_info.cache_line_size, cpu_info.tsc_khz);
+}
+
+uint32_t _cpu_calibrate_tsc() {
+	// Raise channel 2's gate with the speaker off, and start it counting down
+	//  in mode 0 (interrupt on terminal count), which raises its output at 0
+	outb(PIT_GATE_PORT, (inb(PIT_GATE_PORT) & ~0x02) | 0x01);
+	outb(PIT_COMMAND_PORT, 0xb0); // Channel 2, low then high byte, mode 0
+	uint32_t latch = PIT_FREQUENCY / (1000 / PIT_CALIBRATE_MS);
+	outb(PIT_CHANNEL2_PORT, latch & 0xff);
+	outb(PIT_CHANNEL2_PORT, latch >> 8);
+
+	// Wait for the output to go high. If it's already high, or never does,
+	//  there's no working PIT to measure against.
+	uint64_t start = rdtsc();
+	uint32_t polls = 0;
+	while ((inb(PIT_GATE_PORT) & 0x20) == 0 && polls < 0x1000000)
+		++polls;
+	uint64_t cycles = rdtsc() - start;
+	if (polls == 0 || polls == 0x1000000)
+		return 0;
+
+	return cycles / PIT_CALIBRATE_MS;
+}
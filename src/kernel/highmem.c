@@ -0,0 +1,222 @@
+/// @file highmem.c
+
+#include <namuos/highmem.h> // Implements
+
+#include <stddef.h>
+#include <namuos/page_mem.h>
+#include <namuos/panic.h>
+#include <namuos/spinlock.h>
+#include <namuos/terminal.h>
+
+
+// Number of chains in the table finding the slot a PFN is mapped at. A power
+//  of two, so hashing is a mask.
+#define PKMAP_HASH_SIZE 256
+
+// Marks the end of a chain, and a PFN without a slot
+#define PKMAP_NONE UINT32_MAX
+
+// Use count of each slot: 0 if it's free and unmapped, 1 if it has no users
+//  but is still mapped, and otherwise one more than its number of users
+static uint32_t _pkmap_count[LAST_PKMAP];
+
+// PFN mapped at each slot, and the next slot on the same hash chain
+static uint32_t _pkmap_pfn[LAST_PKMAP];
+static uint32_t _pkmap_next[LAST_PKMAP];
+
+// First slot on each hash chain
+static uint32_t _pkmap_hash[PKMAP_HASH_SIZE];
+
+// Slot the search for a free one carries on from
+static uint32_t _pkmap_last = 0;
+
+// Held while changing any of the above
+static spinlock_t _pkmap_lock = SPINLOCK_INIT;
+
+// PTEs of the first slot of each window, set by highmem_initialise
+static PTE_t* _pkmap_ptes = NULL;
+static PTE_t* _kmap_atomic_ptes = NULL;
+
+// PTE flags for every mapping, without the NX bit if it's reserved
+static paging_entry_t _kmap_prot = PAGE_KERNEL;
+
+// Number of kmap_atomic slots each CPU is using
+static uint32_t _kmap_atomic_depth[NR_CPUS];
+
+kmap_stats_t kmap_stats;
+
+
+// Gets the chain of the hash table PFN `pfn` is on
+uint32_t _pkmap_hash_index(uint32_t pfn);
+
+// Finds the slot `pfn` is mapped at, or returns PKMAP_NONE. The lock must be
+//  held.
+uint32_t _pkmap_lookup(uint32_t pfn);
+
+// Maps `pfn` at a free slot and adds it to the hash table with no users. Goes
+//  round the slots from the last one used, unmapping every unused one when
+//  it wraps. Returns PKMAP_NONE if every slot is in use. The lock must be held.
+uint32_t _pkmap_map(uint32_t pfn);
+
+// Unmaps every slot without users, removing them from the hash table, and
+//  invalidates them all at once. The lock must be held.
+void _pkmap_flush_unused();
+
+
+void highmem_initialise() {
+	if (!paging_nx_enabled)
+		_kmap_prot &= ~(paging_entry_t)PTE_NX;
+
+	_pkmap_ptes = paging_get_pte(kernel_pgd, PKMAP_BASE, true);
+	_kmap_atomic_ptes = paging_get_pte(kernel_pgd, KMAP_ATOMIC_BASE, true);
+	if (_pkmap_ptes == NULL || _kmap_atomic_ptes == NULL)
+		panic("highmem: No memory for the kmap page tables\n");
+
+	for (uint32_t i = 0; i < PKMAP_HASH_SIZE; ++i)
+		_pkmap_hash[i] = PKMAP_NONE;
+
+	klog_debug("highmem: %d kmap slots at 0x%p, %d kmap_atomic slots per CPU at 0x%p\n",
+		LAST_PKMAP, PKMAP_BASE, KMAP_ATOMIC_SLOTS, KMAP_ATOMIC_BASE);
+}
+
+void* kmap(page_t* page) {
+	if (!page_is_highmem(page))
+		return page_to_virt(page);
+
+	uint32_t pfn = page_to_pfn(page);
+	spin_lock(&_pkmap_lock);
+	uint32_t slot = _pkmap_lookup(pfn);
+	if (slot != PKMAP_NONE)
+		++kmap_stats.hits;
+	else if ((slot = _pkmap_map(pfn)) == PKMAP_NONE) {
+		++kmap_stats.fails;
+		spin_unlock(&_pkmap_lock);
+		klog_warning("kmap: Every slot is in use, can't map PFN %d\n", pfn);
+		return NULL;
+	}
+	++_pkmap_count[slot];
+	spin_unlock(&_pkmap_lock);
+	return (void*)PKMAP_ADDR(slot);
+}
+
+void kunmap(page_t* page) {
+	if (!page_is_highmem(page))
+		return;
+
+	uint32_t pfn = page_to_pfn(page);
+	spin_lock(&_pkmap_lock);
+	uint32_t slot = _pkmap_lookup(pfn);
+	if (slot == PKMAP_NONE || _pkmap_count[slot] < 2)
+		panic("kunmap: PFN %d isn't mapped by kmap\n", pfn);
+
+	// The slot stays mapped at 1, until it's needed for another page
+	--_pkmap_count[slot];
+	spin_unlock(&_pkmap_lock);
+}
+
+void* kmap_atomic(page_t* page) {
+	if (!page_is_highmem(page))
+		return page_to_virt(page);
+
+	uint32_t cpu = smp_processor_id();
+	uint32_t slot = _kmap_atomic_depth[cpu];
+	if (slot >= KMAP_ATOMIC_SLOTS)
+		panic("kmap_atomic: CPU %d has no slots left\n", cpu);
+	_kmap_atomic_depth[cpu] = slot + 1;
+
+	// Only this CPU uses its window, so the one invalidation is all it needs
+	void* addr = (void*)KMAP_ATOMIC_ADDR(cpu, slot);
+	_kmap_atomic_ptes[cpu * KMAP_ATOMIC_SLOTS + slot].raw = page_to_phys(page) | _kmap_prot;
+	invalidate_page(addr);
+	return addr;
+}
+
+void kunmap_atomic(void* addr) {
+	uintptr_t vaddr = (uintptr_t)addr & PAGE_MASK;
+	if (vaddr < KMAP_ATOMIC_BASE || vaddr >= KMAP_ATOMIC_ADDR(NR_CPUS, 0))
+		return; // From the linear mapping
+
+	uint32_t cpu = smp_processor_id();
+	uint32_t slot = _kmap_atomic_depth[cpu];
+	if (slot == 0 || vaddr != KMAP_ATOMIC_ADDR(cpu, slot - 1))
+		panic("kunmap_atomic: 0x%p isn't the last kmap_atomic on CPU %d\n", addr, cpu);
+	_kmap_atomic_depth[cpu] = slot - 1;
+}
+
+void clear_highpage(page_t* page) {
+	void* addr = kmap_atomic(page);
+	clear_page(addr);
+	kunmap_atomic(addr);
+}
+
+void copy_highpage(page_t* dest, page_t* src) {
+	void* dest_addr = kmap_atomic(dest);
+	void* src_addr = kmap_atomic(src);
+	copy_page(dest_addr, src_addr);
+	kunmap_atomic(src_addr);
+	kunmap_atomic(dest_addr);
+}
+
+uint32_t _pkmap_hash_index(uint32_t pfn) {
+	// Neighbouring pages are often mapped together, so keep them on different
+	//  chains
+	return pfn & (PKMAP_HASH_SIZE - 1);
+}
+
+uint32_t _pkmap_lookup(uint32_t pfn) {
+	uint32_t slot = _pkmap_hash[_pkmap_hash_index(pfn)];
+	while (slot != PKMAP_NONE && _pkmap_pfn[slot] != pfn)
+		slot = _pkmap_next[slot];
+	return slot;
+}
+
+uint32_t _pkmap_map(uint32_t pfn) {
+	// Slots at 0 were invalidated when they were unmapped, so the new entry
+	//  needs no invalidation of its own. Flushing frees up slots already
+	//  passed, so go round once more after it.
+	uint32_t slot = _pkmap_last;
+	for (uint32_t left = LAST_PKMAP; left > 0; --left) {
+		slot = (slot + 1) & (LAST_PKMAP - 1);
+		if (slot == 0) {
+			_pkmap_flush_unused();
+			left = LAST_PKMAP;
+		}
+		if (_pkmap_count[slot] != 0)
+			continue;
+
+		_pkmap_ptes[slot].raw = PFN_PHYS(pfn) | _kmap_prot;
+		_pkmap_count[slot] = 1;
+		_pkmap_pfn[slot] = pfn;
+		uint32_t* head = &_pkmap_hash[_pkmap_hash_index(pfn)];
+		_pkmap_next[slot] = *head;
+		*head = slot;
+		_pkmap_last = slot;
+		++kmap_stats.maps;
+		return slot;
+	}
+	return PKMAP_NONE;
+}
+
+void _pkmap_flush_unused() {
+	paging_gather_t gather;
+	paging_gather_init(&gather, kernel_pgd);
+
+	for (uint32_t i = 0; i < PKMAP_HASH_SIZE; ++i) {
+		uint32_t* link = &_pkmap_hash[i];
+		while (*link != PKMAP_NONE) {
+			uint32_t slot = *link;
+			if (_pkmap_count[slot] != 1) {
+				link = &_pkmap_next[slot];
+				continue;
+			}
+
+			*link = _pkmap_next[slot];
+			paging_gather_add(&gather, PKMAP_ADDR(slot), _pkmap_ptes[slot].raw);
+			_pkmap_ptes[slot].raw = 0;
+			_pkmap_count[slot] = 0;
+		}
+	}
+
+	paging_gather_flush(&gather);
+	++kmap_stats.flushes;
+}
@@ -0,0 +1,116 @@
+/// @file idt.c
+
+#include <namuos/idt.h> // Implements
+
+#include <stddef.h>
+#include <namuos/page_fault.h>
+#include <namuos/panic.h>
+#include <namuos/terminal.h>
+
+
+// Address of each entry stub, from `entry.S`
+extern const uintptr_t _entry_stubs[IDT_ENTRIES];
+
+// Operand of `lidt`, giving the size and address of the IDT
+typedef struct {
+	uint16_t limit;
+	uint32_t base;
+} __attribute__((packed)) _idt_pointer_t;
+
+// Panics with everything saved about an exception that has no handler
+void _idt_unhandled_exception(interrupt_frame_t* frame);
+
+// Logs an interrupt that has no handler, and carries on
+void _idt_unhandled_interrupt(interrupt_fast_frame_t* frame);
+
+
+// The IDT. Every vector is pointed at its entry stub.
+static idt_gate_t _idt[IDT_ENTRIES] __attribute__((aligned(8)));
+
+// Handlers called by the entry stubs, which `entry.S` indexes by vector. The
+//  interrupt handlers start at vector `IDT_EXCEPTIONS`. Vectors without a
+//  handler point at a default one, so the stubs never have to check.
+idt_exception_handler_t _idt_exception_handlers[IDT_EXCEPTIONS] = {
+	[0 ... IDT_EXCEPTIONS - 1] = _idt_unhandled_exception
+};
+idt_interrupt_handler_t _idt_interrupt_handlers[IDT_ENTRIES - IDT_EXCEPTIONS] = {
+	[0 ... IDT_ENTRIES - IDT_EXCEPTIONS - 1] = _idt_unhandled_interrupt
+};
+
+// Mnemonic of each exception vector
+static const char* const _idt_exception_names[IDT_EXCEPTIONS] = {
+	"#DE divide error", "#DB debug", "NMI", "#BP breakpoint",
+	"#OF overflow", "#BR bound range exceeded", "#UD invalid opcode", "#NM device not available",
+	"#DF double fault", "coprocessor segment overrun", "#TS invalid TSS", "#NP segment not present",
+	"#SS stack segment fault", "#GP general protection fault", "#PF page fault", "reserved",
+	"#MF x87 floating point error", "#AC alignment check", "#MC machine check", "#XM SIMD floating point error",
+	"#VE virtualisation exception", "#CP control protection exception", "reserved", "reserved",
+	"reserved", "reserved", "reserved", "reserved",
+	"#HV hypervisor injection exception", "#VC VMM communication exception", "#SX security exception", "reserved"
+};
+
+
+void idt_initialise() {
+	for (uint32_t vector = 0; vector < IDT_ENTRIES; ++vector)
+		idt_set_gate(vector, (void (*)())_entry_stubs[vector], IDT_GATE_INTERRUPT);
+	idt_set_exception_handler(IDT_VECTOR_PAGE_FAULT, page_fault_handle);
+
+	_idt_pointer_t pointer = { sizeof(_idt) - 1, (uint32_t)_idt };
+	asm volatile ("lidt %0" : : "m"(pointer) : "memory");
+	klog_debug("Loaded IDT at 0x%p\n", _idt);
+}
+
+void idt_set_gate(uint8_t vector, void (*entry)(), uint8_t type) {
+	// Interrupts run in whatever code segment the bootloader left us in
+	uint16_t cs;
+	asm volatile ("mov %%cs, %0" : "=r"(cs));
+
+	uintptr_t offset = (uintptr_t)entry;
+	_idt[vector].offset_low = offset & 0xFFFF;
+	_idt[vector].selector = cs;
+	_idt[vector].zero = 0;
+	_idt[vector].type = type;
+	_idt[vector].offset_high = offset >> 16;
+}
+
+idt_exception_handler_t idt_set_exception_handler(uint8_t vector, idt_exception_handler_t handler) {
+	if (vector >= IDT_EXCEPTIONS)
+		panic("idt_set_exception_handler: Vector %d isn't an exception\n", vector);
+
+	idt_exception_handler_t old = _idt_exception_handlers[vector];
+	_idt_exception_handlers[vector] = (handler != NULL) ? handler : _idt_unhandled_exception;
+	return (old != _idt_unhandled_exception) ? old : NULL;
+}
+
+idt_interrupt_handler_t idt_set_interrupt_handler(uint8_t vector, idt_interrupt_handler_t handler) {
+	if (vector < IDT_EXCEPTIONS)
+		panic("idt_set_interrupt_handler: Vector %d is an exception\n", vector);
+
+	idt_interrupt_handler_t old = _idt_interrupt_handlers[vector - IDT_EXCEPTIONS];
+	_idt_interrupt_handlers[vector - IDT_EXCEPTIONS] = (handler != NULL) ? handler : _idt_unhandled_interrupt;
+	return (old != _idt_unhandled_interrupt) ? old : NULL;
+}
+
+void idt_dump_frame(const interrupt_frame_t* frame) {
+	klog_critical(
+		"  vector %d error 0x%x eip 0x%p cs 0x%x eflags 0x%x\n",
+		frame->vector, frame->error_code, frame->eip, frame->cs, frame->eflags);
+	klog_critical(
+		"  eax 0x%x ebx 0x%x ecx 0x%x edx 0x%x\n",
+		frame->eax, frame->ebx, frame->ecx, frame->edx);
+	// The CPU doesn't push ESP without a change of privilege, so the stack
+	//  was where the frame ends
+	klog_critical(
+		"  esi 0x%x edi 0x%x ebp 0x%x esp 0x%p\n",
+		frame->esi, frame->edi, frame->ebp, &frame->eflags + 1);
+}
+
+void _idt_unhandled_exception(interrupt_frame_t* frame) {
+	klog_critical("Unhandled exception: %s\n", _idt_exception_names[frame->vector]);
+	idt_dump_frame(frame);
+	panic("Unhandled exception %d\n", frame->vector);
+}
+
+void _idt_unhandled_interrupt(interrupt_fast_frame_t* frame) {
+	klog_warning("Ignored interrupt %d at 0x%p\n", frame->vector, frame->eip);
+}
@@ -3,11 +3,20 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <namuos/benchmark.h>
 #include <namuos/boot_allocator.h>
+#include <namuos/cpu.h>
+#include <namuos/highmem.h>
+#include <namuos/idt.h>
 #include <namuos/multiboot.h>
+#include <namuos/page_allocator.h>
+#include <namuos/page_fault.h>
+#include <namuos/page_mem.h>
 #include <namuos/paging.h>
 #include <namuos/panic.h>
+#include <namuos/slab.h>
 #include <namuos/terminal.h>
+#include <namuos/vmalloc.h>
 
 
 void kernel_main(multiboot_info_t* mb_info, uint32_t magic, uintptr_t mb_esp) {
@@ -23,10 +32,46 @@ void kernel_main(multiboot_info_t* mb_info, uint32_t magic, uintptr_t mb_esp) {
 	if (magic != MULTIBOOT_BOOTLOADER_MAGIC)
 		panic("Invalid bootloader header magic number\n");
 	
+	// Find out what the CPU supports before anything depends on it
+	cpu_initialise();
+
+	// Report faults instead of resetting, and handle page faults from here on
+	idt_initialise();
+
 	// Set up boot allocator and paging
 	bootmem_initialise(mb_info);
 	paging_initialise();
 	klog_info("bootmem allocator and paging initialised!\n");
 
+	#if KERNEL_BENCHMARKS
+	benchmark_bootmem(); // Needs the boot allocator, so run before retiring it
+	#endif
+
+	// Hand everything the boot allocator didn't use over to the page allocator
+	page_allocator_initialise();
+	bootmem_free_all();
+	slab_initialise();
+	highmem_initialise();
+	vmalloc_initialise();
+
+	// Pick how to clear and copy pages, now there are pages to measure with
+	page_mem_initialise();
+
+	#if KERNEL_BENCHMARKS
+	benchmark_run_all();
+	#endif
+
+	// Nothing else runs yet, so the rest of boot is idle time. Use it to zero
+	//  pages ahead of time for allocations that need them zeroed.
+	while (page_zero_idle(PAGE_ZERO_IDLE_BATCH) != 0)
+		;
+
+	// Report how much early memory we used
+	bootmem_dump_stats();
+	page_allocator_dump_stats();
+	slab_dump_stats();
+	vmalloc_dump_stats();
+	page_fault_dump_stats();
+
 	panic("Finished running kernel_main, aborting...\n");
 }
@@ -0,0 +1,249 @@
+/// @file memblock.c
+
+#include <namuos/memblock.h> // Implements
+
+#include <string.h> // memmove
+#include <namuos/paging.h>
+#include <namuos/panic.h>
+#include <namuos/terminal.h>
+
+
+// Early memory layout
+memblock_t memblock;
+
+// The kernel image (and everything below it) is reserved from the start
+extern void* _paddr_kernel_end;
+
+// Memory we can't map (at or above 4 GiB without PAE) is dropped from the
+//  memory map.
+#define MEMBLOCK_ADDR_LIMIT PHYS_ADDR_LIMIT
+
+// Binary search for the index of the first region in `type` that ends after
+//  `addr`. Returns `type->count` if every region ends at or before `addr`.
+uint32_t _memblock_search(memblock_type_t* type, uint64_t addr);
+
+// Adds or removes `[base, end)` from `type`, merging or splitting regions
+void _memblock_add_range(memblock_type_t* type, uint64_t base, uint64_t end);
+void _memblock_remove_range(memblock_type_t* type, uint64_t base, uint64_t end);
+
+// Replaces regions `[first, last)` of `type` with the `new_count` regions in
+//  `new_regions`, shifting any regions after them along.
+void _memblock_replace(
+	memblock_type_t* type, uint32_t first, uint32_t last,
+	memblock_region_t* new_regions, uint32_t new_count);
+
+
+void memblock_initialise(multiboot_info_t* mb_info) {
+	memblock.memory.count = 0;
+	memblock.reserved.count = 0;
+
+	if (mb_info->flags & MULTIBOOT_FLAG_MMAP) {
+		// Walk the memory map. Each entry's `size` doesn't include the `size`
+		//  field itself.
+		uintptr_t mmap_end = (uintptr_t)mb_info->mmap_addr + mb_info->mmap_length;
+		multiboot_memory_map_t* entry = mb_info->mmap_addr;
+		while ((uintptr_t)entry < mmap_end) {
+			if (entry->type == MULTIBOOT_MEMORY_AVAILABLE)
+				memblock_add(entry->base_addr, entry->length);
+			entry = (multiboot_memory_map_t*)((uintptr_t)entry + entry->size + sizeof(entry->size));
+		}
+	} else if (mb_info->flags & MULTIBOOT_FLAG_MEM) {
+		// No memory map, but we do know how much lower and upper memory there is
+		memblock_add(0, (uint64_t)mb_info->mem_lower * 1024);
+		memblock_add(0x100000, (uint64_t)mb_info->mem_upper * 1024);
+	} else {
+		// Nothing to go off. Assume everything up to ZONE_HIGHMEM is usable
+		klog_warning("memblock_initialise: No memory info from bootloader\n");
+		memblock_add(0, ZONE_HIGHMEM_OFFSET);
+	}
+
+	// The real mode area, BIOS data, and kernel image are all in use. So are
+	//  the multiboot structures we've been handed, wherever they ended up.
+	memblock_reserve(0, (uintptr_t)&_paddr_kernel_end);
+	memblock_reserve(__to_phys(mb_info), sizeof(multiboot_info_t));
+	if (mb_info->flags & MULTIBOOT_FLAG_MMAP)
+		memblock_reserve(__to_phys(mb_info->mmap_addr), mb_info->mmap_length);
+	if (mb_info->flags & MULTIBOOT_FLAG_MODS) {
+		for (uint32_t i = 0; i < mb_info->mods_count; ++i) {
+			struct multiboot_module* mod = (struct multiboot_module*)mb_info->mods_addr + i;
+			memblock_reserve(mod->mod_start, mod->mod_end - mod->mod_start);
+		}
+	}
+
+	for (uint32_t i = 0; i < memblock.memory.count; ++i) {
+		memblock_region_t* region = &memblock.memory.regions[i];
+		klog_debug(
+			"memblock: RAM 0x%lx to 0x%lx\n",
+			region->base, region->base + region->size);
+	}
+}
+
+void memblock_add(uint64_t base, uint64_t size) {
+	// Only whole pages below the addressable limit are usable
+	uint64_t end = (base + size) & PAGE_MASK;
+	base = (base + PAGE_SIZE - 1) & PAGE_MASK;
+	if (end > MEMBLOCK_ADDR_LIMIT)
+		end = MEMBLOCK_ADDR_LIMIT;
+	if (base >= end)
+		return;
+
+	_memblock_add_range(&memblock.memory, base, end);
+}
+
+void memblock_reserve(uint64_t base, uint64_t size) {
+	if (size == 0)
+		return;
+	_memblock_add_range(&memblock.reserved, base, base + size);
+}
+
+void memblock_free(uint64_t base, uint64_t size) {
+	if (size == 0)
+		return;
+	_memblock_remove_range(&memblock.reserved, base, base + size);
+}
+
+uint64_t memblock_alloc_range(uint64_t size, uint64_t align, uint64_t start, uint64_t end) {
+	// Walk the free ranges from `start`, and take the first one that fits
+	uint64_t free_start, free_end;
+	for (uint64_t addr = start; memblock_next_free_range(addr, &free_start, &free_end); addr = free_end) {
+		if (free_start >= end)
+			break;
+
+		uint64_t alloc_start = (free_start + align - 1) & ~(align - 1);
+		uint64_t alloc_end = alloc_start + size;
+		if (alloc_end <= free_end && alloc_end <= end) {
+			memblock_reserve(alloc_start, size);
+			return alloc_start;
+		}
+	}
+
+	klog_warning("memblock_alloc_range: Not enough memory for allocation of size %d\n", (uint32_t)size);
+	return 0;
+}
+
+bool memblock_next_free_range(uint64_t from, uint64_t* start, uint64_t* end) {
+	memblock_type_t* memory = &memblock.memory;
+	memblock_type_t* reserved = &memblock.reserved;
+
+	// Start with the first memory region that ends after `from`
+	for (uint32_t i = _memblock_search(memory, from); i < memory->count; ++i) {
+		uint64_t region_start = memory->regions[i].base;
+		uint64_t region_end = region_start + memory->regions[i].size;
+		if (region_start < from)
+			region_start = from;
+
+		// Skip past any reserved regions covering the start of this range.
+		//  Reserved regions never touch, so at most one can cover it.
+		uint32_t r = _memblock_search(reserved, region_start);
+		if (r < reserved->count && reserved->regions[r].base <= region_start) {
+			region_start = reserved->regions[r].base + reserved->regions[r].size;
+			++r;
+		}
+		if (region_start >= region_end)
+			continue; // Entire rest of the region is reserved
+
+		// The free range ends at the next reserved region, or the end of the
+		//  memory region, whichever comes first
+		if (r < reserved->count && reserved->regions[r].base < region_end)
+			region_end = reserved->regions[r].base;
+
+		*start = region_start;
+		*end = region_end;
+		return true;
+	}
+
+	return false;
+}
+
+bool memblock_is_memory(uint64_t addr) {
+	uint32_t i = _memblock_search(&memblock.memory, addr);
+	return i < memblock.memory.count && memblock.memory.regions[i].base <= addr;
+}
+
+bool memblock_is_reserved(uint64_t addr) {
+	uint32_t i = _memblock_search(&memblock.reserved, addr);
+	return i < memblock.reserved.count && memblock.reserved.regions[i].base <= addr;
+}
+
+uint64_t memblock_end_of_ram() {
+	if (memblock.memory.count == 0)
+		return 0;
+	memblock_region_t* last = &memblock.memory.regions[memblock.memory.count - 1];
+	return last->base + last->size;
+}
+
+uint32_t _memblock_search(memblock_type_t* type, uint64_t addr) {
+	// Regions are sorted and don't overlap, so their ends are sorted too
+	uint32_t low = 0;
+	uint32_t high = type->count;
+	while (low < high) {
+		uint32_t mid = low + (high - low) / 2;
+		memblock_region_t* region = &type->regions[mid];
+		if (region->base + region->size <= addr)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+void _memblock_add_range(memblock_type_t* type, uint64_t base, uint64_t end) {
+	// Find the first region that overlaps or touches the new range, and every
+	//  region after it that does too. They all get merged into one.
+	uint32_t first = _memblock_search(type, base);
+	if (first > 0 && type->regions[first-1].base + type->regions[first-1].size == base)
+		--first; // Touches the end of the previous region
+	uint32_t last = first;
+	while (last < type->count && type->regions[last].base <= end) {
+		memblock_region_t* region = &type->regions[last];
+		if (region->base < base)
+			base = region->base;
+		if (region->base + region->size > end)
+			end = region->base + region->size;
+		++last;
+	}
+
+	memblock_region_t merged = { .base = base, .size = end - base };
+	_memblock_replace(type, first, last, &merged, 1);
+}
+
+void _memblock_remove_range(memblock_type_t* type, uint64_t base, uint64_t end) {
+	// Find every region overlapping the range. The first and last of them may
+	//  stick out either side, and those parts are kept.
+	uint32_t first = _memblock_search(type, base);
+	uint32_t last = first;
+	while (last < type->count && type->regions[last].base < end)
+		++last;
+	if (first == last)
+		return; // Nothing to remove
+
+	memblock_region_t kept[2];
+	uint32_t kept_count = 0;
+	memblock_region_t* head = &type->regions[first];
+	memblock_region_t* tail = &type->regions[last-1];
+	uint64_t tail_end = tail->base + tail->size;
+	if (head->base < base)
+		kept[kept_count++] = (memblock_region_t){ .base = head->base, .size = base - head->base };
+	if (tail_end > end)
+		kept[kept_count++] = (memblock_region_t){ .base = end, .size = tail_end - end };
+
+	_memblock_replace(type, first, last, kept, kept_count);
+}
+
+void _memblock_replace(
+	memblock_type_t* type, uint32_t first, uint32_t last,
+	memblock_region_t* new_regions, uint32_t new_count
+) {
+	uint32_t count = type->count - (last - first) + new_count;
+	if (count > MEMBLOCK_MAX_REGIONS)
+		panic("memblock: Too many regions\n");
+
+	// Shift the regions after the replaced ones to make (or close) room
+	memmove(
+		&type->regions[first + new_count],
+		&type->regions[last],
+		(type->count - last) * sizeof(memblock_region_t));
+	for (uint32_t i = 0; i < new_count; ++i)
+		type->regions[first + i] = new_regions[i];
+	type->count = count;
+}
@@ -0,0 +1,1111 @@
+/// @file page_allocator.c
+
+#include <namuos/page_allocator.h> // Implements
+
+#include <string.h> // memset
+#include <namuos/boot_allocator.h>
+#include <namuos/cpu.h>
+#include <namuos/highmem.h>
+#include <namuos/memblock.h>
+#include <namuos/page_mem.h>
+#include <namuos/paging.h>
+#include <namuos/panic.h>
+#include <namuos/slab.h>
+#include <namuos/terminal.h>
+
+
+// Most of the linear mapping mem_map may take up
+#define MEM_MAP_MAX_SIZE ((ZONE_HIGHMEM_OFFSET - ZONE_DMA_OFFSET) / 8)
+
+// Page allocator information
+page_allocator_t page_allocator;
+
+// Page descriptors
+page_t* mem_map;
+uint32_t mem_map_pages;
+
+// Zones to try for each set of allocation flags, in order, ending with -1
+static const int _zone_fallbacks[][PAGE_NR_ZONES + 1] = {
+	[GFP_KERNEL]  = { PAGE_ZONE_NORMAL, PAGE_ZONE_DMA, -1 },
+	[GFP_DMA]     = { PAGE_ZONE_DMA, -1 },
+	[GFP_HIGHMEM] = { PAGE_ZONE_HIGHMEM, PAGE_ZONE_NORMAL, PAGE_ZONE_DMA, -1 },
+};
+
+// Migrate types to take blocks from when a type has none left, in order
+static const uint32_t _migrate_fallbacks[PAGE_MIGRATE_TYPES][PAGE_MIGRATE_TYPES - 1] = {
+	[PAGE_MIGRATE_UNMOVABLE]   = { PAGE_MIGRATE_RECLAIMABLE, PAGE_MIGRATE_MOVABLE },
+	[PAGE_MIGRATE_RECLAIMABLE] = { PAGE_MIGRATE_UNMOVABLE, PAGE_MIGRATE_MOVABLE },
+	[PAGE_MIGRATE_MOVABLE]     = { PAGE_MIGRATE_RECLAIMABLE, PAGE_MIGRATE_UNMOVABLE },
+};
+
+// Number of pages in each pageblock
+#define PAGEBLOCK_PAGES (1U << PAGEBLOCK_ORDER)
+
+// Sets up the span and empty free lists of a zone covering `[start, end)`.
+//  The zone is left empty if `end` is before `start`.
+void _zone_initialise(zone_t* zone, const char* name, uint64_t start, uint64_t end);
+
+// Returns the zone spanning `pfn`, or NULL if there isn't one
+zone_t* _pfn_zone(uint32_t pfn);
+
+// Returns the `PAGE_ZONE_*` index of the zone `pfn` would be in
+uint8_t _pfn_zone_index(uint32_t pfn);
+
+// Checks the allocation flags pick a zone
+bool _gfp_valid(gfp_t gfp);
+
+// Returns the `PAGE_MIGRATE_*` type picked by the allocation flags
+uint32_t _gfp_migrate_type(gfp_t gfp);
+
+// Gets or sets the migrate type of the pageblock containing `pfn`. Setting it
+//  doesn't move the free blocks in it, see `_claim_pageblock`.
+uint32_t _pageblock_type(zone_t* zone, uint32_t pfn);
+void _set_pageblock_type(zone_t* zone, uint32_t pfn, uint32_t type);
+
+// Gets the number of free pages in the buddy lists in the pageblock containing
+//  `pfn`. `zone` must be locked.
+uint32_t _pageblock_free_pages(zone_t* zone, uint32_t pfn);
+
+// Changes the pageblock containing `pfn` to `type`, moving its free blocks to
+//  the lists of that type. `zone` must be locked.
+void _claim_pageblock(zone_t* zone, uint32_t pfn, uint32_t type);
+
+// Finds the largest free block of at least `order` of a type other than
+//  `type`, claiming its pageblock for `type` if the block is large or most of
+//  the pageblock is free. Sets `order_found` to its order and returns it, left
+//  on its free list, or returns NULL. `zone` must be locked.
+page_t* _find_fallback(zone_t* zone, uint32_t order, uint32_t type, uint32_t* order_found);
+
+// Compacts each zone allowed by `gfp` where an allocation of `order` would
+//  fail because of fragmentation. Returns if any pages were moved.
+bool _compact_for(uint32_t order, gfp_t gfp);
+
+// Takes the free pages from the highest movable pageblock in `zone` that
+//  starts after `low` and ends at or before `high`, and adds them to `targets`
+//  as single pages. Returns the start of the last pageblock scanned, where
+//  the next scan should end.
+uint32_t _compact_isolate_free(zone_t* zone, uint32_t low, uint32_t high, page_t** targets);
+
+// Moves a movable page to `target`. Returns if it was moved.
+bool _compact_migrate(page_t* page, page_t* target);
+
+// Takes a block of `order` from the first zone allowed by `gfp` that has one,
+//  or returns PAGE_PFN_NONE
+uint32_t _alloc_from_zones(uint32_t order, gfp_t gfp);
+
+// Gets the free block in the buddy lists of `zone` that contains `pfn`, or NULL
+//  if it isn't free. `zone` must be locked.
+page_t* _free_block_containing(zone_t* zone, uint32_t pfn);
+
+// Frees the frames `[start, end)` as the largest naturally aligned blocks that
+//  fit, marking them as zeroed if `zero` is PG_ZERO. `_zone_free_range` needs
+//  `zone` locked, and does nothing if `end` isn't after `start`.
+void _free_range(zone_t* zone, uint32_t start, uint32_t end, uint32_t zero);
+void _zone_free_range(zone_t* zone, uint32_t start, uint32_t end, uint32_t zero);
+
+// Takes a block of `order` from `zone`, preferring blocks of the migrate type
+//  `type`, or returns PAGE_PFN_NONE if it doesn't have one. `zone` must be
+//  locked.
+uint32_t _zone_alloc(zone_t* zone, uint32_t order, uint32_t type);
+
+// Returns if `zone` has a free block of any order of the migrate type `type`,
+//  so `_zone_alloc` can take one without falling back. `zone` must be locked.
+bool _zone_has_free(zone_t* zone, uint32_t type);
+
+// Puts a block of `order` back into `zone`, merging it with its buddies.
+//  `zone` must be locked.
+void _zone_free(zone_t* zone, uint32_t pfn, uint32_t order);
+
+// Helpers to add or remove a block from the free list of `order` in `zone`.
+//  Blocks go on the list for the type of their pageblock, and their `index`
+//  records which so they can be taken off it again.
+void _free_list_add(zone_t* zone, page_t* page, uint32_t order);
+void _free_list_remove(zone_t* zone, page_t* page, uint32_t order);
+
+// Takes a single page of migrate type `type` from the current CPU's lists for
+//  `zone`, refilling them from the zone first if they're at their low
+//  watermark or have none of the type. Takes the coldest page if `cold` is
+//  set. Returns PAGE_PFN_NONE if both are empty.
+uint32_t _pcp_alloc(zone_t* zone, bool cold, uint32_t type);
+
+// Puts a single page on the current CPU's list for `zone` and the type of its
+//  pageblock, at the tail if `cold` is set, draining the lists if they go over
+//  their high watermark
+void _pcp_free(zone_t* zone, page_t* page, bool cold);
+
+// Moves up to `count` pages between `pcp` and the buddy lists of `zone`.
+//  Refilling adds pages of `type` to the tail, and draining takes them from
+//  the tail of each list in turn.
+void _pcp_refill(zone_t* zone, per_cpu_pages_t* pcp, uint32_t type, uint32_t count);
+void _pcp_drain(zone_t* zone, per_cpu_pages_t* pcp, uint32_t count);
+
+// Helpers to add or remove a page from a per-CPU list
+void _pcp_list_add(per_cpu_pages_t* pcp, page_t* page, uint32_t type, bool tail);
+void _pcp_list_remove(per_cpu_pages_t* pcp, page_t* page);
+
+// Takes a page from the pool of zeroed pages of the first zone allowed by
+//  `gfp` that has one, or returns PAGE_PFN_NONE
+uint32_t _zero_pool_alloc(gfp_t gfp);
+
+// Zeroes the `count` frames from `pfn` unless the first is marked PG_ZERO,
+//  then marks it so. Counts a hit or miss for the zone either way.
+void _zero_pages(uint32_t pfn, uint32_t count);
+
+
+void mem_map_initialise() {
+	// Cover every frame up to the end of RAM, unless that would take too much
+	//  of the linear mapping
+	uint64_t ram_end = memblock_end_of_ram();
+	uint64_t max_pages = (uint64_t)MEM_MAP_MAX_SIZE / sizeof(page_t);
+	uint64_t pages = ram_end >> PAGE_SHIFT;
+	if (pages > max_pages) {
+		klog_warning(
+			"mem_map: Only covering the first %lu MiB of %lu MiB of RAM\n",
+			(max_pages << PAGE_SHIFT) >> 20, ram_end >> 20);
+		pages = max_pages;
+	}
+	mem_map_pages = (uint32_t)pages;
+
+	size_t size = mem_map_pages * sizeof(page_t);
+	mem_map = (page_t*)bootmem_alloc(size);
+	if (mem_map == NULL)
+		panic("mem_map_initialise: No memory for %d page descriptors\n", mem_map_pages);
+
+	// Every frame is reserved until it's handed to the page allocator
+	memset(mem_map, 0, size);
+	for (uint32_t pfn = 0; pfn < mem_map_pages; ++pfn) {
+		mem_map[pfn].flags = PG_RESERVED;
+		mem_map[pfn].zone = _pfn_zone_index(pfn);
+	}
+
+	klog_info(
+		"mem_map: %d page descriptors in %d KiB\n",
+		mem_map_pages, (uint32_t)(size / 1024));
+}
+
+void page_allocator_initialise() {
+	mem_map_initialise();
+
+	// Each zone runs up to the start of the next one, or the end of the frames
+	//  covered by mem_map
+	uint64_t ram_end = PFN_PHYS(mem_map_pages);
+	uint64_t dma_end = (ram_end < ZONE_NORMAL_OFFSET) ? ram_end : ZONE_NORMAL_OFFSET;
+	uint64_t normal_end = (ram_end < ZONE_HIGHMEM_OFFSET) ? ram_end : ZONE_HIGHMEM_OFFSET;
+	zone_t* zones = page_allocator.zones;
+	_zone_initialise(&zones[PAGE_ZONE_DMA], "DMA", ZONE_DMA_OFFSET, dma_end);
+	_zone_initialise(&zones[PAGE_ZONE_NORMAL], "NORMAL", ZONE_NORMAL_OFFSET, normal_end);
+	_zone_initialise(&zones[PAGE_ZONE_HIGHMEM], "HIGHMEM", ZONE_HIGHMEM_OFFSET, ram_end);
+	page_allocator.free_pages = 0;
+
+	// Every pageblock starts out movable, and is claimed by the other types as
+	//  they need it
+	for (uint32_t i = 0; i < PAGE_NR_ZONES; ++i) {
+		zone_t* zone = &zones[i];
+		if (zone->pfn_end == zone->pfn_start)
+			continue;
+		zone->nr_pageblocks = ((zone->pfn_end + PAGEBLOCK_PAGES - 1) >> PAGEBLOCK_ORDER)
+			- (zone->pfn_start >> PAGEBLOCK_ORDER);
+		zone->pageblock_types = (uint8_t*)bootmem_alloc(zone->nr_pageblocks);
+		if (zone->pageblock_types == NULL)
+			panic("page_allocator_initialise: No memory for %d pageblocks\n", zone->nr_pageblocks);
+		memset(zone->pageblock_types, PAGE_MIGRATE_MOVABLE, zone->nr_pageblocks);
+	}
+}
+
+void page_allocator_add_block(uint32_t pfn, uint32_t order) {
+	zone_t* zone = _pfn_zone(pfn);
+	if (order >= PAGE_MAX_ORDER || pfn & ((1U << order) - 1)
+		|| zone == NULL || pfn + (1U << order) > zone->pfn_end)
+		panic("page_allocator_add_block: Bad block PFN %d order %d\n", pfn, order);
+
+	for (uint32_t i = 0; i < (1U << order); ++i)
+		mem_map[pfn + i].flags &= ~(PG_RESERVED | PG_ZERO);
+
+	spin_lock(&zone->lock);
+	zone->managed_pages += 1U << order;
+	_zone_free(zone, pfn, order);
+	spin_unlock(&zone->lock);
+}
+
+uint32_t page_alloc_pfn(uint32_t order, gfp_t gfp) {
+	if (order >= PAGE_MAX_ORDER || !_gfp_valid(gfp))
+		return PAGE_PFN_NONE;
+
+	// Movable single pages that need zeroing come from the pools of pages
+	//  zeroed while idle, if there are any left. The pools are stocked from
+	//  movable pageblocks, so other types would pin pages inside them.
+	if (gfp & GFP_ZERO && order == 0
+		&& _gfp_migrate_type(gfp) == PAGE_MIGRATE_MOVABLE) {
+		uint32_t pfn = _zero_pool_alloc(gfp);
+		if (pfn != PAGE_PFN_NONE)
+			return pfn;
+	}
+
+	uint32_t pfn = _alloc_from_zones(order, gfp);
+	if (pfn == PAGE_PFN_NONE) {
+		// Out of memory, so take back the empty slabs and the pages on the
+		//  per-CPU lists and in the pools, which may also let larger blocks
+		//  merge, and try again
+		uint32_t reaped = slab_reap();
+		page_pcp_drain_all();
+		page_zero_drain_all();
+		pfn = _alloc_from_zones(order, gfp);
+
+		// If there's enough free memory but it's in pieces, compact the zones
+		if (pfn == PAGE_PFN_NONE && order > 0 && _compact_for(order, gfp))
+			pfn = _alloc_from_zones(order, gfp);
+		if (pfn == PAGE_PFN_NONE) {
+			klog_warning(
+				"page_alloc: Not enough memory for allocation of order %d (reaped %d pages)\n",
+				order, reaped);
+			return PAGE_PFN_NONE;
+		}
+	}
+
+	if (gfp & GFP_ZERO)
+		_zero_pages(pfn, 1U << order);
+	return pfn;
+}
+
+void page_free_pfn(uint32_t pfn, uint32_t order) {
+	zone_t* zone = _pfn_zone(pfn);
+	if (order >= PAGE_MAX_ORDER || zone == NULL || mem_map[pfn].flags & PG_RESERVED)
+		panic("page_free: Bad block PFN %d order %d\n", pfn, order);
+
+	// Whatever was in the block, it can't be assumed to be zero anymore
+	mem_map[pfn].flags &= ~(PG_ZERO | PG_MOVABLE);
+	if (order == 0) {
+		_pcp_free(zone, pfn_to_page(pfn), false);
+		return;
+	}
+
+	spin_lock(&zone->lock);
+	_zone_free(zone, pfn, order);
+	spin_unlock(&zone->lock);
+}
+
+void page_free_pfn_cold(uint32_t pfn) {
+	zone_t* zone = _pfn_zone(pfn);
+	if (zone == NULL || mem_map[pfn].flags & PG_RESERVED)
+		panic("page_free: Bad block PFN %d order 0\n", pfn);
+
+	mem_map[pfn].flags &= ~(PG_ZERO | PG_MOVABLE);
+	_pcp_free(zone, pfn_to_page(pfn), true);
+}
+
+uint32_t page_alloc_pfn_exact(uint32_t count, gfp_t gfp) {
+	if (count == 0 || count > (1U << (PAGE_MAX_ORDER - 1)) || !_gfp_valid(gfp))
+		return PAGE_PFN_NONE;
+
+	// Take the smallest block that fits, and give back the pages past `count`.
+	//  Only the pages kept are zeroed, if they need to be.
+	uint32_t order = 0;
+	while ((1U << order) < count)
+		++order;
+	uint32_t pfn = page_alloc_pfn(order, gfp & ~GFP_ZERO);
+	if (pfn == PAGE_PFN_NONE)
+		return PAGE_PFN_NONE;
+
+	// The pages given back are as zeroed as the rest of the block
+	uint32_t zero = mem_map[pfn].flags & PG_ZERO;
+	mem_map[pfn].flags &= ~PG_HEAD;
+	_free_range(_pfn_zone(pfn), pfn + count, pfn + (1U << order), zero);
+
+	if (gfp & GFP_ZERO)
+		_zero_pages(pfn, count);
+	return pfn;
+}
+
+void page_free_pfn_exact(uint32_t pfn, uint32_t count) {
+	zone_t* zone = _pfn_zone(pfn);
+	if (count == 0 || zone == NULL || pfn + count > zone->pfn_end)
+		panic("page_free: Bad range PFN %d count %d\n", pfn, count);
+
+	_free_range(zone, pfn, pfn + count, 0);
+}
+
+bool page_claim_pfn_range(uint32_t pfn, uint32_t count) {
+	zone_t* zone = _pfn_zone(pfn);
+	if (count == 0 || zone == NULL || pfn + count > zone->pfn_end)
+		return false;
+
+	// Make sure every frame is in a free block before taking any of them
+	spin_lock(&zone->lock);
+	for (uint32_t next = pfn; next < pfn + count; ) {
+		page_t* block = _free_block_containing(zone, next);
+		if (block == NULL) {
+			spin_unlock(&zone->lock);
+			return false;
+		}
+		next = page_to_pfn(block) + (1U << block->order);
+	}
+
+	// Take each block, and give back the parts outside the range
+	for (uint32_t next = pfn; next < pfn + count; ) {
+		page_t* block = _free_block_containing(zone, next);
+		uint32_t start = page_to_pfn(block);
+		uint32_t end = start + (1U << block->order);
+		uint32_t zero = block->flags & PG_ZERO;
+		_free_list_remove(zone, block, block->order);
+		zone->free_pages -= end - start;
+		page_allocator.free_pages -= end - start;
+
+		_zone_free_range(zone, start, pfn, zero);
+		_zone_free_range(zone, pfn + count, end, zero);
+		next = end;
+	}
+	spin_unlock(&zone->lock);
+	return true;
+}
+
+bool page_pcp_set_watermarks(uint32_t low, uint32_t high, uint32_t batch) {
+	if (high <= low || batch == 0 || batch > high) {
+		klog_warning(
+			"page_pcp_set_watermarks: Bad watermarks low %d high %d batch %d\n",
+			low, high, batch);
+		return false;
+	}
+
+	for (uint32_t i = 0; i < PAGE_NR_ZONES; ++i) {
+		zone_t* zone = &page_allocator.zones[i];
+		for (uint32_t cpu = 0; cpu < NR_CPUS; ++cpu) {
+			per_cpu_pages_t* pcp = &zone->pcp[cpu];
+			pcp->low = low;
+			pcp->high = high;
+			pcp->batch = batch;
+			if (pcp->count > high)
+				_pcp_drain(zone, pcp, pcp->count - high);
+		}
+	}
+	return true;
+}
+
+void page_pcp_drain_all() {
+	for (uint32_t i = 0; i < PAGE_NR_ZONES; ++i) {
+		zone_t* zone = &page_allocator.zones[i];
+		for (uint32_t cpu = 0; cpu < NR_CPUS; ++cpu)
+			_pcp_drain(zone, &zone->pcp[cpu], zone->pcp[cpu].count);
+	}
+}
+
+uint32_t page_zero_idle(uint32_t max_pages) {
+	uint32_t added = 0;
+	for (uint32_t i = 0; i < PAGE_NR_ZONES; ++i) {
+		zone_t* zone = &page_allocator.zones[i];
+
+		// Leave at least as many pages free in the zone as are in the pool.
+		//  Pool pages are still free, so they're only taken from movable
+		//  pageblocks, and never by stealing or claiming another type's.
+		while (added < max_pages && zone->zero_count < zone->zero_high
+			&& zone->free_pages > zone->zero_high) {
+			spin_lock(&zone->lock);
+			uint32_t pfn = PAGE_PFN_NONE;
+			if (_zone_has_free(zone, PAGE_MIGRATE_MOVABLE))
+				pfn = _zone_alloc(zone, 0, PAGE_MIGRATE_MOVABLE);
+			spin_unlock(&zone->lock);
+			if (pfn == PAGE_PFN_NONE)
+				break;
+
+			// The zone lock isn't held while zeroing, so allocations can go on
+			page_t* page = pfn_to_page(pfn);
+			if (!(page->flags & PG_ZERO)) {
+				void* addr = kmap_atomic(page);
+				clear_page_nocache(addr);
+				kunmap_atomic(addr);
+				zone->zero_idle_bytes += PAGE_SIZE;
+			}
+
+			spin_lock(&zone->lock);
+			page->flags |= PG_POOL | PG_ZERO;
+			page->refcount = 0;
+			page->next = zone->zero_pool;
+			zone->zero_pool = page;
+			++zone->zero_count;
+			spin_unlock(&zone->lock);
+			++added;
+		}
+	}
+	return added;
+}
+
+void page_zero_drain_all() {
+	for (uint32_t i = 0; i < PAGE_NR_ZONES; ++i) {
+		zone_t* zone = &page_allocator.zones[i];
+		if (zone->zero_count == 0)
+			continue;
+
+		spin_lock(&zone->lock);
+		while (zone->zero_pool != NULL) {
+			page_t* page = zone->zero_pool;
+			zone->zero_pool = page->next;
+			--zone->zero_count;
+			page->flags &= ~PG_POOL;
+			_zone_free(zone, page_to_pfn(page), 0);
+		}
+		spin_unlock(&zone->lock);
+	}
+}
+
+bool page_set_movable(uint32_t pfn, const page_movable_ops_t* ops) {
+	zone_t* zone = _pfn_zone(pfn);
+	page_t* page = pfn_to_page(pfn);
+	uint32_t busy = PG_RESERVED | PG_BUDDY | PG_HEAD | PG_PCP | PG_SLAB | PG_POOL;
+	if (zone == NULL || ops == NULL || page->flags & busy) {
+		klog_warning("page_set_movable: PFN %d can't be made movable\n", pfn);
+		return false;
+	}
+
+	// A movable allocation falls back to other types' pageblocks when there
+	//  are no movable ones left. Those pages just stay where they are.
+	if (_pageblock_type(zone, pfn) != PAGE_MIGRATE_MOVABLE)
+		return false;
+
+	page->owner = (void*)ops;
+	page->flags |= PG_MOVABLE;
+	return true;
+}
+
+uint32_t page_compact_zone(zone_t* zone) {
+	if (zone->managed_pages == 0)
+		return 0;
+
+	// Pages on the per-CPU lists and in the pools aren't in the buddy lists, so
+	//  could neither be moved nor be moved into
+	page_pcp_drain_all();
+	page_zero_drain_all();
+
+	// The migrate scanner works up from the bottom of the zone, and the free
+	//  scanner down from the top a pageblock at a time, until they meet
+	page_t* targets = NULL;
+	uint32_t free_pfn = zone->pfn_end;
+	uint32_t moved = 0;
+	for (uint32_t pfn = zone->pfn_start; pfn < free_pfn; ) {
+		page_t* page = pfn_to_page(pfn);
+		if (page->flags & PG_BUDDY) {
+			pfn += 1U << page->order;
+			continue;
+		}
+		if (!(page->flags & PG_MOVABLE)) {
+			++pfn;
+			continue;
+		}
+
+		if (targets == NULL) {
+			free_pfn = _compact_isolate_free(zone, pfn, free_pfn, &targets);
+			if (targets == NULL)
+				break;
+		}
+		page_t* target = targets;
+		targets = target->next;
+
+		// Whichever of the two pages isn't used goes back to the zone. Both
+		//  have been written to, whatever they held before.
+		bool migrated = _compact_migrate(page, target);
+		page_t* unused = migrated ? page : target;
+		unused->flags &= ~(PG_ZERO | PG_MOVABLE);
+		spin_lock(&zone->lock);
+		_zone_free(zone, page_to_pfn(unused), 0);
+		spin_unlock(&zone->lock);
+		moved += migrated ? 1 : 0;
+		++pfn;
+	}
+
+	// Give back the free pages that weren't needed
+	spin_lock(&zone->lock);
+	while (targets != NULL) {
+		page_t* target = targets;
+		targets = target->next;
+		_zone_free(zone, page_to_pfn(target), 0);
+	}
+	spin_unlock(&zone->lock);
+	return moved;
+}
+
+void* page_alloc(uint32_t order) {
+	uint32_t pfn = page_alloc_pfn(order, GFP_KERNEL);
+	if (pfn == PAGE_PFN_NONE)
+		return NULL;
+	return __to_virt(PFN_PHYS(pfn));
+}
+
+void* page_alloc_low(uint32_t order) {
+	uint32_t pfn = page_alloc_pfn(order, GFP_DMA);
+	if (pfn == PAGE_PFN_NONE)
+		return NULL;
+	return __to_virt(PFN_PHYS(pfn));
+}
+
+void page_free(void* addr, uint32_t order) {
+	if (addr == NULL)
+		return;
+	page_free_pfn(__to_phys(addr) >> PAGE_SHIFT, order);
+}
+
+uint32_t page_zone_unusable_index(zone_t* zone, uint32_t order) {
+	if (zone->free_pages == 0)
+		return 0;
+
+	// Count the free pages in blocks large enough for the allocation
+	uint32_t usable = 0;
+	for (uint32_t i = order; i < PAGE_MAX_ORDER; ++i)
+		usable += zone->nr_free[i] << i;
+	return (zone->free_pages - usable) * 1000 / zone->free_pages;
+}
+
+int32_t page_zone_fragmentation_index(zone_t* zone, uint32_t order) {
+	uint32_t blocks = 0;
+	for (uint32_t i = 0; i < PAGE_MAX_ORDER; ++i) {
+		if (i >= order && zone->nr_free[i] > 0)
+			return -1000;
+		blocks += zone->nr_free[i];
+	}
+	if (blocks == 0)
+		return 0;
+
+	// Fewer, larger free blocks than the allocation needs means too little
+	//  memory, and many small ones means fragmentation
+	uint64_t requested = 1U << order;
+	int32_t index = 1000 - (int32_t)((1000 + (uint64_t)zone->free_pages * 1000 / requested) / blocks);
+	return (index < 0) ? 0 : index;
+}
+
+void page_allocator_dump_stats() {
+	klog_info("page allocator: %d pages free\n", page_allocator.free_pages);
+	for (uint32_t i = 0; i < PAGE_NR_ZONES; ++i) {
+		zone_t* zone = &page_allocator.zones[i];
+		if (zone->managed_pages == 0)
+			continue;
+
+		klog_info(
+			"  %s: %d of %d pages free, unusable index %d/1000 at order %d\n",
+			zone->name, zone->free_pages, zone->managed_pages,
+			page_zone_unusable_index(zone, PAGE_MAX_ORDER - 1), PAGE_MAX_ORDER - 1);
+		klog_info("    free blocks per order:");
+		for (uint32_t order = 0; order < PAGE_MAX_ORDER; ++order)
+			kprintf(" %d", zone->nr_free[order]);
+		kprintf("\n");
+
+		uint32_t types[PAGE_MIGRATE_TYPES] = { 0 };
+		for (uint32_t block = 0; block < zone->nr_pageblocks; ++block)
+			++types[zone->pageblock_types[block]];
+		klog_info(
+			"    pageblocks: %d unmovable, %d reclaimable, %d movable, %d steals, %d claimed\n",
+			types[PAGE_MIGRATE_UNMOVABLE], types[PAGE_MIGRATE_RECLAIMABLE],
+			types[PAGE_MIGRATE_MOVABLE], zone->pageblock_steals, zone->pageblock_claims);
+
+		for (uint32_t cpu = 0; cpu < NR_CPUS; ++cpu) {
+			per_cpu_pages_t* pcp = &zone->pcp[cpu];
+			uint32_t allocs = pcp->alloc_hits + pcp->alloc_misses;
+			uint32_t frees = pcp->free_hits + pcp->free_drains;
+			klog_info(
+				"    CPU %d: %d pages listed, %d/%d allocs and %d/%d frees hit the list\n",
+				cpu, pcp->count, pcp->alloc_hits, allocs, pcp->free_hits, frees);
+		}
+
+		if (zone->zero_high != 0) {
+			klog_info(
+				"    zeroed pool: %d of %d pages, %d/%d zeroed allocs hit, %lu KiB zeroed while idle\n",
+				zone->zero_count, zone->zero_high, zone->zero_hits,
+				zone->zero_hits + zone->zero_misses, zone->zero_idle_bytes >> 10);
+		}
+	}
+}
+
+uint32_t _alloc_from_zones(uint32_t order, gfp_t gfp) {
+	// Try each zone allowed in turn, so ZONE_DMA is only used once the zones
+	//  above it are exhausted
+	gfp_t zones = gfp & GFP_ZONE_MASK;
+	uint32_t type = _gfp_migrate_type(gfp);
+	for (const int* i = _zone_fallbacks[zones]; *i >= 0; ++i) {
+		zone_t* zone = &page_allocator.zones[*i];
+
+		// Single pages come from the per-CPU lists, without the zone lock
+		//  unless the list needs refilling
+		if (order == 0) {
+			uint32_t pfn = _pcp_alloc(zone, gfp & GFP_COLD, type);
+			if (pfn != PAGE_PFN_NONE)
+				return pfn;
+			continue;
+		}
+
+		if (zone->free_pages < (1U << order))
+			continue;
+
+		spin_lock(&zone->lock);
+		uint32_t pfn = _zone_alloc(zone, order, type);
+		spin_unlock(&zone->lock);
+		if (pfn != PAGE_PFN_NONE)
+			return pfn;
+	}
+	return PAGE_PFN_NONE;
+}
+
+void _zone_initialise(zone_t* zone, const char* name, uint64_t start, uint64_t end) {
+	if (end < start)
+		end = start;
+
+	zone->name = name;
+	zone->pfn_start = start >> PAGE_SHIFT;
+	zone->pfn_end = end >> PAGE_SHIFT;
+	zone->free_pages = 0;
+	zone->managed_pages = 0;
+	spin_lock_init(&zone->lock);
+
+	for (uint32_t order = 0; order < PAGE_MAX_ORDER; ++order) {
+		for (uint32_t type = 0; type < PAGE_MIGRATE_TYPES; ++type)
+			zone->free_list[order][type] = NULL;
+		zone->nr_free[order] = 0;
+	}
+
+	zone->pageblock_types = NULL;
+	zone->nr_pageblocks = 0;
+	zone->pageblock_steals = 0;
+	zone->pageblock_claims = 0;
+
+	memset(zone->pcp, 0, sizeof(zone->pcp));
+	for (uint32_t cpu = 0; cpu < NR_CPUS; ++cpu) {
+		zone->pcp[cpu].low = PAGE_PCP_LOW;
+		zone->pcp[cpu].high = PAGE_PCP_HIGH;
+		zone->pcp[cpu].batch = PAGE_PCP_BATCH;
+	}
+
+	zone->zero_pool = NULL;
+	zone->zero_count = 0;
+	zone->zero_high = PAGE_ZERO_POOL_HIGH;
+	zone->zero_hits = 0;
+	zone->zero_misses = 0;
+	zone->zero_idle_bytes = 0;
+}
+
+zone_t* _pfn_zone(uint32_t pfn) {
+	if (pfn >= mem_map_pages)
+		return NULL;
+	return &page_allocator.zones[mem_map[pfn].zone];
+}
+
+uint8_t _pfn_zone_index(uint32_t pfn) {
+	if (pfn >= ZONE_HIGHMEM_OFFSET >> PAGE_SHIFT)
+		return PAGE_ZONE_HIGHMEM;
+	if (pfn >= ZONE_NORMAL_OFFSET >> PAGE_SHIFT)
+		return PAGE_ZONE_NORMAL;
+	return PAGE_ZONE_DMA;
+}
+
+bool _gfp_valid(gfp_t gfp) {
+	return (gfp & GFP_ZONE_MASK) <= GFP_HIGHMEM;
+}
+
+uint32_t _gfp_migrate_type(gfp_t gfp) {
+	if (gfp & GFP_MOVABLE)
+		return PAGE_MIGRATE_MOVABLE;
+	if (gfp & GFP_RECLAIMABLE)
+		return PAGE_MIGRATE_RECLAIMABLE;
+	return PAGE_MIGRATE_UNMOVABLE;
+}
+
+uint32_t _pageblock_type(zone_t* zone, uint32_t pfn) {
+	return zone->pageblock_types[(pfn >> PAGEBLOCK_ORDER) - (zone->pfn_start >> PAGEBLOCK_ORDER)];
+}
+
+void _set_pageblock_type(zone_t* zone, uint32_t pfn, uint32_t type) {
+	zone->pageblock_types[(pfn >> PAGEBLOCK_ORDER) - (zone->pfn_start >> PAGEBLOCK_ORDER)] = type;
+}
+
+uint32_t _pageblock_free_pages(zone_t* zone, uint32_t pfn) {
+	// Pageblocks at the edges of the zone may only be partly in it
+	uint32_t start = pfn & ~(PAGEBLOCK_PAGES - 1);
+	uint32_t end = start + PAGEBLOCK_PAGES;
+	start = (start < zone->pfn_start) ? zone->pfn_start : start;
+	end = (end > zone->pfn_end) ? zone->pfn_end : end;
+
+	uint32_t free = 0;
+	for (uint32_t next = start; next < end; ) {
+		page_t* page = pfn_to_page(next);
+		if (page->flags & PG_BUDDY) {
+			free += 1U << page->order;
+			next += 1U << page->order;
+		}
+		else
+			++next;
+	}
+	return free;
+}
+
+void _claim_pageblock(zone_t* zone, uint32_t pfn, uint32_t type) {
+	uint32_t start = pfn & ~(PAGEBLOCK_PAGES - 1);
+	uint32_t end = start + PAGEBLOCK_PAGES;
+	start = (start < zone->pfn_start) ? zone->pfn_start : start;
+	end = (end > zone->pfn_end) ? zone->pfn_end : end;
+
+	_set_pageblock_type(zone, start, type);
+	for (uint32_t next = start; next < end; ) {
+		page_t* page = pfn_to_page(next);
+		if (page->flags & PG_BUDDY) {
+			uint32_t order = page->order;
+			_free_list_remove(zone, page, order);
+			_free_list_add(zone, page, order);
+			next += 1U << order;
+		}
+		else
+			++next;
+	}
+	++zone->pageblock_claims;
+}
+
+page_t* _find_fallback(zone_t* zone, uint32_t order, uint32_t type, uint32_t* order_found) {
+	// Take the largest block there is, so that what's left of its pageblock is
+	//  more likely to be claimed too, rather than splitting many pageblocks
+	for (int32_t found = PAGE_MAX_ORDER - 1; found >= (int32_t)order; --found) {
+		for (uint32_t i = 0; i < PAGE_MIGRATE_TYPES - 1; ++i) {
+			page_t* page = zone->free_list[found][_migrate_fallbacks[type][i]];
+			if (page == NULL)
+				continue;
+
+			++zone->pageblock_steals;
+			uint32_t pfn = page_to_pfn(page);
+			if (found >= PAGEBLOCK_ORDER / 2
+				|| _pageblock_free_pages(zone, pfn) >= PAGEBLOCK_PAGES / 2)
+				_claim_pageblock(zone, pfn, type);
+			*order_found = found;
+			return page;
+		}
+	}
+	return NULL;
+}
+
+bool _compact_for(uint32_t order, gfp_t gfp) {
+	uint32_t moved = 0;
+	for (const int* i = _zone_fallbacks[gfp & GFP_ZONE_MASK]; *i >= 0; ++i) {
+		zone_t* zone = &page_allocator.zones[*i];
+		if (page_zone_fragmentation_index(zone, order) > PAGE_COMPACT_THRESHOLD)
+			moved += page_compact_zone(zone);
+	}
+	return moved > 0;
+}
+
+uint32_t _compact_isolate_free(zone_t* zone, uint32_t low, uint32_t high, page_t** targets) {
+	// Only take from whole pageblocks above the one the migrate scanner is in,
+	//  and only movable ones, so unmovable pageblocks don't get movable pages
+	uint32_t block = (high - 1) & ~(PAGEBLOCK_PAGES - 1);
+	uint32_t lowest = (low & ~(PAGEBLOCK_PAGES - 1)) + PAGEBLOCK_PAGES;
+	for (; high > lowest && block >= lowest; high = block, block -= PAGEBLOCK_PAGES) {
+		if (_pageblock_type(zone, block) != PAGE_MIGRATE_MOVABLE)
+			continue;
+
+		spin_lock(&zone->lock);
+		for (uint32_t pfn = block; pfn < high; ) {
+			page_t* page = pfn_to_page(pfn);
+			if (!(page->flags & PG_BUDDY)) {
+				++pfn;
+				continue;
+			}
+
+			// Split the block into single pages. None of them are known to be
+			//  zero anymore, as they're about to be written over.
+			uint32_t pages = 1U << page->order;
+			_free_list_remove(zone, page, page->order);
+			zone->free_pages -= pages;
+			page_allocator.free_pages -= pages;
+			for (uint32_t i = 0; i < pages; ++i) {
+				page[i].flags &= ~PG_ZERO;
+				page[i].order = 0;
+				page[i].next = *targets;
+				*targets = &page[i];
+			}
+			pfn += pages;
+		}
+		spin_unlock(&zone->lock);
+
+		if (*targets != NULL)
+			return block;
+	}
+	return high;
+}
+
+bool _compact_migrate(page_t* page, page_t* target) {
+	copy_highpage(target, page);
+	target->owner = page->owner;
+	target->index = page->index;
+	target->data = page->data;
+	target->refcount = page->refcount;
+	target->flags |= PG_MOVABLE;
+
+	const page_movable_ops_t* ops = (const page_movable_ops_t*)page->owner;
+	return ops->migrate(page, target);
+}
+
+uint32_t _zone_alloc(zone_t* zone, uint32_t order, uint32_t type) {
+	// Find the smallest order with a free block of the type that fits, and
+	//  fall back to the other types if there isn't one
+	uint32_t found = order;
+	while (found < PAGE_MAX_ORDER && zone->free_list[found][type] == NULL)
+		++found;
+	page_t* page;
+	if (found < PAGE_MAX_ORDER)
+		page = zone->free_list[found][type];
+	else if ((page = _find_fallback(zone, order, type, &found)) == NULL)
+		return PAGE_PFN_NONE;
+	_free_list_remove(zone, page, found);
+
+	// Split the block in half until it's the right size, putting the upper
+	//  halves back on the free lists of their pageblock's type. Each half is
+	//  zeroed if the block was.
+	uint32_t zero = page->flags & PG_ZERO;
+	while (found > order) {
+		--found;
+		page_t* half = page + (1U << found);
+		half->flags = (half->flags & ~PG_ZERO) | zero;
+		_free_list_add(zone, half, found);
+	}
+
+	page->flags |= (order > 0) ? PG_HEAD : 0;
+	page->order = order;
+	page->refcount = 1;
+
+	zone->free_pages -= 1U << order;
+	page_allocator.free_pages -= 1U << order;
+	return page_to_pfn(page);
+}
+
+bool _zone_has_free(zone_t* zone, uint32_t type) {
+	for (uint32_t order = 0; order < PAGE_MAX_ORDER; ++order) {
+		if (zone->free_list[order][type] != NULL)
+			return true;
+	}
+	return false;
+}
+
+void _zone_free(zone_t* zone, uint32_t pfn, uint32_t order) {
+	page_t* page = pfn_to_page(pfn);
+	if (page->flags & (PG_BUDDY | PG_PCP | PG_POOL))
+		panic("page_free: Double free of PFN %d\n", pfn);
+	page->flags &= ~(PG_HEAD | PG_MOVABLE);
+	page->refcount = 0;
+
+	zone->free_pages += 1U << order;
+	page_allocator.free_pages += 1U << order;
+
+	// Merge with the buddy for as long as it's a free block of the same order.
+	//  A block's buddy is the other half of the block of the next order up.
+	//  The merged block is only zeroed if both halves were.
+	uint32_t zero = page->flags & PG_ZERO;
+	while (order < PAGE_MAX_ORDER - 1) {
+		uint32_t buddy = pfn ^ (1U << order);
+		if (buddy < zone->pfn_start || buddy + (1U << order) > zone->pfn_end)
+			break;
+		page_t* buddy_page = pfn_to_page(buddy);
+		if (!(buddy_page->flags & PG_BUDDY) || buddy_page->order != order)
+			break;
+
+		_free_list_remove(zone, buddy_page, order);
+		zero &= buddy_page->flags;
+		pfn &= ~(1U << order);
+		++order;
+	}
+
+	page = pfn_to_page(pfn);
+	page->flags = (page->flags & ~PG_ZERO) | zero;
+	_free_list_add(zone, page, order);
+}
+
+page_t* _free_block_containing(zone_t* zone, uint32_t pfn) {
+	// Try the block of each order that would contain the frame
+	for (uint32_t order = 0; order < PAGE_MAX_ORDER; ++order) {
+		uint32_t start = pfn & ~((1U << order) - 1);
+		if (start < zone->pfn_start)
+			break;
+		page_t* page = pfn_to_page(start);
+		if (page->flags & PG_BUDDY && start + (1U << page->order) > pfn)
+			return page;
+	}
+	return NULL;
+}
+
+void _free_range(zone_t* zone, uint32_t start, uint32_t end, uint32_t zero) {
+	spin_lock(&zone->lock);
+	_zone_free_range(zone, start, end, zero);
+	spin_unlock(&zone->lock);
+}
+
+void _zone_free_range(zone_t* zone, uint32_t start, uint32_t end, uint32_t zero) {
+	while (start < end) {
+		// Largest order the PFN is aligned to that still fits in the range
+		uint32_t order = PAGE_MAX_ORDER - 1;
+		if (start != 0 && (uint32_t)__builtin_ctz(start) < order)
+			order = __builtin_ctz(start);
+		while ((1U << order) > end - start)
+			--order;
+
+		page_t* page = pfn_to_page(start);
+		page->flags = (page->flags & ~(PG_ZERO | PG_HEAD)) | zero;
+		_zone_free(zone, start, order);
+		start += 1U << order;
+	}
+}
+
+void _free_list_add(zone_t* zone, page_t* page, uint32_t order) {
+	uint32_t type = _pageblock_type(zone, page_to_pfn(page));
+	page->flags |= PG_BUDDY;
+	page->order = order;
+	page->index = type;
+	page->prev = NULL;
+	page->next = zone->free_list[order][type];
+	if (page->next != NULL)
+		page->next->prev = page;
+	zone->free_list[order][type] = page;
+	zone->nr_free[order] += 1;
+}
+
+void _free_list_remove(zone_t* zone, page_t* page, uint32_t order) {
+	if (page->prev != NULL)
+		page->prev->next = page->next;
+	else
+		zone->free_list[order][page->index] = page->next;
+	if (page->next != NULL)
+		page->next->prev = page->prev;
+	page->flags &= ~PG_BUDDY;
+	zone->nr_free[order] -= 1;
+}
+
+uint32_t _pcp_alloc(zone_t* zone, bool cold, uint32_t type) {
+	per_cpu_pages_t* pcp = &zone->pcp[smp_processor_id()];
+	if (pcp->count <= pcp->low || pcp->head[type] == NULL) {
+		++pcp->alloc_misses;
+		_pcp_refill(zone, pcp, type, pcp->batch);
+		if (pcp->head[type] == NULL)
+			return PAGE_PFN_NONE;
+	}
+	else
+		++pcp->alloc_hits;
+
+	page_t* page = cold ? pcp->tail[type] : pcp->head[type];
+	_pcp_list_remove(pcp, page);
+	page->refcount = 1;
+	return page_to_pfn(page);
+}
+
+void _pcp_free(zone_t* zone, page_t* page, bool cold) {
+	if (page->flags & (PG_BUDDY | PG_PCP | PG_POOL))
+		panic("page_free: Double free of PFN %d\n", page_to_pfn(page));
+
+	per_cpu_pages_t* pcp = &zone->pcp[smp_processor_id()];
+	page->flags &= ~(PG_HEAD | PG_MOVABLE);
+	page->refcount = 0;
+	_pcp_list_add(pcp, page, _pageblock_type(zone, page_to_pfn(page)), cold);
+	if (pcp->count > pcp->high) {
+		++pcp->free_drains;
+		_pcp_drain(zone, pcp, pcp->batch);
+	}
+	else
+		++pcp->free_hits;
+}
+
+void _pcp_refill(zone_t* zone, per_cpu_pages_t* pcp, uint32_t type, uint32_t count) {
+	if (zone->free_pages == 0)
+		return;
+
+	// Pages taken from another type's pageblock still go on the list for
+	//  `type`, as that's what they're being taken for
+	spin_lock(&zone->lock);
+	for (uint32_t i = 0; i < count; ++i) {
+		uint32_t pfn = _zone_alloc(zone, 0, type);
+		if (pfn == PAGE_PFN_NONE)
+			break;
+		_pcp_list_add(pcp, pfn_to_page(pfn), type, true);
+	}
+	spin_unlock(&zone->lock);
+}
+
+void _pcp_drain(zone_t* zone, per_cpu_pages_t* pcp, uint32_t count) {
+	if (count == 0)
+		return;
+
+	// Take the coldest page of each type in turn
+	spin_lock(&zone->lock);
+	for (uint32_t i = 0, type = 0; i < count && pcp->count > 0; type = (type + 1) % PAGE_MIGRATE_TYPES) {
+		page_t* page = pcp->tail[type];
+		if (page == NULL)
+			continue;
+		_pcp_list_remove(pcp, page);
+		_zone_free(zone, page_to_pfn(page), 0);
+		++i;
+	}
+	spin_unlock(&zone->lock);
+}
+
+void _pcp_list_add(per_cpu_pages_t* pcp, page_t* page, uint32_t type, bool tail) {
+	page->flags |= PG_PCP;
+	page->order = 0;
+	page->index = type;
+	if (tail) {
+		page->next = NULL;
+		page->prev = pcp->tail[type];
+		if (pcp->tail[type] != NULL)
+			pcp->tail[type]->next = page;
+		else
+			pcp->head[type] = page;
+		pcp->tail[type] = page;
+	}
+	else {
+		page->prev = NULL;
+		page->next = pcp->head[type];
+		if (pcp->head[type] != NULL)
+			pcp->head[type]->prev = page;
+		else
+			pcp->tail[type] = page;
+		pcp->head[type] = page;
+	}
+	++pcp->count;
+}
+
+void _pcp_list_remove(per_cpu_pages_t* pcp, page_t* page) {
+	uint32_t type = page->index;
+	if (page->prev != NULL)
+		page->prev->next = page->next;
+	else
+		pcp->head[type] = page->next;
+	if (page->next != NULL)
+		page->next->prev = page->prev;
+	else
+		pcp->tail[type] = page->prev;
+	page->flags &= ~PG_PCP;
+	--pcp->count;
+}
+
+uint32_t _zero_pool_alloc(gfp_t gfp) {
+	for (const int* i = _zone_fallbacks[gfp & GFP_ZONE_MASK]; *i >= 0; ++i) {
+		zone_t* zone = &page_allocator.zones[*i];
+		if (zone->zero_count == 0)
+			continue;
+
+		spin_lock(&zone->lock);
+		page_t* page = zone->zero_pool;
+		if (page != NULL) {
+			zone->zero_pool = page->next;
+			--zone->zero_count;
+			page->flags &= ~PG_POOL;
+			page->refcount = 1;
+		}
+		spin_unlock(&zone->lock);
+
+		if (page != NULL) {
+			++zone->zero_hits;
+			return page_to_pfn(page);
+		}
+	}
+	return PAGE_PFN_NONE;
+}
+
+void _zero_pages(uint32_t pfn, uint32_t count) {
+	page_t* page = pfn_to_page(pfn);
+	zone_t* zone = _pfn_zone(pfn);
+	if (page->flags & PG_ZERO) {
+		++zone->zero_hits;
+		return;
+	}
+
+	++zone->zero_misses;
+	for (uint32_t i = 0; i < count; ++i)
+		clear_highpage(&page[i]);
+	page->flags |= PG_ZERO;
+}
@@ -0,0 +1,267 @@
+/// @file page_fault.c
+
+#include <namuos/page_fault.h> // Implements
+
+#include <stdbool.h>
+#include <namuos/highmem.h>
+#include <namuos/page_allocator.h>
+#include <namuos/paging.h>
+#include <namuos/panic.h>
+#include <namuos/terminal.h>
+#include <namuos/vmalloc.h>
+
+
+// What handling a fault came to
+#define _PAGE_FAULT_MINOR    0
+#define _PAGE_FAULT_MAJOR    1
+#define _PAGE_FAULT_SPURIOUS 2
+#define _PAGE_FAULT_BAD      3
+
+// Works out why the access to `addr` with error code `error` faulted, and
+//  fixes it if the kernel expected it. Returns a `_PAGE_FAULT_*` result, and
+//  for `_PAGE_FAULT_BAD`, sets `reason` to say why.
+uint32_t _page_fault_resolve(uintptr_t addr, uint32_t error, const char** reason);
+
+// Gives the copy-on-write page at `pte` to the mapping at `addr` in `pgd` to
+//  write to, copying it if anything else still maps it
+uint32_t _page_fault_cow(PDE_t* pgd, PTE_t* pte, uintptr_t addr, const char** reason);
+
+// Lets compaction move `pfn`, a page just allocated for the mapping at `addr`
+//  in `pgd`. Its `index` is the address, and its `data` the directory.
+void _page_fault_set_movable(uint32_t pfn, PDE_t* pgd, uintptr_t addr);
+
+// Moves an anonymous page to `new_page`, by pointing its entry at the new
+//  page. Refuses if the page is shared, or no longer mapped where it was.
+bool _page_fault_migrate(page_t* page, page_t* new_page);
+
+// Returns if entries `pde` and `pte` allow the access described by `error`
+bool _page_fault_allowed(paging_entry_t pde, paging_entry_t pte, uint32_t error);
+
+// Returns why the entries didn't allow the access described by `error`
+const char* _page_fault_denied_reason(uint32_t error);
+
+// Returns the name of the region of virtual memory `addr` is in
+const char* _page_fault_region(uintptr_t addr);
+
+// Logs everything known about a fault the kernel didn't expect, and panics
+void _page_fault_oops(interrupt_frame_t* frame, uintptr_t addr, const char* reason) __attribute__((__noreturn__));
+
+
+page_fault_stats_t page_fault_stats[NR_CPUS];
+
+// How compaction moves the pages allocated by faults
+static const page_movable_ops_t _page_fault_movable_ops = { .migrate = _page_fault_migrate };
+
+
+void page_fault_handle(interrupt_frame_t* frame) {
+	// CR2 has to be read before anything else can fault
+	uintptr_t addr = read_cr2();
+	uint64_t begin = rdtsc();
+
+	const char* reason = NULL;
+	uint32_t result = _page_fault_resolve(addr, frame->error_code, &reason);
+	if (result == _PAGE_FAULT_BAD)
+		_page_fault_oops(frame, addr, reason);
+
+	page_fault_stats_t* stats = &page_fault_stats[smp_processor_id()];
+	if (result == _PAGE_FAULT_MAJOR)
+		++stats->major;
+	else if (result == _PAGE_FAULT_MINOR)
+		++stats->minor;
+	else
+		++stats->spurious;
+	stats->cycles += rdtsc() - begin;
+}
+
+void page_fault_dump_stats() {
+	for (uint32_t cpu = 0; cpu < NR_CPUS; ++cpu) {
+		page_fault_stats_t* stats = &page_fault_stats[cpu];
+		uint32_t faults = stats->minor + stats->major + stats->spurious;
+		klog_info(
+			"page faults: CPU %d: %d minor, %d major, %d spurious, %lu cycles each\n",
+			cpu, stats->minor, stats->major, stats->spurious,
+			stats->cycles / (faults ? faults : 1));
+	}
+}
+
+uint32_t _page_fault_resolve(uintptr_t addr, uint32_t error, const char** reason) {
+	if (error & PF_RSVD) {
+		*reason = "Reserved bit set in a paging entry";
+		return _PAGE_FAULT_BAD;
+	}
+
+	// Page tables for kernel addresses are added to the kernel's directory,
+	//  and only copied into other directories when they fault on them
+	uint32_t index = addr >> PGDIR_SHIFT;
+	if (addr >= PAGE_OFFSET && current_pgd != kernel_pgd
+		&& kernel_pgd[index].present && current_pgd[index].raw != kernel_pgd[index].raw) {
+		current_pgd[index] = kernel_pgd[index];
+		return _PAGE_FAULT_MINOR;
+	}
+
+	// A range from `paging_map_anon` may not have its page table yet
+	PDE_t* pgd = (addr >= PAGE_OFFSET) ? kernel_pgd : current_pgd;
+	PDE_t* pde = &pgd[index];
+	if (!pde->present) {
+		if (!(pde->raw & PDE_ANON)) {
+			*reason = "No page table";
+			return _PAGE_FAULT_BAD;
+		}
+		if (paging_get_pte(pgd, addr, true) == NULL) {
+			*reason = "Out of memory for a page table";
+			return _PAGE_FAULT_BAD;
+		}
+		if (pgd != current_pgd)
+			current_pgd[index] = *pde;
+	}
+
+	// Large pages only map the linear mapping, which never changes
+	if (pde->page_size) {
+		if (_page_fault_allowed(pde->raw, pde->raw, error)) {
+			invalidate_page((void*)addr);
+			return _PAGE_FAULT_SPURIOUS;
+		}
+		*reason = _page_fault_denied_reason(error);
+		return _PAGE_FAULT_BAD;
+	}
+
+	// Allocate a page touched for the first time, which keeps the flags it's
+	//  to be mapped with. Entries that weren't present aren't in the TLB.
+	PTE_t* pte = paging_get_pte(pgd, addr, false);
+	if (!pte->present) {
+		if (!(pte->raw & PTE_ANON)) {
+			*reason = "Page not mapped";
+			return _PAGE_FAULT_BAD;
+		}
+		uint32_t pfn = page_alloc_pfn(0, GFP_HIGHMEM | GFP_MOVABLE | GFP_ZERO);
+		if (pfn == PAGE_PFN_NONE) {
+			*reason = "Out of memory for a demand-zero page";
+			return _PAGE_FAULT_BAD;
+		}
+		_page_fault_set_movable(pfn, pgd, addr);
+
+		PTE_t entry = *pte;
+		entry.addr = pfn;
+		entry.present = 1;
+		*pte = entry;
+		return _PAGE_FAULT_MAJOR;
+	}
+
+	if ((error & PF_WRITE) && !pte->rw && (pte->raw & PTE_COW))
+		return _page_fault_cow(pgd, pte, addr, reason);
+
+	// Another CPU, or an earlier fault, may have fixed the entry already
+	if (_page_fault_allowed(pde->raw, pte->raw, error)) {
+		invalidate_page((void*)addr);
+		return _PAGE_FAULT_SPURIOUS;
+	}
+	*reason = _page_fault_denied_reason(error);
+	return _PAGE_FAULT_BAD;
+}
+
+uint32_t _page_fault_cow(PDE_t* pgd, PTE_t* pte, uintptr_t addr, const char** reason) {
+	page_t* page = pfn_to_page(pte->addr);
+	PTE_t entry = *pte;
+	entry.rw = 1;
+	entry.raw &= ~(paging_entry_t)PTE_COW;
+
+	// The last mapping left can have the frame to itself
+	uint32_t result = _PAGE_FAULT_MINOR;
+	if (page->refcount > 1) {
+		uint32_t pfn = page_alloc_pfn(0, GFP_HIGHMEM | GFP_MOVABLE);
+		if (pfn == PAGE_PFN_NONE) {
+			*reason = "Out of memory to copy a copy-on-write page";
+			return _PAGE_FAULT_BAD;
+		}
+		copy_highpage(pfn_to_page(pfn), page);
+		_page_fault_set_movable(pfn, pgd, addr);
+		--page->refcount;
+		entry.addr = pfn;
+		result = _PAGE_FAULT_MAJOR;
+	}
+
+	// The read-only entry may still be in the TLB
+	*pte = entry;
+	invalidate_page((void*)addr);
+	return result;
+}
+
+void _page_fault_set_movable(uint32_t pfn, PDE_t* pgd, uintptr_t addr) {
+	page_t* page = pfn_to_page(pfn);
+	page->index = addr & PAGE_MASK;
+	page->data = (uint32_t)pgd;
+	page_set_movable(pfn, &_page_fault_movable_ops);
+}
+
+bool _page_fault_migrate(page_t* page, page_t* new_page) {
+	// Only the mapping it was allocated for is known, and sharing or
+	//  copy-on-write may have moved that elsewhere since
+	if (page->refcount != 1)
+		return false;
+	PDE_t* pgd = (PDE_t*)page->data;
+	PTE_t* pte = paging_get_pte(pgd, page->index, false);
+	if (pte == NULL || !pte->present || pte->addr != page_to_pfn(page))
+		return false;
+
+	pte->addr = page_to_pfn(new_page);
+	invalidate_page((void*)page->index);
+	return true;
+}
+
+bool _page_fault_allowed(paging_entry_t pde, paging_entry_t pte, uint32_t error) {
+	if (!(pte & PTE_PRESENT))
+		return false;
+	if ((error & PF_WRITE) && (!(pde & PDE_RW) || !(pte & PTE_RW)))
+		return false;
+	if ((error & PF_USER) && (!(pde & PDE_USER) || !(pte & PTE_USER)))
+		return false;
+	if ((error & PF_INSTR) && ((pde | pte) & PTE_NX))
+		return false;
+	return true;
+}
+
+const char* _page_fault_denied_reason(uint32_t error) {
+	if (error & PF_INSTR)
+		return "Instruction fetch from a non-executable page";
+	if (error & PF_WRITE)
+		return "Write to a read-only page";
+	if (error & PF_USER)
+		return "User access to a kernel page";
+	return "Access denied";
+}
+
+const char* _page_fault_region(uintptr_t addr) {
+	if (addr < PAGE_SIZE)
+		return "the null page";
+	if (addr < PAGE_OFFSET)
+		return "user space";
+	if (addr < (uintptr_t)__to_virt(ZONE_HIGHMEM_OFFSET))
+		return "the linear mapping";
+	if (addr < VMALLOC_START)
+		return "the gap before the vmalloc area";
+	if (addr < VMALLOC_END)
+		return "the vmalloc area";
+	if (addr < KMAP_ATOMIC_BASE)
+		return "the kmap window";
+	return "the kmap_atomic windows";
+}
+
+void _page_fault_oops(interrupt_frame_t* frame, uintptr_t addr, const char* reason) {
+	PDE_t* pgd = (addr >= PAGE_OFFSET) ? kernel_pgd : current_pgd;
+	PDE_t pde = pgd[addr >> PGDIR_SHIFT];
+	PTE_t* pte = (pde.present && !pde.page_size) ? paging_get_pte(pgd, addr, false) : NULL;
+	uint32_t error = frame->error_code;
+
+	klog_critical("page fault: %s at 0x%p in %s\n", reason, addr, _page_fault_region(addr));
+	klog_critical(
+		"  error 0x%x: %s %s from %s mode%s\n", error,
+		(error & PF_INSTR) ? "instruction fetch" : ((error & PF_WRITE) ? "write" : "read"),
+		(error & PF_PRESENT) ? "denied" : "of a page not present",
+		(error & PF_USER) ? "user" : "kernel",
+		(error & PF_RSVD) ? ", reserved bit set" : "");
+	idt_dump_frame(frame);
+	klog_critical(
+		"  PDE 0x%lx PTE 0x%lx\n",
+		(uint64_t)pde.raw, (pte != NULL) ? (uint64_t)pte->raw : 0ULL);
+	panic("Unhandled page fault\n");
+}
@@ -0,0 +1,265 @@
+/// @file page_mem.c
+
+#include <namuos/page_mem.h> // Implements
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <namuos/page_allocator.h>
+#include <namuos/terminal.h>
+
+
+// Clears a page with `rep stosd`
+void _clear_page_rep(void* page);
+
+// Copies a page with `rep movsd`
+void _copy_page_rep(void* dest, const void* src);
+
+// Clears a page with a loop of 32-bit stores, a cache line per iteration
+void _clear_page_unrolled(void* page);
+
+// Copies a page with a loop of 32-bit loads and stores, 32 bytes per iteration
+void _copy_page_unrolled(void* dest, const void* src);
+
+// Clears a page with SSE2 non-temporal stores, a cache line per iteration. The
+//  rest of the kernel is built without SSE, so only these may use it.
+__attribute__((target("sse2"))) void _clear_page_sse2(void* page);
+
+// Copies a page with SSE2 loads and non-temporal stores, a cache line per
+//  iteration
+__attribute__((target("sse2"))) void _copy_page_sse2(void* dest, const void* src);
+
+// Returns if the variant `variant` can be used on this CPU
+bool _page_mem_supported(uint32_t variant);
+
+// Measures clearing (or copying, if `src` is set) @ref PAGE_MEM_PROBE_PAGES
+//  pages at `dest` with variant `variant`. Returns the fewest cycles per page
+//  taken in any round.
+uint32_t _page_mem_probe(uint32_t variant, void* dest, const void* src);
+
+
+// Every variant, indexed by `PAGE_MEM_*`
+static void (* const _page_mem_clear[PAGE_MEM_VARIANTS])(void*) = {
+	[PAGE_MEM_REP]      = _clear_page_rep,
+	[PAGE_MEM_UNROLLED] = _clear_page_unrolled,
+	[PAGE_MEM_SSE2]     = _clear_page_sse2,
+};
+static void (* const _page_mem_copy[PAGE_MEM_VARIANTS])(void*, const void*) = {
+	[PAGE_MEM_REP]      = _copy_page_rep,
+	[PAGE_MEM_UNROLLED] = _copy_page_unrolled,
+	[PAGE_MEM_SSE2]     = _copy_page_sse2,
+};
+static const char* const _page_mem_names[PAGE_MEM_VARIANTS] = {
+	[PAGE_MEM_REP]      = "rep",
+	[PAGE_MEM_UNROLLED] = "unrolled",
+	[PAGE_MEM_SSE2]     = "sse2",
+};
+
+// If pages can be cleared around the cache, set by page_mem_initialise
+static bool _page_mem_nocache = false;
+
+// Page clearing and copying for each CPU
+page_mem_cpu_t page_mem_cpu[NR_CPUS] = {
+	[0 ... NR_CPUS - 1] = {
+		.clear = _clear_page_rep,
+		.copy = _copy_page_rep,
+		.clear_variant = PAGE_MEM_REP,
+		.copy_variant = PAGE_MEM_REP,
+	},
+};
+
+
+void page_mem_initialise() {
+	page_mem_cpu_t* cpu = &page_mem_cpu[smp_processor_id()];
+	_page_mem_nocache = _page_mem_supported(PAGE_MEM_SSE2);
+	if (!(cpu_info.features_edx & CPUID_EDX_TSC)) {
+		klog_debug("page_mem: No TSC to measure with, using rep\n");
+		return;
+	}
+
+	// Measure into pages the rest of the kernel isn't using, so nothing
+	//  depends on what's in them
+	uint32_t pfn = page_alloc_pfn_exact(2 * PAGE_MEM_PROBE_PAGES, GFP_KERNEL);
+	if (pfn == PAGE_PFN_NONE) {
+		klog_warning("page_mem: No memory to measure with, using rep\n");
+		return;
+	}
+	uint8_t* dest = (uint8_t*)page_to_virt(pfn_to_page(pfn));
+	uint8_t* src = dest + PAGE_MEM_PROBE_PAGES * PAGE_SIZE;
+
+	uint32_t best_clear = PAGE_MEM_REP, best_copy = PAGE_MEM_REP;
+	for (uint32_t variant = 0; variant < PAGE_MEM_VARIANTS; ++variant) {
+		if (!_page_mem_supported(variant))
+			continue;
+		cpu->clear_cycles[variant] = _page_mem_probe(variant, dest, NULL);
+		cpu->copy_cycles[variant] = _page_mem_probe(variant, dest, src);
+		if (cpu->clear_cycles[variant] < cpu->clear_cycles[best_clear])
+			best_clear = variant;
+		if (cpu->copy_cycles[variant] < cpu->copy_cycles[best_copy])
+			best_copy = variant;
+	}
+	page_free_pfn_exact(pfn, 2 * PAGE_MEM_PROBE_PAGES);
+
+	cpu->clear = _page_mem_clear[best_clear];
+	cpu->copy = _page_mem_copy[best_copy];
+	cpu->clear_variant = best_clear;
+	cpu->copy_variant = best_copy;
+
+	klog_info(
+		"page_mem: CPU %d clears pages with %s (%d cycles), copies with %s (%d cycles)\n",
+		smp_processor_id(), _page_mem_names[best_clear], cpu->clear_cycles[best_clear],
+		_page_mem_names[best_copy], cpu->copy_cycles[best_copy]);
+}
+
+const char* page_mem_variant_name(uint32_t variant) {
+	return (variant < PAGE_MEM_VARIANTS) ? _page_mem_names[variant] : "unknown";
+}
+
+void clear_page_nocache(void* page) {
+	if (_page_mem_nocache)
+		_clear_page_sse2(page);
+	else
+		clear_page(page);
+}
+
+void _clear_page_rep(void* page) {
+	size_t count = PAGE_SIZE / sizeof(uint32_t);
+	asm volatile ("rep stosl"
+		: "+D"(page), "+c"(count)
+		: "a"(0)
+		: "memory");
+}
+
+void _copy_page_rep(void* dest, const void* src) {
+	size_t count = PAGE_SIZE / sizeof(uint32_t);
+	asm volatile ("rep movsl"
+		: "+D"(dest), "+S"(src), "+c"(count)
+		:
+		: "memory");
+}
+
+void _clear_page_unrolled(void* page) {
+	size_t count = PAGE_SIZE / 64;
+	asm volatile (
+		"1:\n\t"
+		"movl %2, 0(%0)\n\t"
+		"movl %2, 4(%0)\n\t"
+		"movl %2, 8(%0)\n\t"
+		"movl %2, 12(%0)\n\t"
+		"movl %2, 16(%0)\n\t"
+		"movl %2, 20(%0)\n\t"
+		"movl %2, 24(%0)\n\t"
+		"movl %2, 28(%0)\n\t"
+		"movl %2, 32(%0)\n\t"
+		"movl %2, 36(%0)\n\t"
+		"movl %2, 40(%0)\n\t"
+		"movl %2, 44(%0)\n\t"
+		"movl %2, 48(%0)\n\t"
+		"movl %2, 52(%0)\n\t"
+		"movl %2, 56(%0)\n\t"
+		"movl %2, 60(%0)\n\t"
+		"add $64, %0\n\t"
+		"dec %1\n\t"
+		"jnz 1b"
+		: "+r"(page), "+r"(count)
+		: "r"(0U)
+		: "memory", "cc");
+}
+
+void _copy_page_unrolled(void* dest, const void* src) {
+	// Only two registers are left to copy through on i686, so pair up the
+	//  loads and stores to keep both busy
+	size_t count = PAGE_SIZE / 32;
+	uint32_t a, b;
+	asm volatile (
+		"1:\n\t"
+		"movl 0(%1), %3\n\t"
+		"movl 4(%1), %4\n\t"
+		"movl %3, 0(%0)\n\t"
+		"movl %4, 4(%0)\n\t"
+		"movl 8(%1), %3\n\t"
+		"movl 12(%1), %4\n\t"
+		"movl %3, 8(%0)\n\t"
+		"movl %4, 12(%0)\n\t"
+		"movl 16(%1), %3\n\t"
+		"movl 20(%1), %4\n\t"
+		"movl %3, 16(%0)\n\t"
+		"movl %4, 20(%0)\n\t"
+		"movl 24(%1), %3\n\t"
+		"movl 28(%1), %4\n\t"
+		"movl %3, 24(%0)\n\t"
+		"movl %4, 28(%0)\n\t"
+		"add $32, %1\n\t"
+		"add $32, %0\n\t"
+		"dec %2\n\t"
+		"jnz 1b"
+		: "+r"(dest), "+r"(src), "+r"(count), "=&r"(a), "=&r"(b)
+		:
+		: "memory", "cc");
+}
+
+__attribute__((target("sse2"))) void _clear_page_sse2(void* page) {
+	// The stores are weakly ordered, so fence them before the page is used
+	size_t count = PAGE_SIZE / 64;
+	asm volatile (
+		"pxor %%xmm0, %%xmm0\n\t"
+		"1:\n\t"
+		"movntdq %%xmm0, 0(%0)\n\t"
+		"movntdq %%xmm0, 16(%0)\n\t"
+		"movntdq %%xmm0, 32(%0)\n\t"
+		"movntdq %%xmm0, 48(%0)\n\t"
+		"add $64, %0\n\t"
+		"dec %1\n\t"
+		"jnz 1b\n\t"
+		"sfence"
+		: "+r"(page), "+r"(count)
+		:
+		: "memory", "cc", "xmm0");
+}
+
+__attribute__((target("sse2"))) void _copy_page_sse2(void* dest, const void* src) {
+	// Pages are 16 byte aligned, so the loads can be aligned too
+	size_t count = PAGE_SIZE / 64;
+	asm volatile (
+		"1:\n\t"
+		"movdqa 0(%1), %%xmm0\n\t"
+		"movdqa 16(%1), %%xmm1\n\t"
+		"movdqa 32(%1), %%xmm2\n\t"
+		"movdqa 48(%1), %%xmm3\n\t"
+		"movntdq %%xmm0, 0(%0)\n\t"
+		"movntdq %%xmm1, 16(%0)\n\t"
+		"movntdq %%xmm2, 32(%0)\n\t"
+		"movntdq %%xmm3, 48(%0)\n\t"
+		"add $64, %1\n\t"
+		"add $64, %0\n\t"
+		"dec %2\n\t"
+		"jnz 1b\n\t"
+		"sfence"
+		: "+r"(dest), "+r"(src), "+r"(count)
+		:
+		: "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3");
+}
+
+bool _page_mem_supported(uint32_t variant) {
+	// SSE2 also needs to have been turned on by cpu_initialise
+	if (variant == PAGE_MEM_SSE2)
+		return (cpu_info.features_edx & CPUID_EDX_SSE2) && (read_cr4() & CR4_OSFXSR);
+	return true;
+}
+
+uint32_t _page_mem_probe(uint32_t variant, void* dest, const void* src) {
+	uint64_t best = UINT64_MAX;
+	for (uint32_t round = 0; round < PAGE_MEM_PROBE_ROUNDS; ++round) {
+		uint64_t begin = rdtsc();
+		for (uint32_t i = 0; i < PAGE_MEM_PROBE_PAGES; ++i) {
+			void* page = (uint8_t*)dest + i * PAGE_SIZE;
+			if (src != NULL)
+				_page_mem_copy[variant](page, (const uint8_t*)src + i * PAGE_SIZE);
+			else
+				_page_mem_clear[variant](page);
+		}
+		uint64_t cycles = rdtsc() - begin;
+		if (cycles < best)
+			best = cycles;
+	}
+	return best / PAGE_MEM_PROBE_PAGES;
+}
@@ -2,27 +2,91 @@
 
 #include <namuos/paging.h> // Implements
 
-#include <string.h> // memset
+#include <namuos/bios_defines.h>
 #include <namuos/boot_allocator.h>
+#include <namuos/cpu.h>
+#include <namuos/memblock.h>
+#include <namuos/page_allocator.h>
+#include <namuos/page_mem.h>
+#include <namuos/panic.h>
 #include <namuos/terminal.h>
 
 
-// Kernel page directory from `boot.S`, and the first two pages.
+// Kernel page directory from `boot.S`, and the page tables mapping the first
+//  8 MiB, or BOOT_TABLES_MAPPED_SIZE without large pages.
 extern void* _kernel_pgd;
-extern void* _kernel_pg0;
-extern void* _kernel_pg1;
+extern PTE_t _kernel_pg0[];
 PDE_t* kernel_pgd = (PDE_t*)&_kernel_pgd;
 
-// The current directory we're using
-PDE_t* current_pgd = NULL;
+#if PAGING_PAE
+// Page directory pointer table from `boot.S`
+extern PDPTE_t _kernel_pdpt[];
+PDPTE_t* kernel_pdpt = _kernel_pdpt;
+#endif
+
+// The current directory we're using, which is the kernel's from `boot.S` on
+PDE_t* current_pgd = (PDE_t*)&_kernel_pgd;
+
+// Set if the linear mapping is made of large pages
+bool paging_pse_enabled = false;
+
+// Set if EFER.NXE is set
+bool paging_nx_enabled = false;
+
+// Set if the PAT has been programmed
+bool paging_pat_enabled = false;
+
+// Memory types used in PAT entries
+#define PAT_UC       0x00
+#define PAT_WC       0x01
+#define PAT_WT       0x04
+#define PAT_WP       0x05
+#define PAT_WB       0x06
+#define PAT_UC_MINUS 0x07
+
+// PTE bits selecting each caching attribute. Until the PAT is programmed these
+//  use the power-on PAT entries (WB, WT, UC-, UC, repeated), which have no
+//  write-combining or write-protected entry, so those are left uncached.
+paging_entry_t _paging_cache_bits[PAGE_CACHE_TYPES] = {
+	[PAGE_CACHE_WB]       = 0,
+	[PAGE_CACHE_WC]       = PTE_PCD,
+	[PAGE_CACHE_WT]       = PTE_PWT,
+	[PAGE_CACHE_WP]       = PTE_PCD,
+	[PAGE_CACHE_UC_MINUS] = PTE_PCD,
+	[PAGE_CACHE_UC]       = PTE_PCD | PTE_PWT,
+};
+
+// Programs the PAT with all the caching attributes in `enum page_cache`
+void _paging_initialise_pat();
+
+// Set if global pages are enabled
+bool paging_pge_enabled = false;
 
 // Addresses of regions of the kernel image. See `linker.ld`. Used to mark pages
 //  as read-only. The `_kernel_image_rw_permission()` method returns 1 if the
-//  page frame is writable, otherwise 0.
+//  page frame is writable, otherwise 0. `_kernel_image_pfn_executable()`
+//  returns 1 if code may run from the page frame, otherwise 0.
 extern void* _paddr_kernel_start;
 extern void* _paddr_kernel_ro_end;
 extern void* _paddr_kernel_rw_end;
 int _kernel_image_pfn_rw_permission(uint32_t pfn);
+int _kernel_image_pfn_executable(uint32_t pfn);
+
+// Finish the linear mapping of low memory past what `boot.S` mapped with page
+//  tables, either marking its large pages global, or with more page tables
+//  allocated from ZONE_NORMAL.
+void _paging_map_linear_pse();
+void _paging_map_linear_tables();
+
+// Returns the page table covering `vaddr` in `pgd`. If there isn't one and
+//  `alloc` is set, a zeroed table is allocated and added to `pgd`, or one
+//  filled with the demand-zero entries of a PDE from `paging_map_anon`.
+//  Returns NULL if there's no table, or `vaddr` is covered by a large page.
+PTE_t* _paging_get_table(PDE_t* pgd, uintptr_t vaddr, bool alloc);
+
+// Allocates a zeroed page for a page table, from the boot allocator if it's
+//  still running, otherwise the page allocator.
+PTE_t* _paging_alloc_table();
 
 
 void paging_initialise() {
@@ -30,55 +94,73 @@ void paging_initialise() {
 	//  `boot.S`.
 	current_pgd = kernel_pgd;
 
-	// Set the permissions for the first two pages of the kernel page directory.
-	//  The `present` bit has already been set for each entry, we just need to
-	//  set `global` and the correct read/write permissions.
-	PTE_t* pg0 = (PTE_t*)&_kernel_pg0;
-	PTE_t* pg1 = (PTE_t*)&_kernel_pg1;
-	for (uint32_t i = 0; i < PTRS_PER_PTE; ++i) { // pg0
-		pg0[i].global = 1;
-		pg0[i].rw = _kernel_image_pfn_rw_permission(i);
-	}
-	for (uint32_t i = 0; i < PTRS_PER_PTE; ++i) { // pg1
-		pg1[i].global = 1;
-		pg1[i].rw = _kernel_image_pfn_rw_permission(i + PTRS_PER_PTE);
-	}
-
-	// Calculate how many page table entries we need to cover the entire linear
-	//  mappin of low memory. We subtract 2 from the rounded up number as we've
-	//  already got pg0 and pg1.
-	uint32_t total_entries = ZONE_HIGHMEM_OFFSET / PAGE_SIZE;
-	uint32_t new_tables = (total_entries + PTRS_PER_PTE - 1) / PTRS_PER_PTE - 2;
-
-	// Allocate space for the remaining page tables and clear all the entries.
-	//  All page tables are allocated contiguously in one block in ZONE_DMA as
-	//  otherwise it's not mapped in the 8 MiB initial mapping.
-	PTE_t* entries = (PTE_t*)bootmem_aligned_alloc_low(sizeof(PTE_t) * PTRS_PER_PTE * new_tables);
-	memset(entries, 0, sizeof(PTE_t) * PTRS_PER_PTE * new_tables);
-
-	// Set `global` and `present` for all the new entries, and set as writable
-	//  as they are outside the kernel image.
-	for (uint32_t i = 2*PTRS_PER_PTE; i < total_entries; ++i) {
-		entries[i - 2*PTRS_PER_PTE].present = 1;
-		entries[i - 2*PTRS_PER_PTE].global = 1;
-		entries[i - 2*PTRS_PER_PTE].rw = 1;
-		// This ends up being physical address >> PAGE_SHIFT
-		entries[i - 2*PTRS_PER_PTE].addr = i;
-	}
-
-	// Add these new page tables to the kernel page directory
-	uint32_t pde_offset = PAGE_OFFSET >> PGDIR_SHIFT; // PDE kernel-space offset
-	for (uint32_t i = 0; i < new_tables; ++i) {
-		kernel_pgd[pde_offset+i+2].present = 1;
-		kernel_pgd[pde_offset+i+2].addr = (__to_phys(entries) >> PAGE_SHIFT) + i;
+#if PAGING_PAE
+	// PAE entries have an execute-disable bit, but it's reserved unless
+	//  EFER.NXE is set. If the CPU supports it, turn it on so only the kernel's
+	//  code is executable.
+	if (cpu_info.ext_features_edx & CPUID_EXT_EDX_NX) {
+		wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_NXE);
+		paging_nx_enabled = true;
+	}
+	klog_debug("Enabled PAE paging, NX %s\n", paging_nx_enabled ? "enabled" : "not supported");
+#endif
+
+	// Rewrite the page tables `boot.S` mapped, adding `global` and the correct
+	//  read/write (and execute) permissions to each entry.
+	bool large_pages = PAGING_PAE || (cpu_info.features_edx & CPUID_EDX_PSE);
+	uint32_t boot_pt_entries = (large_pages ? BOOT_MAPPED_SIZE : BOOT_TABLES_MAPPED_SIZE) / PAGE_SIZE;
+	PTE_t* boot_pt = _kernel_pg0;
+	for (uint32_t i = 0; i < boot_pt_entries; ++i) {
+		paging_entry_t flags = PTE_PRESENT | PTE_GLOBAL;
+		if (_kernel_image_pfn_rw_permission(i))
+			flags |= PTE_RW;
+		if (paging_nx_enabled && !_kernel_image_pfn_executable(i))
+			flags |= PTE_NX;
+		boot_pt[i].raw = PFN_PHYS(i) | flags;
+	}
+
+	// Program the PAT before anything asks for a caching attribute
+	if (cpu_info.features_edx & CPUID_EDX_PAT)
+		_paging_initialise_pat();
+
+	// If the CPU supports large pages, `boot.S` mapped the rest of the linear
+	//  mapping with them. No page tables need to be allocated, and the whole of
+	//  low memory only needs a few hundred TLB entries. PAE always has them.
+	if (large_pages)
+		_paging_map_linear_pse();
+	else
+		_paging_map_linear_tables();
+
+	// Every kernel entry has `global` set, but the CPU ignores it unless
+	//  CR4.PGE is set. With it set, switching page directories no longer
+	//  throws away the kernel's TLB entries. Setting it also flushes the TLB.
+	if (cpu_info.features_edx & CPUID_EDX_PGE) {
+		write_cr4(read_cr4() | CR4_PGE);
+		paging_pge_enabled = true;
 	}
 
 	// Update the current paging directory to the kernel PGD, and we've got
 	//  paging set up!
 	paging_change_pgd(kernel_pgd);
+
+	// The MTRRs leave video memory uncached, so every write to it goes out on
+	//  its own. Mapped write-combining, writes are merged into bursts instead.
+	if (paging_pat_enabled) {
+		paging_map_range(
+			kernel_pgd, (uintptr_t)__to_virt(VIDEO_MEMORY_START), VIDEO_MEMORY_START,
+			(VIDEO_MEMORY_END - VIDEO_MEMORY_START) / PAGE_SIZE, PAGE_KERNEL, PAGE_CACHE_WC);
+		wbinvd();
+	}
 	klog_debug(
-		"Initialised linear mapping 0x%p to 0x%p\n",
-		__to_virt(0), __to_virt(ZONE_HIGHMEM_OFFSET));
+		"Initialised linear mapping 0x%p to 0x%p%s\n",
+		__to_virt(0), __to_virt(ZONE_HIGHMEM_OFFSET),
+		paging_pse_enabled ? (PAGING_PAE ? " with 2 MiB pages" : " with 4 MiB pages") : "");
+}
+
+uintptr_t paging_boot_mapped_end() {
+	if (PAGING_PAE || (cpu_info.features_edx & CPUID_EDX_PSE))
+		return ZONE_HIGHMEM_OFFSET;
+	return BOOT_TABLES_MAPPED_SIZE;
 }
 
 void invalidate_page(void* vaddr) {
@@ -87,12 +169,385 @@ void invalidate_page(void* vaddr) {
 }
 
 void paging_change_pgd(PDE_t* pgd) {
+	current_pgd = pgd;
+#if PAGING_PAE
+	// Point the PDPT at each of the directories making up `pgd`. The CPU only
+	//  reads the PDPTEs when CR3 is loaded, so changing them here is safe.
+	for (uint32_t i = 0; i < PTRS_PER_PDPTE; ++i)
+		kernel_pdpt[i].raw = (__to_phys(pgd) + i * PAGE_SIZE) | PDPTE_PRESENT;
+	uint32_t cr3 = (uint32_t)__to_phys(kernel_pdpt);
+#else
 	// We don't use the PWT or PCD bits. By setting CR3 to the address of the
 	//  given directory, we set the 20 most sig bits to (address >> PAGE_SHIFT).
 	uint32_t cr3 = (uint32_t)__to_phys(pgd);
+#endif
 	asm volatile ("mov %0, %%cr3" : : "a"(cr3) : "memory");
 }
 
+void paging_flush_tlb_user() {
+	// Writing CR3 flushes every entry that isn't marked global
+	uint32_t cr3;
+	asm volatile ("mov %%cr3, %0" : "=r"(cr3));
+	asm volatile ("mov %0, %%cr3" : : "r"(cr3) : "memory");
+}
+
+void paging_flush_tlb_all() {
+	// Without global pages, a CR3 reload already flushes everything
+	if (!paging_pge_enabled) {
+		paging_flush_tlb_user();
+		return;
+	}
+
+	// Any write to CR4 that changes PGE flushes the entire TLB, including
+	//  global entries. Clear it and set it again.
+	uint32_t cr4 = read_cr4();
+	write_cr4(cr4 & ~CR4_PGE);
+	write_cr4(cr4);
+}
+
+bool paging_map_range(PDE_t* pgd, uintptr_t vaddr, phys_addr_t paddr, uint32_t npages, paging_entry_t flags, enum page_cache cache) {
+	// The NX bit is reserved unless execute-disable is enabled
+	if (!paging_nx_enabled)
+		flags &= ~(paging_entry_t)PTE_NX;
+	flags = (flags & ~(paging_entry_t)(PTE_PAT | PTE_PCD | PTE_PWT)) | _paging_cache_bits[cache];
+
+	paging_gather_t gather;
+	paging_gather_init(&gather, pgd);
+
+	bool mapped = true;
+	paging_entry_t entry = paddr | flags;
+	while (npages > 0) {
+		PTE_t* table = _paging_get_table(pgd, vaddr, true);
+		if (table == NULL) {
+			mapped = false;
+			break;
+		}
+
+		// Fill in as much of this table as the range covers
+		uint32_t index = (vaddr >> PAGE_SHIFT) & (PTRS_PER_PTE - 1);
+		uint32_t count = PTRS_PER_PTE - index;
+		if (count > npages)
+			count = npages;
+		for (uint32_t i = 0; i < count; ++i) {
+			paging_entry_t old = table[index + i].raw;
+			if (old & PTE_PRESENT)
+				paging_gather_add(&gather, vaddr + i * PAGE_SIZE, old);
+			table[index + i].raw = entry;
+			entry += PAGE_SIZE;
+		}
+
+		vaddr += count * PAGE_SIZE;
+		npages -= count;
+	}
+
+	paging_gather_flush(&gather);
+	return mapped;
+}
+
+void paging_unmap_range(PDE_t* pgd, uintptr_t vaddr, uint32_t npages) {
+	paging_gather_t gather;
+	paging_gather_init(&gather, pgd);
+	paging_unmap_range_gather(pgd, vaddr, npages, &gather);
+	paging_gather_flush(&gather);
+}
+
+void paging_unmap_range_gather(PDE_t* pgd, uintptr_t vaddr, uint32_t npages, paging_gather_t* gather) {
+	while (npages > 0) {
+		// Skip over any part of the range without a page table
+		uint32_t index = (vaddr >> PAGE_SHIFT) & (PTRS_PER_PTE - 1);
+		uint32_t count = PTRS_PER_PTE - index;
+		if (count > npages)
+			count = npages;
+
+		PTE_t* table = _paging_get_table(pgd, vaddr, false);
+		for (uint32_t i = 0; table != NULL && i < count; ++i) {
+			paging_entry_t old = table[index + i].raw;
+			if (old & PTE_PRESENT)
+				paging_gather_add(gather, vaddr + i * PAGE_SIZE, old);
+			table[index + i].raw = 0;
+		}
+
+		vaddr += count * PAGE_SIZE;
+		npages -= count;
+	}
+}
+
+PTE_t* paging_get_pte(PDE_t* pgd, uintptr_t vaddr, bool alloc) {
+	PTE_t* table = _paging_get_table(pgd, vaddr, alloc);
+	if (table == NULL)
+		return NULL;
+	return &table[(vaddr >> PAGE_SHIFT) & (PTRS_PER_PTE - 1)];
+}
+
+bool paging_map_anon(PDE_t* pgd, uintptr_t vaddr, uint32_t npages, paging_entry_t flags) {
+	// Nothing is present, so the entries hold the flags for the page fault
+	//  handler to map each page with once it's allocated
+	if (!paging_nx_enabled)
+		flags &= ~(paging_entry_t)PTE_NX;
+	paging_entry_t entry = (flags & ~(paging_entry_t)(PTE_PRESENT | PTE_PAT | PTE_PCD | PTE_PWT | PTE_COW)) | PTE_ANON;
+
+	while (npages > 0) {
+		uint32_t index = (vaddr >> PAGE_SHIFT) & (PTRS_PER_PTE - 1);
+		uint32_t count = PTRS_PER_PTE - index;
+		if (count > npages)
+			count = npages;
+
+		// A whole table's worth of pages needs no table until one is touched
+		PDE_t* pde = &pgd[vaddr >> PGDIR_SHIFT];
+		if (count == PTRS_PER_PTE && !pde->present)
+			pde->raw = entry;
+		else {
+			PTE_t* table = _paging_get_table(pgd, vaddr, true);
+			if (table == NULL)
+				return false;
+			for (uint32_t i = 0; i < count; ++i)
+				table[index + i].raw = entry;
+		}
+
+		vaddr += count * PAGE_SIZE;
+		npages -= count;
+	}
+	return true;
+}
+
+bool paging_share_anon(PDE_t* pgd, uintptr_t dest, uintptr_t src, uint32_t npages) {
+	paging_gather_t gather;
+	paging_gather_init(&gather, pgd);
+
+	bool shared = true;
+	for (uint32_t i = 0; i < npages; ++i) {
+		PTE_t* from = paging_get_pte(pgd, src + i * PAGE_SIZE, true);
+		PTE_t* to = paging_get_pte(pgd, dest + i * PAGE_SIZE, true);
+		if (from == NULL || to == NULL) {
+			shared = false;
+			break;
+		}
+
+		// Write-protect the frame at the source too, so whichever mapping is
+		//  written first gets its own copy
+		PTE_t entry = *from;
+		if (entry.present && (entry.raw & PTE_ANON)) {
+			if (entry.rw) {
+				paging_gather_add(&gather, src + i * PAGE_SIZE, entry.raw);
+				entry.rw = 0;
+				entry.raw |= PTE_COW;
+				*from = entry;
+			}
+			++pfn_to_page(entry.addr)->refcount;
+		}
+		else if (!(entry.raw & PTE_ANON))
+			entry.raw = 0;
+		*to = entry;
+	}
+
+	paging_gather_flush(&gather);
+	return shared;
+}
+
+void paging_unmap_anon(PDE_t* pgd, uintptr_t vaddr, uint32_t npages) {
+	paging_gather_t gather;
+	paging_gather_init(&gather, pgd);
+
+	// A frame can't be reused while a TLB entry may still point at it, so the
+	//  ones to free are chained through their descriptors until the flush
+	page_t* freed = NULL;
+	while (npages > 0) {
+		uint32_t index = (vaddr >> PAGE_SHIFT) & (PTRS_PER_PTE - 1);
+		uint32_t count = PTRS_PER_PTE - index;
+		if (count > npages)
+			count = npages;
+
+		// A table that was never allocated has nothing to free. Part of one
+		//  still needs its table, to keep the rest demand-zero.
+		PDE_t* pde = &pgd[vaddr >> PGDIR_SHIFT];
+		PTE_t* table = NULL;
+		if (count == PTRS_PER_PTE && !pde->present)
+			pde->raw = 0;
+		else if (pde->present || (pde->raw & PDE_ANON))
+			table = _paging_get_table(pgd, vaddr, true);
+
+		for (uint32_t i = 0; table != NULL && i < count; ++i) {
+			PTE_t entry = table[index + i];
+			table[index + i].raw = 0;
+			if (!entry.present)
+				continue;
+
+			paging_gather_add(&gather, vaddr + i * PAGE_SIZE, entry.raw);
+			if (entry.raw & PTE_ANON) {
+				page_t* page = pfn_to_page(entry.addr);
+				if (--page->refcount == 0) {
+					page->next = freed;
+					freed = page;
+				}
+			}
+		}
+
+		vaddr += count * PAGE_SIZE;
+		npages -= count;
+	}
+
+	paging_gather_flush(&gather);
+	while (freed != NULL) {
+		page_t* page = freed;
+		freed = page->next;
+		page_free_pfn(page_to_pfn(page), 0);
+	}
+}
+
+void paging_gather_init(paging_gather_t* gather, PDE_t* pgd) {
+	gather->pgd = pgd;
+	gather->start = 0;
+	gather->last = 0;
+	gather->count = 0;
+	gather->global = false;
+}
+
+void paging_gather_add(paging_gather_t* gather, uintptr_t vaddr, paging_entry_t old) {
+	vaddr &= PAGE_MASK;
+	if (gather->count == 0 || vaddr < gather->start)
+		gather->start = vaddr;
+	if (gather->count == 0 || vaddr > gather->last)
+		gather->last = vaddr;
+	if (old & PTE_GLOBAL)
+		gather->global = true;
+	++gather->count;
+}
+
+void paging_gather_flush(paging_gather_t* gather) {
+	if (gather->count == 0)
+		return;
+
+	// Without PCIDs, the TLB only holds entries for the loaded directory, and
+	//  the kernel mapping it shares with every other directory.
+	if (gather->pgd != current_pgd && gather->last < PAGE_OFFSET) {
+		paging_gather_init(gather, gather->pgd);
+		return;
+	}
+
+	// A few pages are cheapest to invalidate one at a time. `invlpg` also
+	//  removes global entries. Past that, throw away the whole TLB, as the
+	//  entries are refilled on demand anyway.
+	uint32_t pages = ((gather->last - gather->start) >> PAGE_SHIFT) + 1;
+	if (pages <= PAGING_GATHER_INVLPG_MAX) {
+		for (uint32_t i = 0; i < pages; ++i)
+			invalidate_page((void*)(gather->start + i * PAGE_SIZE));
+	}
+	else if (gather->global)
+		paging_flush_tlb_all();
+	else
+		paging_flush_tlb_user();
+
+	paging_gather_init(gather, gather->pgd);
+}
+
+void _paging_map_linear_pse() {
+	// `boot.S` already set CR4.PSE without PAE, and pointed each PDE after the
+	//  first 8 MiB at a large page. Give back the page tables it would have
+	//  used otherwise.
+	paging_pse_enabled = true;
+	if (!PAGING_PAE) {
+		bootmem_free(
+			__to_phys(&_kernel_pg0[BOOT_MAPPED_SIZE / PAGE_SIZE]),
+			(BOOT_TABLES_MAPPED_SIZE - BOOT_MAPPED_SIZE) / PAGE_SIZE * sizeof(PTE_t));
+	}
+
+	// Rewrite each of those PDEs, up to the end of ZONE_NORMAL, as global and
+	//  not executable.
+	paging_entry_t flags = PDE_PRESENT | PDE_RW | PDE_PAGE_SIZE | PTE_GLOBAL;
+	if (paging_nx_enabled)
+		flags |= PTE_NX;
+	uint32_t pde_offset = PAGE_OFFSET >> PGDIR_SHIFT; // PDE kernel-space offset
+	uint32_t total_pdes = ZONE_HIGHMEM_OFFSET >> PGDIR_SHIFT;
+	for (uint32_t i = BOOT_MAPPED_SIZE >> PGDIR_SHIFT; i < total_pdes; ++i)
+		kernel_pgd[pde_offset + i].raw = ((phys_addr_t)i << PGDIR_SHIFT) | flags;
+}
+
+void _paging_map_linear_tables() {
+	// Map the rest of low memory past what `boot.S` mapped. Page tables are
+	//  allocated one at a time from the start of ZONE_NORMAL as mapping goes
+	//  along. They're allocated from low addresses up, so each is already
+	//  mapped.
+	uint32_t npages = (ZONE_HIGHMEM_OFFSET - BOOT_TABLES_MAPPED_SIZE) / PAGE_SIZE;
+	uintptr_t vaddr = (uintptr_t)__to_virt(BOOT_TABLES_MAPPED_SIZE);
+	if (!paging_map_range(kernel_pgd, vaddr, BOOT_TABLES_MAPPED_SIZE, npages, PAGE_KERNEL, PAGE_CACHE_WB))
+		panic("Failed to map low memory");
+}
+
+void _paging_initialise_pat() {
+	// Entries 0 - 3 are what a PTE without the PAT bit selects, so WB, UC-,
+	//  and UC keep the same PCD/PWT bits as before the PAT was programmed.
+	//  WC replaces WT as entry 1, as framebuffers are more common.
+	uint8_t pat[8] = {
+		PAT_WB, PAT_WC, PAT_UC_MINUS, PAT_UC,
+		PAT_WB, PAT_WP, PAT_UC_MINUS, PAT_WT,
+	};
+	uint64_t value = 0;
+	for (uint32_t i = 0; i < 8; ++i)
+		value |= (uint64_t)pat[i] << (i * 8);
+	wrmsr(MSR_PAT, value);
+
+	_paging_cache_bits[PAGE_CACHE_WC] = PTE_PWT;
+	_paging_cache_bits[PAGE_CACHE_WP] = PTE_PAT | PTE_PWT;
+	_paging_cache_bits[PAGE_CACHE_WT] = PTE_PAT | PTE_PCD | PTE_PWT;
+	paging_pat_enabled = true;
+
+	// Nothing is mapped with entry 1 yet, but flush anything cached under it
+	wbinvd();
+}
+
+PTE_t* _paging_get_table(PDE_t* pgd, uintptr_t vaddr, bool alloc) {
+	PDE_t* pde = &pgd[vaddr >> PGDIR_SHIFT];
+	if (pde->present && pde->page_size) {
+		klog_warning("paging: 0x%p is mapped by a large page\n", vaddr);
+		return NULL;
+	}
+	if (pde->present)
+		return (PTE_t*)__to_virt(PFN_PHYS(pde->addr));
+	if (!alloc)
+		return NULL;
+
+	// Add a new empty page table. User-space tables are left accessible to
+	//  user mode, and each PTE decides for itself.
+	PTE_t* table = _paging_alloc_table();
+	if (table == NULL) {
+		klog_warning("paging: No memory for a page table\n");
+		return NULL;
+	}
+
+	// A table for a range from `paging_map_anon` starts out with every page
+	//  still to be allocated on demand
+	if (pde->raw & PDE_ANON) {
+		for (uint32_t i = 0; i < PTRS_PER_PTE; ++i)
+			table[i].raw = pde->raw;
+	}
+
+	paging_entry_t flags = PDE_PRESENT | PDE_RW;
+	if (vaddr < PAGE_OFFSET)
+		flags |= PDE_USER;
+	pde->raw = __to_phys(table) | flags;
+	return table;
+}
+
+PTE_t* _paging_alloc_table() {
+	// While the boot allocator is still in charge of memory, take tables from
+	//  the bottom of ZONE_NORMAL, which `boot.S` always maps. ZONE_DMA is left
+	//  for devices, unless there's no other memory.
+	if (bootmem_data.bitmap != NULL) {
+		PTE_t* table = (memblock_end_of_ram() > ZONE_NORMAL_OFFSET)
+			? (PTE_t*)bootmem_aligned_alloc(PAGE_SIZE)
+			: (PTE_t*)bootmem_aligned_alloc_low(PAGE_SIZE);
+		if (table != NULL)
+			clear_page(table);
+		return table;
+	}
+
+	// Otherwise, take one zeroed while idle if there are any
+	uint32_t pfn = page_alloc_pfn(0, GFP_KERNEL | GFP_ZERO);
+	if (pfn == PAGE_PFN_NONE)
+		return NULL;
+	return (PTE_t*)__to_virt(PFN_PHYS(pfn));
+}
+
 int _kernel_image_pfn_rw_permission(uint32_t pfn) {
 	uintptr_t paddr = pfn << PAGE_SHIFT;
 
@@ -113,3 +568,13 @@ int _kernel_image_pfn_rw_permission(uint32_t pfn) {
 	// Any address outside of the kernel image is free for writing
 	return 1;
 }
+
+int _kernel_image_pfn_executable(uint32_t pfn) {
+	uintptr_t paddr = pfn << PAGE_SHIFT;
+
+	// Only the read-only region of the kernel image holds code (.text, along
+	//  with .rodata). Everything else, including the real mode address space,
+	//  is data.
+	return paddr >= (uintptr_t)&_paddr_kernel_start
+		&& paddr < (uintptr_t)&_paddr_kernel_ro_end;
+}
@@ -0,0 +1,278 @@
+/// @file rbtree.c
+
+#include <namuos/rbtree.h> // Implements
+
+
+// Points whatever pointed at `old` (its parent's child, or the root) at `new`.
+//  `old` must still have its parent.
+void _rb_replace_child(rb_root_t* root, rb_node_t* old, rb_node_t* new);
+
+// Rotates `node` down to the left or right, moving its right or left child up
+//  into its place. Updates both nodes' subtree data.
+void _rb_rotate_left(rb_root_t* root, rb_node_t* node);
+void _rb_rotate_right(rb_root_t* root, rb_node_t* node);
+
+// Updates the subtree data of `node` and every ancestor, all the way up. Used
+//  where moving nodes could leave an ancestor wrong even if its child's data
+//  is unchanged.
+void _rb_propagate_all(rb_root_t* root, rb_node_t* node);
+
+// Restores the red-black properties after a red `node` is linked in
+void _rb_insert_fixup(rb_root_t* root, rb_node_t* node);
+
+// Restores the red-black properties after a black node is removed from under
+//  `parent`, leaving `node` (possibly NULL) in its place
+void _rb_erase_fixup(rb_root_t* root, rb_node_t* node, rb_node_t* parent);
+
+
+void rb_insert(rb_root_t* root, rb_node_t* node, rb_node_t* parent, rb_node_t** link) {
+	node->parent = parent;
+	node->left = NULL;
+	node->right = NULL;
+	node->red = true;
+	*link = node;
+
+	if (root->augment != NULL) {
+		root->augment(node);
+		if (parent != NULL)
+			rb_propagate(root, parent);
+	}
+	_rb_insert_fixup(root, node);
+}
+
+void rb_erase(rb_root_t* root, rb_node_t* node) {
+	// Find the node taking its place, and the lowest node whose subtree changed
+	rb_node_t* child;
+	rb_node_t* parent;
+	bool red;
+	if (node->left == NULL || node->right == NULL) {
+		child = (node->left != NULL) ? node->left : node->right;
+		parent = node->parent;
+		red = node->red;
+		if (child != NULL)
+			child->parent = parent;
+		_rb_replace_child(root, node, child);
+	}
+	else {
+		// Move the successor, which has no left child, up into its place
+		rb_node_t* succ = node->right;
+		while (succ->left != NULL)
+			succ = succ->left;
+		child = succ->right;
+		red = succ->red;
+		if (succ->parent == node)
+			parent = succ;
+		else {
+			parent = succ->parent;
+			parent->left = child;
+			if (child != NULL)
+				child->parent = parent;
+			succ->right = node->right;
+			node->right->parent = succ;
+		}
+		succ->left = node->left;
+		node->left->parent = succ;
+		succ->red = node->red;
+		succ->parent = node->parent;
+		_rb_replace_child(root, node, succ);
+	}
+
+	if (root->augment != NULL && parent != NULL)
+		_rb_propagate_all(root, parent);
+	if (!red)
+		_rb_erase_fixup(root, child, parent);
+}
+
+void rb_propagate(rb_root_t* root, rb_node_t* node) {
+	while (node != NULL && root->augment(node))
+		node = node->parent;
+}
+
+rb_node_t* rb_first(const rb_root_t* root) {
+	rb_node_t* node = root->node;
+	if (node == NULL)
+		return NULL;
+	while (node->left != NULL)
+		node = node->left;
+	return node;
+}
+
+rb_node_t* rb_next(const rb_node_t* node) {
+	if (node->right != NULL) {
+		node = node->right;
+		while (node->left != NULL)
+			node = node->left;
+		return (rb_node_t*)node;
+	}
+	while (node->parent != NULL && node == node->parent->right)
+		node = node->parent;
+	return node->parent;
+}
+
+rb_node_t* rb_prev(const rb_node_t* node) {
+	if (node->left != NULL) {
+		node = node->left;
+		while (node->right != NULL)
+			node = node->right;
+		return (rb_node_t*)node;
+	}
+	while (node->parent != NULL && node == node->parent->left)
+		node = node->parent;
+	return node->parent;
+}
+
+void _rb_replace_child(rb_root_t* root, rb_node_t* old, rb_node_t* new) {
+	rb_node_t* parent = old->parent;
+	if (parent == NULL)
+		root->node = new;
+	else if (parent->left == old)
+		parent->left = new;
+	else
+		parent->right = new;
+}
+
+void _rb_rotate_left(rb_root_t* root, rb_node_t* node) {
+	rb_node_t* up = node->right;
+	node->right = up->left;
+	if (up->left != NULL)
+		up->left->parent = node;
+	_rb_replace_child(root, node, up);
+	up->parent = node->parent;
+	up->left = node;
+	node->parent = up;
+
+	// Only the two nodes' subtrees changed, so their ancestors are still right
+	if (root->augment != NULL) {
+		root->augment(node);
+		root->augment(up);
+	}
+}
+
+void _rb_rotate_right(rb_root_t* root, rb_node_t* node) {
+	rb_node_t* up = node->left;
+	node->left = up->right;
+	if (up->right != NULL)
+		up->right->parent = node;
+	_rb_replace_child(root, node, up);
+	up->parent = node->parent;
+	up->right = node;
+	node->parent = up;
+
+	if (root->augment != NULL) {
+		root->augment(node);
+		root->augment(up);
+	}
+}
+
+void _rb_propagate_all(rb_root_t* root, rb_node_t* node) {
+	for (; node != NULL; node = node->parent)
+		root->augment(node);
+}
+
+void _rb_insert_fixup(rb_root_t* root, rb_node_t* node) {
+	rb_node_t* parent;
+	while ((parent = node->parent) != NULL && parent->red) {
+		// The root is black, so a red parent always has a parent of its own
+		rb_node_t* gparent = parent->parent;
+		if (parent == gparent->left) {
+			rb_node_t* uncle = gparent->right;
+			if (uncle != NULL && uncle->red) {
+				parent->red = false;
+				uncle->red = false;
+				gparent->red = true;
+				node = gparent;
+				continue;
+			}
+			if (node == parent->right) {
+				_rb_rotate_left(root, parent);
+				node = parent;
+				parent = node->parent;
+			}
+			parent->red = false;
+			gparent->red = true;
+			_rb_rotate_right(root, gparent);
+		}
+		else {
+			rb_node_t* uncle = gparent->left;
+			if (uncle != NULL && uncle->red) {
+				parent->red = false;
+				uncle->red = false;
+				gparent->red = true;
+				node = gparent;
+				continue;
+			}
+			if (node == parent->left) {
+				_rb_rotate_right(root, parent);
+				node = parent;
+				parent = node->parent;
+			}
+			parent->red = false;
+			gparent->red = true;
+			_rb_rotate_left(root, gparent);
+		}
+	}
+	root->node->red = false;
+}
+
+void _rb_erase_fixup(rb_root_t* root, rb_node_t* node, rb_node_t* parent) {
+	// `node` is short one black node on its path. Its sibling can't be NULL,
+	//  as the sibling's side had the removed black node's share too.
+	while (node != root->node && (node == NULL || !node->red)) {
+		if (node == parent->left) {
+			rb_node_t* sibling = parent->right;
+			if (sibling->red) {
+				sibling->red = false;
+				parent->red = true;
+				_rb_rotate_left(root, parent);
+				sibling = parent->right;
+			}
+			if ((sibling->left == NULL || !sibling->left->red)
+				&& (sibling->right == NULL || !sibling->right->red)) {
+				sibling->red = true;
+				node = parent;
+				parent = node->parent;
+				continue;
+			}
+			if (sibling->right == NULL || !sibling->right->red) {
+				sibling->left->red = false;
+				sibling->red = true;
+				_rb_rotate_right(root, sibling);
+				sibling = parent->right;
+			}
+			sibling->red = parent->red;
+			parent->red = false;
+			sibling->right->red = false;
+			_rb_rotate_left(root, parent);
+		}
+		else {
+			rb_node_t* sibling = parent->left;
+			if (sibling->red) {
+				sibling->red = false;
+				parent->red = true;
+				_rb_rotate_right(root, parent);
+				sibling = parent->left;
+			}
+			if ((sibling->left == NULL || !sibling->left->red)
+				&& (sibling->right == NULL || !sibling->right->red)) {
+				sibling->red = true;
+				node = parent;
+				parent = node->parent;
+				continue;
+			}
+			if (sibling->left == NULL || !sibling->left->red) {
+				sibling->right->red = false;
+				sibling->red = true;
+				_rb_rotate_left(root, sibling);
+				sibling = parent->left;
+			}
+			sibling->red = parent->red;
+			parent->red = false;
+			sibling->left->red = false;
+			_rb_rotate_right(root, parent);
+		}
+		node = root->node;
+		break;
+	}
+	if (node != NULL)
+		node->red = false;
+}
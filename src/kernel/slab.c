@@ -0,0 +1,376 @@
+/// @file slab.c
+
+#include <namuos/slab.h> // Implements
+
+#include <string.h> // memset
+#include <namuos/page_allocator.h>
+#include <namuos/paging.h>
+#include <namuos/panic.h>
+#include <namuos/terminal.h>
+
+
+// Cache the other caches are allocated from
+static kmem_cache_t _cache_cache;
+
+// List of every cache, for reaping and stats
+static kmem_cache_t* _caches;
+static spinlock_t _caches_lock = SPINLOCK_INIT;
+
+// Fills in `cache` and works out its slab layout. Returns false if objects of
+//  `size` are too large for a slab.
+bool _cache_setup(kmem_cache_t* cache, const char* name, uint32_t size, uint32_t align, kmem_ctor_t ctor);
+
+// Allocates a new slab for `cache`, constructing each of its objects. Returns
+//  its first page, or NULL if the page allocator has no memory. Doesn't need
+//  the cache lock, as nothing else can see the slab until it's on a list.
+page_t* _slab_create(kmem_cache_t* cache);
+
+// Gives the pages of an empty slab back to the page allocator
+void _slab_destroy(kmem_cache_t* cache, page_t* slab);
+
+// Takes an object from the slabs of `cache`, creating a slab if there are no
+//  free objects. `cache` must be locked, but is unlocked while creating a slab.
+void* _slab_alloc_object(kmem_cache_t* cache);
+
+// Puts an object back in its slab, freeing the slab if it becomes empty and
+//  the cache already has enough empty slabs. `cache` must be locked.
+void _slab_free_object(kmem_cache_t* cache, void* object);
+
+// Gets the first page of the slab holding `object`, or panics if it isn't an
+//  object from `cache`
+page_t* _object_slab(kmem_cache_t* cache, void* object);
+
+// Gets the address of the first object in `slab`
+uint8_t* _slab_objects(kmem_cache_t* cache, page_t* slab);
+
+// Gets the stack of free object indices at the start of `slab`
+uint16_t* _slab_free_stack(page_t* slab);
+
+// Gets the list `slab` belongs on, going by how many of its objects are in use
+page_t** _slab_list(kmem_cache_t* cache, page_t* slab);
+
+// Helpers to add or remove a slab from one of the slab lists of a cache
+void _slab_list_add(page_t** list, page_t* slab);
+void _slab_list_remove(page_t** list, page_t* slab);
+
+// Fills the magazine `mag` with up to @ref SLAB_MAGAZINE_BATCH objects
+void _magazine_refill(kmem_cache_t* cache, kmem_magazine_t* mag);
+
+// Puts the `count` coldest objects in `mag` back in their slabs
+void _magazine_flush(kmem_cache_t* cache, kmem_magazine_t* mag, uint32_t count);
+
+
+void slab_initialise() {
+	if (!_cache_setup(&_cache_cache, "kmem_cache", sizeof(kmem_cache_t), __alignof__(kmem_cache_t), NULL))
+		panic("slab_initialise: Can't set up kmem_cache cache\n");
+	_caches = &_cache_cache;
+}
+
+kmem_cache_t* kmem_cache_create(const char* name, uint32_t size, uint32_t align, kmem_ctor_t ctor) {
+	kmem_cache_t* cache = (kmem_cache_t*)kmem_cache_alloc(&_cache_cache);
+	if (cache == NULL)
+		return NULL;
+	if (!_cache_setup(cache, name, size, align, ctor)) {
+		kmem_cache_free(&_cache_cache, cache);
+		return NULL;
+	}
+
+	spin_lock(&_caches_lock);
+	cache->next = _caches;
+	_caches = cache;
+	spin_unlock(&_caches_lock);
+	return cache;
+}
+
+void kmem_cache_destroy(kmem_cache_t* cache) {
+	kmem_cache_shrink(cache);
+	if (cache->nr_active != 0)
+		klog_warning(
+			"kmem_cache_destroy: Leaking %d objects still in use in %s\n",
+			cache->nr_active, cache->name);
+
+	spin_lock(&_caches_lock);
+	for (kmem_cache_t** i = &_caches; *i != NULL; i = &(*i)->next) {
+		if (*i == cache) {
+			*i = cache->next;
+			break;
+		}
+	}
+	spin_unlock(&_caches_lock);
+
+	kmem_cache_free(&_cache_cache, cache);
+}
+
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+	kmem_magazine_t* mag = &cache->magazines[smp_processor_id()];
+	if (mag->count == 0) {
+		_magazine_refill(cache, mag);
+		if (mag->count == 0) {
+			klog_warning("kmem_cache_alloc: Not enough memory for %s\n", cache->name);
+			return NULL;
+		}
+	}
+	return mag->objects[--mag->count];
+}
+
+void kmem_cache_free(kmem_cache_t* cache, void* object) {
+	if (object == NULL)
+		return;
+
+	kmem_magazine_t* mag = &cache->magazines[smp_processor_id()];
+	if (mag->count == SLAB_MAGAZINE_SIZE)
+		_magazine_flush(cache, mag, SLAB_MAGAZINE_BATCH);
+	mag->objects[mag->count++] = object;
+}
+
+uint32_t kmem_cache_shrink(kmem_cache_t* cache) {
+	// Only the boot CPU runs for now, so every magazine can be flushed from
+	//  here
+	for (uint32_t cpu = 0; cpu < NR_CPUS; ++cpu)
+		_magazine_flush(cache, &cache->magazines[cpu], cache->magazines[cpu].count);
+
+	uint32_t freed = 0;
+	spin_lock(&cache->lock);
+	while (cache->slabs_empty != NULL) {
+		page_t* slab = cache->slabs_empty;
+		_slab_list_remove(&cache->slabs_empty, slab);
+		--cache->nr_empty;
+		_slab_destroy(cache, slab);
+		freed += 1U << cache->order;
+	}
+	spin_unlock(&cache->lock);
+	return freed;
+}
+
+uint32_t slab_reap() {
+	uint32_t freed = 0;
+	spin_lock(&_caches_lock);
+	for (kmem_cache_t* cache = _caches; cache != NULL; cache = cache->next)
+		freed += kmem_cache_shrink(cache);
+	spin_unlock(&_caches_lock);
+	return freed;
+}
+
+void slab_dump_stats() {
+	klog_info("slab allocator:\n");
+	spin_lock(&_caches_lock);
+	for (kmem_cache_t* cache = _caches; cache != NULL; cache = cache->next) {
+		uint32_t cached = 0;
+		for (uint32_t cpu = 0; cpu < NR_CPUS; ++cpu)
+			cached += cache->magazines[cpu].count;
+		klog_info(
+			"  %s: %d objects of %d bytes in use, %d in magazines, %d slabs of %d pages (%d empty), %d per slab, %d colours\n",
+			cache->name, cache->nr_active - cached, cache->object_size, cached,
+			cache->nr_slabs, 1U << cache->order, cache->nr_empty,
+			cache->objects_per_slab, cache->colours);
+	}
+	spin_unlock(&_caches_lock);
+}
+
+bool _cache_setup(kmem_cache_t* cache, const char* name, uint32_t size, uint32_t align, kmem_ctor_t ctor) {
+	if (align == 0)
+		align = sizeof(void*);
+	if (size == 0 || (align & (align - 1)) != 0) {
+		klog_warning("kmem_cache_create: Bad size %d or alignment %d for %s\n", size, align, name);
+		return false;
+	}
+
+	memset(cache, 0, sizeof(kmem_cache_t));
+	cache->name = name;
+	cache->object_size = size;
+	cache->size = (size + align - 1) & ~(align - 1);
+	cache->align = align;
+	cache->ctor = ctor;
+	spin_lock_init(&cache->lock);
+
+	// Use the smallest slab that holds enough objects. Each object needs a
+	//  16-bit slot in the free stack as well as its own space.
+	uint32_t count = 0, offset = 0;
+	for (cache->order = 0; cache->order <= SLAB_MAX_ORDER; ++cache->order) {
+		uint32_t slab_size = PAGE_SIZE << cache->order;
+		count = slab_size / (cache->size + sizeof(uint16_t));
+		offset = (count * sizeof(uint16_t) + align - 1) & ~(align - 1);
+		while (count > 0 && offset + count * cache->size > slab_size) {
+			--count;
+			offset = (count * sizeof(uint16_t) + align - 1) & ~(align - 1);
+		}
+		if (count >= SLAB_MIN_OBJECTS || cache->order == SLAB_MAX_ORDER)
+			break;
+	}
+	if (count == 0) {
+		klog_warning("kmem_cache_create: Objects of %d bytes too large for %s\n", size, name);
+		return false;
+	}
+	cache->objects_per_slab = count;
+	cache->objects_offset = offset;
+
+	// Colour with whatever's left at the end of the slab, a cache line (or
+	//  the alignment, if larger) at a time
+	uint32_t colour_step = (align > cpu_info.cache_line_size) ? align : cpu_info.cache_line_size;
+	uint32_t leftover = (PAGE_SIZE << cache->order) - offset - count * cache->size;
+	cache->colours = leftover / colour_step + 1;
+	return true;
+}
+
+page_t* _slab_create(kmem_cache_t* cache) {
+	uint8_t* base = (uint8_t*)page_alloc(cache->order);
+	if (base == NULL)
+		return NULL;
+
+	// Every page of the slab points back to the cache, so any object can be
+	//  checked against it
+	page_t* slab = virt_to_page(base);
+	for (uint32_t i = 0; i < (1U << cache->order); ++i) {
+		slab[i].flags |= PG_SLAB;
+		slab[i].owner = cache;
+	}
+	slab->index = 0;
+
+	// Colour offsets go round in turn, but this isn't under the cache lock,
+	//  so a race only ever gives two slabs the same colour
+	uint32_t colour_step = (cache->align > cpu_info.cache_line_size) ? cache->align : cpu_info.cache_line_size;
+	uint32_t colour = cache->colour_next;
+	cache->colour_next = (colour + 1) % cache->colours;
+	slab->data = colour * colour_step;
+
+	// Objects are handed out from the top of the stack, lowest index first
+	uint16_t* free_stack = _slab_free_stack(slab);
+	uint8_t* objects = _slab_objects(cache, slab);
+	for (uint32_t i = 0; i < cache->objects_per_slab; ++i) {
+		free_stack[i] = cache->objects_per_slab - 1 - i;
+		if (cache->ctor != NULL)
+			cache->ctor(objects + i * cache->size);
+	}
+	return slab;
+}
+
+void _slab_destroy(kmem_cache_t* cache, page_t* slab) {
+	for (uint32_t i = 0; i < (1U << cache->order); ++i) {
+		slab[i].flags &= ~PG_SLAB;
+		slab[i].owner = NULL;
+	}
+	--cache->nr_slabs;
+	page_free(page_to_virt(slab), cache->order);
+}
+
+void* _slab_alloc_object(kmem_cache_t* cache) {
+	page_t* slab = cache->slabs_partial;
+	if (slab == NULL && cache->slabs_empty != NULL) {
+		slab = cache->slabs_empty;
+		--cache->nr_empty;
+	}
+	if (slab == NULL) {
+		// Creating a slab can end up reaping this cache if the page
+		//  allocator is out of memory, so don't hold the lock for it
+		spin_unlock(&cache->lock);
+		slab = _slab_create(cache);
+		spin_lock(&cache->lock);
+		if (slab == NULL)
+			return NULL;
+		++cache->nr_slabs;
+	}
+	else
+		_slab_list_remove(_slab_list(cache, slab), slab);
+
+	uint32_t free = cache->objects_per_slab - slab->index;
+	uint16_t index = _slab_free_stack(slab)[free - 1];
+	++slab->index;
+	++cache->nr_active;
+	_slab_list_add(_slab_list(cache, slab), slab);
+	return _slab_objects(cache, slab) + index * cache->size;
+}
+
+void _slab_free_object(kmem_cache_t* cache, void* object) {
+	page_t* slab = _object_slab(cache, object);
+	uint32_t index = ((uint8_t*)object - _slab_objects(cache, slab)) / cache->size;
+
+	_slab_list_remove(_slab_list(cache, slab), slab);
+	uint32_t free = cache->objects_per_slab - slab->index;
+	_slab_free_stack(slab)[free] = index;
+	--slab->index;
+	--cache->nr_active;
+
+	// Keep a few empty slabs around, so a cache that's going up and down
+	//  doesn't keep going to the page allocator
+	if (slab->index == 0) {
+		if (cache->nr_empty >= SLAB_MAX_EMPTY) {
+			_slab_destroy(cache, slab);
+			return;
+		}
+		++cache->nr_empty;
+	}
+	_slab_list_add(_slab_list(cache, slab), slab);
+}
+
+page_t* _object_slab(kmem_cache_t* cache, void* object) {
+	uint32_t pfn = __to_phys(object) >> PAGE_SHIFT;
+	page_t* slab = pfn_to_page(pfn & ~((1U << cache->order) - 1));
+	if (pfn >= mem_map_pages || !(slab->flags & PG_SLAB) || slab->owner != cache)
+		panic("kmem_cache_free: %p isn't an object from %s\n", object, cache->name);
+
+	uint8_t* objects = _slab_objects(cache, slab);
+	uint32_t offset = (uint8_t*)object - objects;
+	if ((uint8_t*)object < objects || offset % cache->size != 0
+		|| offset / cache->size >= cache->objects_per_slab)
+		panic("kmem_cache_free: %p isn't an object from %s\n", object, cache->name);
+	return slab;
+}
+
+uint8_t* _slab_objects(kmem_cache_t* cache, page_t* slab) {
+	return (uint8_t*)page_to_virt(slab) + cache->objects_offset + slab->data;
+}
+
+uint16_t* _slab_free_stack(page_t* slab) {
+	return (uint16_t*)page_to_virt(slab);
+}
+
+page_t** _slab_list(kmem_cache_t* cache, page_t* slab) {
+	if (slab->index == 0)
+		return &cache->slabs_empty;
+	if (slab->index == cache->objects_per_slab)
+		return &cache->slabs_full;
+	return &cache->slabs_partial;
+}
+
+void _slab_list_add(page_t** list, page_t* slab) {
+	slab->prev = NULL;
+	slab->next = *list;
+	if (*list != NULL)
+		(*list)->prev = slab;
+	*list = slab;
+}
+
+void _slab_list_remove(page_t** list, page_t* slab) {
+	if (slab->prev != NULL)
+		slab->prev->next = slab->next;
+	else
+		*list = slab->next;
+	if (slab->next != NULL)
+		slab->next->prev = slab->prev;
+}
+
+void _magazine_refill(kmem_cache_t* cache, kmem_magazine_t* mag) {
+	spin_lock(&cache->lock);
+	while (mag->count < SLAB_MAGAZINE_BATCH) {
+		void* object = _slab_alloc_object(cache);
+		if (object == NULL)
+			break;
+		mag->objects[mag->count++] = object;
+	}
+	spin_unlock(&cache->lock);
+}
+
+void _magazine_flush(kmem_cache_t* cache, kmem_magazine_t* mag, uint32_t count) {
+	if (count == 0)
+		return;
+
+	spin_lock(&cache->lock);
+	for (uint32_t i = 0; i < count; ++i)
+		_slab_free_object(cache, mag->objects[i]);
+	spin_unlock(&cache->lock);
+
+	// Move the hotter objects that are left down to the bottom
+	for (uint32_t i = count; i < mag->count; ++i)
+		mag->objects[i - count] = mag->objects[i];
+	mag->count -= count;
+}
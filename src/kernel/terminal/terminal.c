@@ -3,7 +3,7 @@
 #include <namuos/terminal.h> // Implements
 
 #include <stddef.h>
-#include <string.h> // memmove
+#include <string.h> // memcpy, memmove
 #include <namuos/bios_defines.h>
 #include <namuos/paging.h> // __to_virt
 
@@ -17,6 +17,12 @@ static size_t EGA_WIDTH = 0;
 static size_t EGA_HEIGHT = 0;
 static uint16_t* EGA_BUFFER = (uint16_t*)0;
 
+// Write-back copy of `EGA_BUFFER`. Video memory is mapped write-combining,
+//  so reading it back is uncached. Scrolling moves the copy instead, and
+//  streams the result out, so video memory is only ever written.
+static uint16_t _terminal_shadow[TERMINAL_SHADOW_ENTRIES];
+static bool _terminal_shadowed = false;
+
 // Default and current terminal colours
 uint8_t default_colour;
 uint8_t current_colour;
@@ -55,17 +61,28 @@ bool terminal_initialise(multiboot_info_t* mb_info) {
 	EGA_WIDTH  = mb_info->framebuffer_width;
 	EGA_HEIGHT = mb_info->framebuffer_height;
 	EGA_BUFFER = __to_virt(VIDEO_MEMORY_ADDR_COLOUR);
+	_terminal_shadowed = (EGA_WIDTH * EGA_HEIGHT <= TERMINAL_SHADOW_ENTRIES);
 
 	// Set the current and default terminal colours
 	terminal_set_default_colour(TERMINAL_DEFAULT_BG, TERMINAL_DEFAULT_FG);
 	terminal_reset_colour();
 
 	// Clear the terminal!
+	terminal_clear();
+
+	return true;
+}
+
+void terminal_clear() {
 	for (uint32_t i = 0; i < EGA_WIDTH * EGA_HEIGHT; ++i) {
 		_terminal_set_entry(i, ' ');
 	}
+	next_row = 0;
+	next_col = 0;
+}
 
-	return true;
+bool terminal_shadowed() {
+	return _terminal_shadowed;
 }
 
 void terminal_set_default_colour(enum terminal_colour bg, enum terminal_colour fg) {
@@ -129,7 +146,10 @@ int terminal_write_char(char ch) {
 
 void _terminal_set_entry(uint32_t index, char ch) {
 	// Entry is 16 bits, structured as 8 bit colour followed by character.
-	EGA_BUFFER[index] = ((uint16_t)current_colour << 8) | (uint16_t)ch;
+	uint16_t entry = ((uint16_t)current_colour << 8) | (uint16_t)ch;
+	EGA_BUFFER[index] = entry;
+	if (_terminal_shadowed)
+		_terminal_shadow[index] = entry;
 }
 
 void _terminal_boundscheck() {
@@ -146,14 +166,21 @@ void _terminal_boundscheck() {
 		// Reset back to the previous line so we can continue printing at bottom
 		--next_row;
 
-		// Shift everything we've printed so far back one line
+		// Shift everything we've printed so far back one line. Reading video
+		//  memory is uncached, so shift the copy if there is one.
+		uint16_t* buffer = _terminal_shadowed ? _terminal_shadow : EGA_BUFFER;
 		uint32_t copied_entry_count = EGA_WIDTH * (EGA_HEIGHT - 1);
 		memmove(
-			(void*)EGA_BUFFER, // Moving here
-			(void*)EGA_BUFFER + EGA_WIDTH*2, // From here (each entry 2 bytes)
+			(void*)buffer, // Moving here
+			(void*)buffer + EGA_WIDTH*2, // From here (each entry 2 bytes)
 			copied_entry_count * 2
 		);
 
+		// Write the shifted lines out in one sequential pass, which the write
+		//  combining buffers turn into bursts
+		if (_terminal_shadowed)
+			memcpy(EGA_BUFFER, _terminal_shadow, copied_entry_count * 2);
+
 		// Clear the bottom line with empty characters so we can start printing
 		for (uint32_t i = 0; i < EGA_WIDTH; ++i)
 			_terminal_set_entry(copied_entry_count+i, ' ');
@@ -0,0 +1,468 @@
+/// @file vmalloc.c
+
+#include <namuos/vmalloc.h> // Implements
+
+#include <stdlib.h> // malloc, free
+#include <namuos/page_allocator.h>
+#include <namuos/panic.h>
+#include <namuos/slab.h>
+#include <namuos/spinlock.h>
+#include <namuos/terminal.h>
+
+
+// Recomputes the largest free range under a node of the free tree
+bool _vmap_augment(rb_node_t* node);
+
+// Finds the free range at the lowest address with at least `size` bytes, or
+//  returns NULL. The lock must be held.
+vmap_area_t* _vmap_find_lowest(uint32_t size);
+
+// Takes `size` bytes from the lowest free range that fits, purging the lazily
+//  unmapped areas if none does, and adds them to the busy tree as a new area.
+//  Returns NULL if there's no room, or no memory for the descriptor.
+vmap_area_t* _vmap_alloc_area(uint32_t size);
+
+// Adds the range of `va` to the free tree, merging it with the free ranges
+//  either side of it. `va` is freed if it's merged. The lock must be held.
+void _vmap_insert_free(vmap_area_t* va);
+
+// Adds `va` to the busy tree, and finds the area starting at `addr` in it. The
+//  lock must be held.
+void _vmap_insert_busy(vmap_area_t* va);
+vmap_area_t* _vmap_find_busy(uintptr_t addr);
+
+// Removes `va` from the busy tree and clears its mappings, without flushing
+//  them, leaving it on the purge list along with any pages it still owns.
+//  Purges if too many pages are waiting. Areas from `vmalloc_demand` must be
+//  unmapped already, and go straight back to the free tree. The lock must be
+//  held.
+void _vmap_release(vmap_area_t* va);
+
+// Flushes the TLB for every lazily unmapped area, then frees the pages of
+//  those from `vmalloc` and gives their ranges back to the free tree. The lock
+//  must be held.
+void _vmap_purge();
+
+// Allocates the pages for `size` bytes with `gfp` and maps them into a new area
+void* _vmalloc(size_t size, gfp_t gfp);
+
+// Maps `count` pages into a new area with `flags`, mapping runs of frames that
+//  are next to each other together. Returns NULL if there's no room, or no
+//  memory for page tables.
+void* _vmap_pages(page_t** pages, uint32_t count, paging_entry_t flags, uint32_t vm_flags);
+
+// Removes the area starting at `addr`, which must have `vm_flags`. Pages from
+//  `vmalloc` are freed by the purge that flushes their mappings. `caller` is
+//  used in the panic message.
+void _vmap_remove(const void* addr, uint32_t vm_flags, const char* caller);
+
+// Moves a page of an area from `vmalloc` to `new_page`, by pointing its entry
+//  and the area's array at the new page. The page's `data` is the area, and
+//  its `index` where in the area it is. Refuses once the area is unmapped.
+bool _vmalloc_migrate(page_t* page, page_t* new_page);
+
+
+// Free ranges ordered by address, each knowing the largest free range below
+//  it, and areas in use ordered by address
+static rb_root_t _vmap_free = RB_ROOT_INIT(_vmap_augment);
+static rb_root_t _vmap_busy = RB_ROOT_INIT(NULL);
+
+// Areas unmapped but not yet flushed, and the flush they're waiting on. Their
+//  ranges stay out of the free tree until then, so nothing can be mapped
+//  where the TLB may still hold an old entry.
+static vmap_area_t* _vmap_purge_list = NULL;
+static paging_gather_t _vmap_lazy_gather;
+
+// Held while changing either tree or the purge list
+static spinlock_t _vmap_lock = SPINLOCK_INIT;
+
+// Cache the area descriptors are allocated from
+static kmem_cache_t* _vmap_area_cache = NULL;
+
+// How compaction moves the pages of areas from `vmalloc`
+static const page_movable_ops_t _vmalloc_movable_ops = { .migrate = _vmalloc_migrate };
+
+vmalloc_stats_t vmalloc_stats;
+
+// Gets the area holding `node`
+#define _va(ptr) rb_entry(ptr, vmap_area_t, node)
+
+
+void vmalloc_initialise() {
+	_vmap_area_cache = kmem_cache_create("vmap_area", sizeof(vmap_area_t), 0, NULL);
+	vmap_area_t* va = (_vmap_area_cache != NULL) ? kmem_cache_alloc(_vmap_area_cache) : NULL;
+	if (va == NULL)
+		panic("vmalloc: No memory for the area descriptors\n");
+
+	paging_gather_init(&_vmap_lazy_gather, kernel_pgd);
+	va->start = VMALLOC_START;
+	va->end = VMALLOC_END;
+	spin_lock(&_vmap_lock);
+	_vmap_insert_free(va);
+	spin_unlock(&_vmap_lock);
+
+	klog_debug("vmalloc: 0x%p to 0x%p\n", VMALLOC_START, VMALLOC_END);
+}
+
+void* vmalloc(size_t size) {
+	return _vmalloc(size, GFP_HIGHMEM | GFP_MOVABLE);
+}
+
+void* vzalloc(size_t size) {
+	return _vmalloc(size, GFP_HIGHMEM | GFP_MOVABLE | GFP_ZERO);
+}
+
+void vfree(const void* addr) {
+	if (addr == NULL)
+		return;
+
+	_vmap_remove(addr, VM_ALLOC | VM_DEMAND, "vfree");
+}
+
+void* vmalloc_demand(size_t size) {
+	if (size == 0 || size >= VMALLOC_END - VMALLOC_START)
+		return NULL;
+
+	uint32_t count = PAGE_ALIGN(size) >> PAGE_SHIFT;
+	vmap_area_t* va = _vmap_alloc_area((count + 1) << PAGE_SHIFT);
+	if (va == NULL)
+		return NULL;
+	va->flags = VM_DEMAND;
+	va->nr_pages = count;
+
+	// Nothing's allocated until it's touched, so only page tables can run out
+	bool reserved = paging_map_anon(kernel_pgd, va->start, count, PAGE_KERNEL);
+	if (!reserved)
+		paging_unmap_anon(kernel_pgd, va->start, count);
+
+	spin_lock(&_vmap_lock);
+	vmalloc_stats.pages += count;
+	if (!reserved)
+		_vmap_release(va);
+	spin_unlock(&_vmap_lock);
+	return reserved ? (void*)va->start : NULL;
+}
+
+void* vmap(page_t** pages, uint32_t count, paging_entry_t flags) {
+	if (count == 0 || count >= (VMALLOC_END - VMALLOC_START) >> PAGE_SHIFT)
+		return NULL;
+	return _vmap_pages(pages, count, flags, VM_MAP);
+}
+
+void vunmap(const void* addr) {
+	if (addr == NULL)
+		return;
+	_vmap_remove(addr, VM_MAP, "vunmap");
+}
+
+void vmalloc_purge() {
+	spin_lock(&_vmap_lock);
+	_vmap_purge();
+	spin_unlock(&_vmap_lock);
+}
+
+page_t* vmalloc_to_page(const void* addr) {
+	if (!is_vmalloc_addr(addr))
+		return NULL;
+	PTE_t* pte = paging_get_pte(kernel_pgd, (uintptr_t)addr, false);
+	if (pte == NULL || !pte->present || pte->addr >= mem_map_pages)
+		return NULL;
+	return pfn_to_page(pte->addr);
+}
+
+void vmalloc_dump_stats() {
+	spin_lock(&_vmap_lock);
+	uint32_t largest = (_vmap_free.node != NULL) ? _va(_vmap_free.node)->subtree_max_size : 0;
+	klog_info(
+		"vmalloc: %d areas using %d pages, %d pages waiting to be purged, %d purges of %d areas, largest free range %d KiB\n",
+		vmalloc_stats.areas, vmalloc_stats.pages, vmalloc_stats.lazy_pages,
+		vmalloc_stats.purges, vmalloc_stats.purged_areas, largest >> 10);
+	spin_unlock(&_vmap_lock);
+}
+
+bool _vmap_augment(rb_node_t* node) {
+	vmap_area_t* va = _va(node);
+	uint32_t max = va->end - va->start;
+	if (node->left != NULL && _va(node->left)->subtree_max_size > max)
+		max = _va(node->left)->subtree_max_size;
+	if (node->right != NULL && _va(node->right)->subtree_max_size > max)
+		max = _va(node->right)->subtree_max_size;
+
+	if (va->subtree_max_size == max)
+		return false;
+	va->subtree_max_size = max;
+	return true;
+}
+
+vmap_area_t* _vmap_find_lowest(uint32_t size) {
+	rb_node_t* node = _vmap_free.node;
+	if (node == NULL || _va(node)->subtree_max_size < size)
+		return NULL;
+
+	// Lower addresses are to the left, so go left whenever something there
+	//  fits. Otherwise, if this range doesn't fit, one on the right must.
+	while (true) {
+		if (node->left != NULL && _va(node->left)->subtree_max_size >= size)
+			node = node->left;
+		else if (_va(node)->end - _va(node)->start >= size)
+			return _va(node);
+		else
+			node = node->right;
+	}
+}
+
+vmap_area_t* _vmap_alloc_area(uint32_t size) {
+	vmap_area_t* va = kmem_cache_alloc(_vmap_area_cache);
+	if (va == NULL)
+		return NULL;
+
+	spin_lock(&_vmap_lock);
+	vmap_area_t* range = _vmap_find_lowest(size);
+	if (range == NULL && _vmap_purge_list != NULL) {
+		_vmap_purge();
+		range = _vmap_find_lowest(size);
+	}
+	if (range == NULL) {
+		spin_unlock(&_vmap_lock);
+		kmem_cache_free(_vmap_area_cache, va);
+		klog_warning("vmalloc: No free range of %d KiB\n", size >> 10);
+		return NULL;
+	}
+
+	// Take the bottom of the range, so the free tree keeps its order
+	va->start = range->start;
+	va->end = range->start + size;
+	if (range->end == va->end) {
+		rb_erase(&_vmap_free, &range->node);
+		kmem_cache_free(_vmap_area_cache, range);
+	}
+	else {
+		range->start = va->end;
+		rb_propagate(&_vmap_free, &range->node);
+	}
+
+	va->flags = 0;
+	va->pages = NULL;
+	va->nr_pages = 0;
+	_vmap_insert_busy(va);
+	++vmalloc_stats.areas;
+	spin_unlock(&_vmap_lock);
+	return va;
+}
+
+void _vmap_insert_free(vmap_area_t* va) {
+	rb_node_t** link = &_vmap_free.node;
+	rb_node_t* parent = NULL;
+	while (*link != NULL) {
+		parent = *link;
+		link = (va->start < _va(parent)->start) ? &parent->left : &parent->right;
+	}
+
+	// The new range goes between `parent` and its neighbour on the other side
+	vmap_area_t* prev = NULL;
+	vmap_area_t* next = NULL;
+	if (parent != NULL && link == &parent->left) {
+		next = _va(parent);
+		rb_node_t* node = rb_prev(parent);
+		prev = (node != NULL) ? _va(node) : NULL;
+	}
+	else if (parent != NULL) {
+		prev = _va(parent);
+		rb_node_t* node = rb_next(parent);
+		next = (node != NULL) ? _va(node) : NULL;
+	}
+
+	bool merge_prev = prev != NULL && prev->end == va->start;
+	bool merge_next = next != NULL && next->start == va->end;
+	if (merge_prev && merge_next) {
+		uintptr_t end = next->end;
+		rb_erase(&_vmap_free, &next->node);
+		kmem_cache_free(_vmap_area_cache, next);
+		prev->end = end;
+		rb_propagate(&_vmap_free, &prev->node);
+	}
+	else if (merge_prev) {
+		prev->end = va->end;
+		rb_propagate(&_vmap_free, &prev->node);
+	}
+	else if (merge_next) {
+		next->start = va->start;
+		rb_propagate(&_vmap_free, &next->node);
+	}
+	else {
+		va->subtree_max_size = 0;
+		rb_insert(&_vmap_free, &va->node, parent, link);
+		return;
+	}
+	kmem_cache_free(_vmap_area_cache, va);
+}
+
+void _vmap_insert_busy(vmap_area_t* va) {
+	rb_node_t** link = &_vmap_busy.node;
+	rb_node_t* parent = NULL;
+	while (*link != NULL) {
+		parent = *link;
+		link = (va->start < _va(parent)->start) ? &parent->left : &parent->right;
+	}
+	rb_insert(&_vmap_busy, &va->node, parent, link);
+}
+
+vmap_area_t* _vmap_find_busy(uintptr_t addr) {
+	rb_node_t* node = _vmap_busy.node;
+	while (node != NULL) {
+		vmap_area_t* va = _va(node);
+		if (addr < va->start)
+			node = node->left;
+		else if (addr > va->start)
+			node = node->right;
+		else
+			return va;
+	}
+	return NULL;
+}
+
+void _vmap_release(vmap_area_t* va) {
+	rb_erase(&_vmap_busy, &va->node);
+	--vmalloc_stats.areas;
+	vmalloc_stats.pages -= va->nr_pages;
+
+	// Pages allocated on demand were unmapped and flushed before they were
+	//  freed, so the range can go straight back
+	if (va->flags & VM_DEMAND) {
+		_vmap_insert_free(va);
+		return;
+	}
+
+	paging_unmap_range_gather(kernel_pgd, va->start, va->nr_pages, &_vmap_lazy_gather);
+	va->purge_next = _vmap_purge_list;
+	_vmap_purge_list = va;
+	vmalloc_stats.lazy_pages += va->nr_pages;
+	if (vmalloc_stats.lazy_pages > VMAP_LAZY_MAX_PAGES)
+		_vmap_purge();
+}
+
+void _vmap_purge() {
+	if (_vmap_purge_list == NULL)
+		return;
+
+	// One flush covers every area, however many there are. A frame can't be
+	//  reused while a TLB entry may still point at it, so pages are only freed
+	//  after it. The page allocator never takes the lock, so that's safe here.
+	paging_gather_flush(&_vmap_lazy_gather);
+	while (_vmap_purge_list != NULL) {
+		vmap_area_t* va = _vmap_purge_list;
+		_vmap_purge_list = va->purge_next;
+		if (va->pages != NULL) {
+			for (uint32_t i = 0; i < va->nr_pages; ++i)
+				page_free_pfn(page_to_pfn(va->pages[i]), 0);
+			free(va->pages);
+			va->pages = NULL;
+		}
+		_vmap_insert_free(va);
+		++vmalloc_stats.purged_areas;
+	}
+	vmalloc_stats.lazy_pages = 0;
+	++vmalloc_stats.purges;
+}
+
+void* _vmalloc(size_t size, gfp_t gfp) {
+	if (size == 0 || size >= VMALLOC_END - VMALLOC_START)
+		return NULL;
+
+	uint32_t count = PAGE_ALIGN(size) >> PAGE_SHIFT;
+	page_t** pages = malloc(count * sizeof(page_t*));
+	if (pages == NULL)
+		return NULL;
+
+	uint32_t allocated = 0;
+	for (; allocated < count; ++allocated) {
+		uint32_t pfn = page_alloc_pfn(0, gfp);
+		if (pfn == PAGE_PFN_NONE)
+			break;
+		pages[allocated] = pfn_to_page(pfn);
+	}
+
+	void* addr = (allocated == count) ? _vmap_pages(pages, count, PAGE_KERNEL, VM_ALLOC) : NULL;
+	if (addr == NULL) {
+		for (uint32_t i = 0; i < allocated; ++i)
+			page_free_pfn(page_to_pfn(pages[i]), 0);
+		free(pages);
+	}
+	return addr;
+}
+
+void* _vmap_pages(page_t** pages, uint32_t count, paging_entry_t flags, uint32_t vm_flags) {
+	// Leave a guard page after the area, so overruns fault
+	vmap_area_t* va = _vmap_alloc_area((count + 1) << PAGE_SHIFT);
+	if (va == NULL)
+		return NULL;
+	va->flags = vm_flags;
+	va->pages = pages;
+	va->nr_pages = count;
+
+	// The range was flushed before it went back in the free tree, so nothing
+	//  needs invalidating
+	uint32_t run;
+	for (uint32_t i = 0; i < count; i += run) {
+		uint32_t pfn = page_to_pfn(pages[i]);
+		for (run = 1; i + run < count && page_to_pfn(pages[i + run]) == pfn + run; ++run)
+			;
+		uintptr_t vaddr = va->start + (i << PAGE_SHIFT);
+		if (!paging_map_range(kernel_pgd, vaddr, PFN_PHYS(pfn), run, flags, PAGE_CACHE_WB)) {
+			// The pages go back to the caller, so flush straight away
+			spin_lock(&_vmap_lock);
+			vmalloc_stats.pages += count;
+			va->pages = NULL;
+			_vmap_release(va);
+			_vmap_purge();
+			spin_unlock(&_vmap_lock);
+			return NULL;
+		}
+	}
+
+	// Pages from `vmalloc` are only mapped here, so compaction can move them
+	//  by rewriting their entries
+	if (vm_flags & VM_ALLOC) {
+		for (uint32_t i = 0; i < count; ++i) {
+			pages[i]->index = i;
+			pages[i]->data = (uint32_t)va;
+			page_set_movable(page_to_pfn(pages[i]), &_vmalloc_movable_ops);
+		}
+	}
+
+	spin_lock(&_vmap_lock);
+	vmalloc_stats.pages += count;
+	spin_unlock(&_vmap_lock);
+	return (void*)va->start;
+}
+
+void _vmap_remove(const void* addr, uint32_t vm_flags, const char* caller) {
+	spin_lock(&_vmap_lock);
+	vmap_area_t* va = _vmap_find_busy((uintptr_t)addr);
+	if (va == NULL || !(va->flags & vm_flags)) {
+		spin_unlock(&_vmap_lock);
+		panic("%s: 0x%p isn't the start of an area it can free\n", caller, addr);
+	}
+
+	// Pages from `vmap` belong to the caller, and pages allocated by faults
+	//  are only known to the page tables, so they're freed as they're unmapped
+	if (!(va->flags & VM_ALLOC))
+		va->pages = NULL;
+	if (va->flags & VM_DEMAND)
+		paging_unmap_anon(kernel_pgd, va->start, va->nr_pages);
+	_vmap_release(va);
+	spin_unlock(&_vmap_lock);
+}
+
+bool _vmalloc_migrate(page_t* page, page_t* new_page) {
+	vmap_area_t* va = (vmap_area_t*)page->data;
+	uintptr_t vaddr = va->start + (page->index << PAGE_SHIFT);
+	PTE_t* pte = paging_get_pte(kernel_pgd, vaddr, false);
+	if (pte == NULL || !pte->present || pte->addr != page_to_pfn(page))
+		return false;
+
+	pte->addr = page_to_pfn(new_page);
+	invalidate_page((void*)vaddr);
+	va->pages[page->index] = new_page;
+	return true;
+}
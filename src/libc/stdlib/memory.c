@@ -0,0 +1,305 @@
+/// @file memory.c
+
+#include <stdlib.h> // Implements
+
+#if defined(__is_libk)
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h> // memcpy, memset
+#include <namuos/page_allocator.h>
+#include <namuos/page_mem.h>
+#include <namuos/paging.h>
+#include <namuos/panic.h>
+#include <namuos/slab.h>
+#else
+#error "Dynamic memory management is not implemented outside of kernel"
+#endif
+
+
+// If `free_sized` and `free_aligned_sized` check the size they're given
+//  against the allocation, rather than trusting it. Off by default, as it
+//  costs the lookups the hint is there to avoid.
+#ifndef HEAP_DEBUG
+#define HEAP_DEBUG 0
+#endif
+
+// Alignment of every allocation, enough for any type with fundamental alignment
+#define HEAP_ALIGN 16
+
+// Largest allocation served from the size class caches. Anything larger gets
+//  a span of whole pages straight from the page allocator.
+#define HEAP_MAX_SMALL 4096
+
+// Size classes: every power of two from 16 bytes, and halfway between each
+//  from 32 bytes, so no more than a third of an object is wasted
+static const uint32_t _heap_class_sizes[] = {
+	16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096,
+};
+static const char* const _heap_class_names[] = {
+	"malloc-16", "malloc-32", "malloc-48", "malloc-64", "malloc-96",
+	"malloc-128", "malloc-192", "malloc-256", "malloc-384", "malloc-512",
+	"malloc-768", "malloc-1024", "malloc-1536", "malloc-2048", "malloc-3072",
+	"malloc-4096",
+};
+#define HEAP_NR_CLASSES (sizeof(_heap_class_sizes) / sizeof(_heap_class_sizes[0]))
+
+// Cache for each size class, created on the first allocation
+static kmem_cache_t* _heap_caches[HEAP_NR_CLASSES];
+static bool _heap_ready = false;
+
+// Size class to use for each size, in units of HEAP_ALIGN rounded up
+static uint8_t _heap_class_index[HEAP_MAX_SMALL / HEAP_ALIGN + 1];
+
+// Creates the size class caches. Returns false if any couldn't be created.
+bool _heap_initialise();
+
+// Gets the cache for allocations of `size` bytes, up to HEAP_MAX_SMALL
+kmem_cache_t* _heap_size_cache(size_t size);
+
+// Allocates a span of whole pages for `size` bytes, aligned to at least
+//  `align`. Zeroes it if `zero` is set and it isn't already known to be zero.
+void* _heap_span_alloc(size_t size, size_t align, bool zero);
+
+// Frees a span from `_heap_span_alloc`
+void _heap_span_free(page_t* page);
+
+// Gets the descriptor of the page `ptr` is in, or panics if `ptr` can't be
+//  from the heap. `caller` is used in the panic message.
+page_t* _heap_page(void* ptr, const char* caller);
+
+// Gets the descriptor of the first page of the span at `ptr`, or panics if
+//  `ptr` isn't the start of a span
+page_t* _heap_span_page(void* ptr, const char* caller);
+
+// Frees `ptr` of `size` bytes, from a size class cache if `small` is set and
+//  a span otherwise, without looking at its page descriptors
+void _heap_free_hinted(void* ptr, size_t size, bool small, const char* caller);
+
+
+void* malloc(size_t size) {
+	if (size == 0)
+		return NULL;
+	if (!_heap_ready && !_heap_initialise())
+		return NULL;
+
+	if (size <= HEAP_MAX_SMALL)
+		return kmem_cache_alloc(_heap_size_cache(size));
+	return _heap_span_alloc(size, PAGE_SIZE, false);
+}
+
+void* calloc(size_t num, size_t size) {
+	if (num == 0 || size == 0)
+		return NULL;
+	if (size > SIZE_MAX / num)
+		return NULL; // Overflow
+	size *= num;
+
+	// Spans know if their pages are zero already, so only zero them if needed
+	if (size > HEAP_MAX_SMALL) {
+		if (!_heap_ready && !_heap_initialise())
+			return NULL;
+		return _heap_span_alloc(size, PAGE_SIZE, true);
+	}
+
+	void* ptr = malloc(size);
+	if (ptr != NULL)
+		memset(ptr, 0, size);
+	return ptr;
+}
+
+void* realloc(void* ptr, size_t new_size) {
+	if (ptr == NULL)
+		return malloc(new_size);
+	if (new_size == 0) {
+		free(ptr);
+		return NULL;
+	}
+
+	// Objects stay where they are if the new size has the same size class, so
+	//  `free_sized` with the new size finds the right cache. Moving them into
+	//  a smaller class gives back the memory too.
+	size_t old_size;
+	page_t* page = _heap_page(ptr, "realloc");
+	if (page->flags & PG_SLAB) {
+		kmem_cache_t* cache = (kmem_cache_t*)page->owner;
+		old_size = cache->object_size;
+		if (new_size <= HEAP_MAX_SMALL && _heap_size_cache(new_size) == cache)
+			return ptr;
+	}
+	else if (new_size <= HEAP_MAX_SMALL) {
+		// Likewise, spans that shrink small enough move into a size class
+		page = _heap_span_page(ptr, "realloc");
+		old_size = page->data << PAGE_SHIFT;
+	}
+	else {
+		page = _heap_span_page(ptr, "realloc");
+		uint32_t pfn = page_to_pfn(page);
+		uint32_t pages = page->data;
+		uint32_t new_pages = (new_size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+		// Shrink spans in place, giving back the pages off the end
+		if (new_pages <= pages) {
+			if (new_pages < pages)
+				page_free_pfn_exact(pfn + new_pages, pages - new_pages);
+			page->data = new_pages;
+			return ptr;
+		}
+
+		// Grow spans in place if the pages right after them are free
+		if (page_claim_pfn_range(pfn + pages, new_pages - pages)) {
+			page->data = new_pages;
+			return ptr;
+		}
+		old_size = pages << PAGE_SHIFT;
+	}
+
+	// Otherwise, move it somewhere it does fit
+	void* new_ptr = malloc(new_size);
+	if (new_ptr == NULL)
+		return NULL;
+	if (!(page->flags & PG_SLAB) && new_size > HEAP_MAX_SMALL) {
+		// Spans only move to grow, so the whole of the old one is copied, and
+		//  both are made of whole pages
+		for (uint32_t i = 0; i < page->data; ++i)
+			copy_page((uint8_t*)new_ptr + (i << PAGE_SHIFT), (uint8_t*)ptr + (i << PAGE_SHIFT));
+	}
+	else
+		memcpy(new_ptr, ptr, (old_size < new_size) ? old_size : new_size);
+	free(ptr);
+	return new_ptr;
+}
+
+void free(void* ptr) {
+	if (ptr == NULL)
+		return;
+
+	page_t* page = _heap_page(ptr, "free");
+	if (page->flags & PG_SLAB)
+		kmem_cache_free((kmem_cache_t*)page->owner, ptr);
+	else
+		_heap_span_free(_heap_span_page(ptr, "free"));
+}
+
+void free_sized(void* ptr, size_t size) {
+	if (ptr == NULL)
+		return;
+	_heap_free_hinted(ptr, size, size <= HEAP_MAX_SMALL, "free_sized");
+}
+
+void free_aligned_sized(void* ptr, size_t alignment, size_t size) {
+	if (ptr == NULL)
+		return;
+	// Matches where `aligned_alloc` got the memory from
+	bool small = alignment <= HEAP_ALIGN && size <= HEAP_MAX_SMALL;
+	_heap_free_hinted(ptr, size, small, "free_aligned_sized");
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+		return NULL;
+
+	// Every allocation is aligned well enough already for small alignments.
+	//  Anything more gets a span, which is at least page aligned.
+	if (alignment <= HEAP_ALIGN)
+		return malloc(size);
+	if (size == 0)
+		return NULL;
+	if (!_heap_ready && !_heap_initialise())
+		return NULL;
+	return _heap_span_alloc(size, alignment, false);
+}
+
+bool _heap_initialise() {
+	for (uint32_t i = 0; i < HEAP_NR_CLASSES; ++i) {
+		if (_heap_caches[i] == NULL)
+			_heap_caches[i] = kmem_cache_create(_heap_class_names[i], _heap_class_sizes[i], HEAP_ALIGN, NULL);
+		if (_heap_caches[i] == NULL)
+			return false;
+	}
+
+	// Work out the smallest class for each size, so lookups are one load
+	uint32_t index = 0;
+	for (uint32_t units = 0; units <= HEAP_MAX_SMALL / HEAP_ALIGN; ++units) {
+		while (_heap_class_sizes[index] < units * HEAP_ALIGN)
+			++index;
+		_heap_class_index[units] = index;
+	}
+
+	_heap_ready = true;
+	return true;
+}
+
+kmem_cache_t* _heap_size_cache(size_t size) {
+	return _heap_caches[_heap_class_index[(size + HEAP_ALIGN - 1) / HEAP_ALIGN]];
+}
+
+void* _heap_span_alloc(size_t size, size_t align, bool zero) {
+	if (size > ((size_t)1 << (PAGE_MAX_ORDER - 1)) * PAGE_SIZE)
+		return NULL;
+
+	// Spans are aligned to the power of two number of pages that fits them,
+	//  so ask for enough pages to get the alignment, then give back the rest
+	uint32_t pages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	uint32_t align_pages = align >> PAGE_SHIFT;
+	uint32_t alloc_pages = (pages > align_pages) ? pages : align_pages;
+
+	// The page allocator only zeroes pages that aren't known to be zero already
+	gfp_t gfp = zero ? GFP_KERNEL | GFP_ZERO : GFP_KERNEL;
+	uint32_t pfn = page_alloc_pfn_exact(alloc_pages, gfp);
+	if (pfn == PAGE_PFN_NONE)
+		return NULL;
+	if (alloc_pages > pages)
+		page_free_pfn_exact(pfn + pages, alloc_pages - pages);
+
+	page_t* page = pfn_to_page(pfn);
+	page->flags |= PG_SPAN;
+	page->data = pages;
+	return page_to_virt(page);
+}
+
+void _heap_span_free(page_t* page) {
+	page->flags &= ~PG_SPAN;
+	page_free_pfn_exact(page_to_pfn(page), page->data);
+}
+
+page_t* _heap_page(void* ptr, const char* caller) {
+	uintptr_t addr = (uintptr_t)ptr;
+	if (addr < PAGE_OFFSET || (__to_phys(addr) >> PAGE_SHIFT) >= mem_map_pages)
+		panic("%s: %p wasn't allocated by malloc\n", caller, ptr);
+	return virt_to_page(ptr);
+}
+
+page_t* _heap_span_page(void* ptr, const char* caller) {
+	page_t* page = _heap_page(ptr, caller);
+	if (((uintptr_t)ptr & (PAGE_SIZE - 1)) != 0 || !(page->flags & PG_SPAN))
+		panic("%s: %p wasn't allocated by malloc\n", caller, ptr);
+	return page;
+}
+
+void _heap_free_hinted(void* ptr, size_t size, bool small, const char* caller) {
+	if (size == 0)
+		panic("%s: %p freed with size 0\n", caller, ptr);
+
+	// The size picks the cache or the number of pages, so only the span's
+	//  own flag has to be touched
+	if (small) {
+		kmem_cache_t* cache = _heap_size_cache(size);
+		#if HEAP_DEBUG
+		page_t* page = _heap_page(ptr, caller);
+		if (!(page->flags & PG_SLAB) || page->owner != cache)
+			panic("%s: %p freed with size %d, but isn't from %s\n", caller, ptr, size, cache->name);
+		#endif
+		kmem_cache_free(cache, ptr);
+	}
+	else {
+		uint32_t pages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+		page_t* page = virt_to_page(ptr);
+		#if HEAP_DEBUG
+		page = _heap_span_page(ptr, caller);
+		if (page->data != pages)
+			panic("%s: %p freed with size %d, but is a span of %d pages\n", caller, ptr, size, page->data);
+		#endif
+		page->flags &= ~PG_SPAN;
+		page_free_pfn_exact(page_to_pfn(page), pages);
+	}
+}